@@ -165,194 +165,202 @@ const char *rtttlBuiltinMelodyRandom(void)
 
 #define OCTAVE_OFFSET 0
 
-void rtttlMelody(const char *melodyStr, int16_t *pFreqDur, const int nFreqDur)
+bool rtttlInit(RTTTL_STATE_t *pState, const char *melodyStr)
 {
     // from http://domoticx.com/arduino-melodie-afspelen-rtttl/
     // Copyright 2017 DomoticX
 
-    // Absolutely no error checking in here
-
-    const int16_t notes[] =
-    { 0,
-      RTTTL_NOTE_C4, RTTTL_NOTE_CS4, RTTTL_NOTE_D4, RTTTL_NOTE_DS4, RTTTL_NOTE_E4, RTTTL_NOTE_F4, RTTTL_NOTE_FS4, RTTTL_NOTE_G4, RTTTL_NOTE_GS4, RTTTL_NOTE_A4, RTTTL_NOTE_AS4, RTTTL_NOTE_B4,
-      RTTTL_NOTE_C5, RTTTL_NOTE_CS5, RTTTL_NOTE_D5, RTTTL_NOTE_DS5, RTTTL_NOTE_E5, RTTTL_NOTE_F5, RTTTL_NOTE_FS5, RTTTL_NOTE_G5, RTTTL_NOTE_GS5, RTTTL_NOTE_A5, RTTTL_NOTE_AS5, RTTTL_NOTE_B5,
-      RTTTL_NOTE_C6, RTTTL_NOTE_CS6, RTTTL_NOTE_D6, RTTTL_NOTE_DS6, RTTTL_NOTE_E6, RTTTL_NOTE_F6, RTTTL_NOTE_FS6, RTTTL_NOTE_G6, RTTTL_NOTE_GS6, RTTTL_NOTE_A6, RTTTL_NOTE_AS6, RTTTL_NOTE_B6,
-      RTTTL_NOTE_C7, RTTTL_NOTE_CS7, RTTTL_NOTE_D7, RTTTL_NOTE_DS7, RTTTL_NOTE_E7, RTTTL_NOTE_F7, RTTTL_NOTE_FS7, RTTTL_NOTE_G7, RTTTL_NOTE_GS7, RTTTL_NOTE_A7, RTTTL_NOTE_AS7, RTTTL_NOTE_B7
-    };
-
-    //int16_t melody[2 * RTTTL_MELODY_N + 1];
-    int16_t melodyIx = 0;
+    // The melodies may come from the backend, so the control section is checked and we never read
+    // past the end of the string. The notes are parsed leniently in rtttlNext().
 
     uint8_t default_dur = 4;
     uint8_t default_oct = 6;
     int16_t bpm = 63;
     int16_t num;
-    int32_t wholenote;
-    int32_t duration;
-    uint8_t note;
-    uint8_t scale;
-    const int melodyStrLen = strlen(melodyStr);
-    char melodyCopy[melodyStrLen + 1];
-    strcpy(melodyCopy, melodyStr);
-    const char *p = melodyCopy;
+    const char *p = melodyStr;
+    bool ok = true;
 
-    // format: d=N,o=N,b=NNN:
+    // format: name:d=N,o=N,b=NNN:notes (each of d, o and b is optional)
     // find the start (skip name, etc)
 
-    while(*p != ':') p++;    // ignore name
-    p++;                     // skip ':'
+    while(*p && (*p != ':')) p++;    // ignore name
+    if(*p == ':') p++;       // skip ':'
+    else ok = false;
 
-    // get default duration
-    if(*p == 'd')
+    // get default duration, octave and BPM
+    while(ok && (*p != ':'))
     {
-        p++; p++;              // skip "d="
+        const char key = *p;
+        if(!key || (p[1] != '=') || !isdigit((int)p[2]))
+        {
+            ok = false;
+            break;
+        }
+        p += 2;                // skip "x="
         num = 0;
         while(isdigit((int)(*p)))
         {
-            num = (num * 10) + (*p++ - '0');
+            if(num < 1000) num = (num * 10) + (*p - '0');
+            p++;
         }
-        if(num > 0) default_dur = num;
-        p++;                   // skip comma
+        switch(key)
+        {
+            case 'd':
+                if(num > 0 && num <= 255) default_dur = num;
+                break;
+            case 'o':
+                if(num >= 3 && num <=7) default_oct = num;
+                break;
+            case 'b':
+                bpm = num > 0 ? num : 63;
+                break;
+            default:
+                ok = false;
+        }
+        if(*p == ',') p++;     // skip comma
+        else if(*p != ':') ok = false;
     }
+    if(ok) p++;                // skip colon
 
     //Serial.print("ddur: "); Serial.println(default_dur, 10);
+    //Serial.print("doct: "); Serial.println(default_oct, 10);
+    //Serial.print("bpm: "); Serial.println(bpm, 10);
 
-    // get default octave
-    if(*p == 'o')
-    {
-        p++; p++;              // skip "o="
-        num = *p++ - '0';
-        if(num >= 3 && num <=7) default_oct = num;
-        p++;                   // skip comma
-    }
+    // BPM usually expresses the number of quarter notes per minute
+    pState->wholenote = (60 * 1000L / bpm) * 4;  // this is the time for whole note (in milliseconds)
+    pState->defaultDur = default_dur;
+    pState->defaultOct = default_oct;
+    pState->p = ok ? p : ""; // no notes for a bad melody
 
-    //Serial.print("doct: "); Serial.println(default_oct, 10);
+    //Serial.print("wn: "); Serial.println(wholenote, 10);
+
+    return ok;
+}
 
-    // get BPM
-    if(*p == 'b')
+bool rtttlNext(RTTTL_STATE_t *pState, int16_t *pFreq, int16_t *pDur)
+{
+    static const int16_t notes[] =
+    { 0,
+      RTTTL_NOTE_C4, RTTTL_NOTE_CS4, RTTTL_NOTE_D4, RTTTL_NOTE_DS4, RTTTL_NOTE_E4, RTTTL_NOTE_F4, RTTTL_NOTE_FS4, RTTTL_NOTE_G4, RTTTL_NOTE_GS4, RTTTL_NOTE_A4, RTTTL_NOTE_AS4, RTTTL_NOTE_B4,
+      RTTTL_NOTE_C5, RTTTL_NOTE_CS5, RTTTL_NOTE_D5, RTTTL_NOTE_DS5, RTTTL_NOTE_E5, RTTTL_NOTE_F5, RTTTL_NOTE_FS5, RTTTL_NOTE_G5, RTTTL_NOTE_GS5, RTTTL_NOTE_A5, RTTTL_NOTE_AS5, RTTTL_NOTE_B5,
+      RTTTL_NOTE_C6, RTTTL_NOTE_CS6, RTTTL_NOTE_D6, RTTTL_NOTE_DS6, RTTTL_NOTE_E6, RTTTL_NOTE_F6, RTTTL_NOTE_FS6, RTTTL_NOTE_G6, RTTTL_NOTE_GS6, RTTTL_NOTE_A6, RTTTL_NOTE_AS6, RTTTL_NOTE_B6,
+      RTTTL_NOTE_C7, RTTTL_NOTE_CS7, RTTTL_NOTE_D7, RTTTL_NOTE_DS7, RTTTL_NOTE_E7, RTTTL_NOTE_F7, RTTTL_NOTE_FS7, RTTTL_NOTE_G7, RTTTL_NOTE_GS7, RTTTL_NOTE_A7, RTTTL_NOTE_AS7, RTTTL_NOTE_B7
+    };
+
+    int16_t num;
+    int32_t duration;
+    uint8_t note;
+    uint8_t scale;
+    const char *p = pState->p;
+
+    // end of melody
+    if(!*p)
     {
-        p++; p++;              // skip "b="
-        num = 0;
-        while(isdigit((int)(*p)))
-        {
-            num = (num * 10) + (*p++ - '0');
-        }
-        bpm = num;
-        p++;                   // skip colon
+        return false;
     }
 
-    //Serial.print("bpm: "); Serial.println(bpm, 10);
-
-    // BPM usually expresses the number of quarter notes per minute
-    wholenote = (60 * 1000L / bpm) * 4;  // this is the time for whole note (in milliseconds)
+    // first, get note duration, if available
+    num = 0;
+    while(isdigit((int)(*p)))
+    {
+        num = (num * 10) + (*p++ - '0');
+    }
 
-    //Serial.print("wn: "); Serial.println(wholenote, 10);
+    if(num) duration = pState->wholenote / num;
+    else duration = pState->wholenote / pState->defaultDur;  // we will need to check if we are a dotted note after
 
+    // now get the note
+    note = 0;
 
-    // now begin note loop
-    while(*p)
+    switch(*p)
     {
-        // first, get note duration, if available
-        num = 0;
-        while(isdigit((int)(*p)))
-        {
-            num = (num * 10) + (*p++ - '0');
-        }
+        case 'c':
+            note = 1;
+            break;
+        case 'd':
+            note = 3;
+            break;
+        case 'e':
+            note = 5;
+            break;
+        case 'f':
+            note = 6;
+            break;
+        case 'g':
+            note = 8;
+            break;
+        case 'a':
+            note = 10;
+            break;
+        case 'b':
+            note = 12;
+            break;
+        case 'p':
+        default:
+            note = 0;
+    }
+    if(*p) p++;
 
-        if(num) duration = wholenote / num;
-        else duration = wholenote / default_dur;  // we will need to check if we are a dotted note after
+    // now, get optional '#' sharp
+    if(*p == '#')
+    {
+        note++;
+        p++;
+    }
 
-        // now get the note
-        note = 0;
+    // now, get optional '.' dotted note
+    if(*p == '.')
+    {
+        duration += duration/2;
+        p++;
+    }
 
-        switch(*p)
-        {
-            case 'c':
-                note = 1;
-                break;
-            case 'd':
-                note = 3;
-                break;
-            case 'e':
-                note = 5;
-                break;
-            case 'f':
-                note = 6;
-                break;
-            case 'g':
-                note = 8;
-                break;
-            case 'a':
-                note = 10;
-                break;
-            case 'b':
-                note = 12;
-                break;
-            case 'p':
-            default:
-                note = 0;
-        }
+    // now, get scale
+    if(isdigit((int)(*p)))
+    {
+        scale = *p - '0';
         p++;
+    }
+    else
+    {
+        scale = pState->defaultOct;
+    }
 
-        // now, get optional '#' sharp
-        if(*p == '#')
-        {
-            note++;
-            p++;
-        }
+    scale += OCTAVE_OFFSET;
 
-        // now, get optional '.' dotted note
-        if(*p == '.')
-        {
-            duration += duration/2;
-            p++;
-        }
+    if(*p == ',')
+        p++;       // skip comma for next note (or we may be at the end)
 
-        // now, get scale
-        if(isdigit((int)(*p)))
-        {
-            scale = *p - '0';
-            p++;
-        }
-        else
-        {
-            scale = default_oct;
-        }
+    pState->p = p;
 
-        scale += OCTAVE_OFFSET;
+    // now play the note
+    const int16_t dur = duration;
+    if (note && (scale >= 4) && (scale <= 7))
+    {
+        *pFreq = notes[(scale - 4) * 12 + note];
+        //DEBUG("note: RTTTL %4d %4d", *pFreq, dur);
+    }
+    else
+    {
+        *pFreq = RTTTL_NOTE_PAUSE;
+        //DEBUG("note: RTTTL ---- %4d", dur);
+    }
+    *pDur = dur;
 
-        if(*p == ',')
-            p++;       // skip comma for next note (or we may be at the end)
+    return true;
+}
 
-        // now play the note
-        const int16_t dur = duration;
-        if (note)
-        {
-            const int16_t freq = notes[(scale - 4) * 12 + note];
-            pFreqDur[melodyIx] = freq;
-            melodyIx++;
-            //DEBUG("note: RTTTL %4d %4d", freq, dur);
-
-            //Serial.print("Playing: ");
-            //Serial.print(scale, 10); Serial.print(' ');
-            //Serial.print(note, 10); Serial.print(" (");
-            //Serial.print(notes[(scale - 4) * 12 + note], 10);
-            //Serial.print(") ");
-            //Serial.println(duration, 10);
-            //tone1.play(notes[(scale - 4) * 12 + note]);
-            //delay(duration);
-            //tone1.stop();
-        }
-        else
-        {
-            pFreqDur[melodyIx] = RTTTL_NOTE_PAUSE;
-            melodyIx++;
-            //DEBUG("note: RTTTL ---- %4d", dur);
+void rtttlMelody(const char *melodyStr, int16_t *pFreqDur, const int nFreqDur)
+{
+    RTTTL_STATE_t state;
+    rtttlInit(&state, melodyStr);
 
-            //Serial.print("Pausing: ");
-            //Serial.println(duration, 10);
-            //delay(duration);
-        }
+    int16_t melodyIx = 0;
+    int16_t freq, dur;
+    while (rtttlNext(&state, &freq, &dur))
+    {
+        pFreqDur[melodyIx] = freq;
+        melodyIx++;
         pFreqDur[melodyIx] = dur;
         melodyIx++;
 
@@ -364,4 +372,3 @@ void rtttlMelody(const char *melodyStr, int16_t *pFreqDur, const int nFreqDur)
 
     pFreqDur[melodyIx] = RTTTL_NOTE_END;
 }
-
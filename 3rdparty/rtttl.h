@@ -4,12 +4,28 @@
 #define __RTTTL_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 
 // takes a https://en.wikipedia.org/wiki/Ring_Tone_Transfer_Language melody,
 // (s.a. http://merwin.bespin.org/t4a/specs/nokia_rtttl.txt)
 // and fills in a list of frequency and duration pairs
 void rtttlMelody(const char *melodyStr, int16_t *pFreqDur, const int nFreqDur);
 
+// parser state for rtttlInit() and rtttlNext()
+typedef struct RTTTL_STATE_s
+{
+    const char *p;
+    int32_t wholenote;
+    uint8_t defaultDur;
+    uint8_t defaultOct;
+} RTTTL_STATE_t;
+
+// same as rtttlMelody(), but note by note (the melody string must remain valid until the end),
+// rtttlNext() returns false at the end of the melody, rtttlInit() returns false (and rtttlNext() has
+// no notes) if the melody is malformed (no "name:control:" part or bad control section)
+bool rtttlInit(RTTTL_STATE_t *pState, const char *melodyStr);
+bool rtttlNext(RTTTL_STATE_t *pState, int16_t *pFreq, int16_t *pDur);
+
 const char *rtttlBuiltinMelody(const char *name);
 
 const char *rtttlBuiltinMelodyRandom(void);
@@ -7,6 +7,7 @@
 #define configGENERATE_RUN_TIME_STATS              1
 #define configMINIMAL_STACK_SIZE                   256
 //#define configUSE_IDLE_HOOK                      1
+#define configUSE_TICK_HOOK                        1
 #define configSUPPORT_STATIC_ALLOCATION            1
 //#define configTIMER_QUEUE_LENGTH                 3
 #define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()   /* nothing */
@@ -26,4 +26,53 @@ CONFIG_BACKENDURL = ""
 # e.g. CONFIG_CRTFILE = server.crt
 CONFIG_CRTFILE = 
 
+# LED frame rate [Hz] (10..500), e.g. 25 for low-power setups, the frame period is rounded to
+# whole RTOS ticks (10ms with the default configTICK_RATE_HZ of 100, see FreeRTOSConfig.h), so
+# rates above 100 need a faster tick, the effects run at the same speed regardless
+CONFIG_LEDSFPS = 100
+
+# number of LEDs on a second strip connected to the I2S output (GPIO 3 = data, GPIO 15 = clock),
+# these are the last LEDs (channels), 0 = no second strip, the LED driver (WS2801 or SK9822) and
+# colour order (RGB, RBG, GRB, GBR, BRG or BGR) for that strip can be set if they are different
+# from the backend config, both strips are updated simultaneously
+CONFIG_LEDSI2S = 0
+#CONFIG_LEDSI2SDRIVER = SK9822
+#CONFIG_LEDSI2SORDER = BGR
+
+# generate notes from about 1.2kHz upwards using the sigma-delta modulator (1) instead of toggling
+# the GPIO from the timer interrupt (0), this saves a lot of interrupts but is a bit quieter
+CONFIG_TONESDM = 1
+
+# send debug messages as compact binary records (1) instead of text (0), this saves a lot of CPU
+# and UART bandwidth, "make debug" decodes them (using the string table from the build)
+CONFIG_LOGBIN = 0
+
+# highest debug level (NONE, ERROR, WARNING, NOTICE, PRINT or DEBUG), messages above this are
+# compiled out, the levels can be lowered per module at run-time (backend command, e.g.
+# "loglevel backend warning" or "loglevel all print")
+CONFIG_LOGLEVEL = DEBUG
+
+# send the debug output to a collector host via UDP (host name or IP address, empty to disable),
+# the output is collected and sent every CONFIG_NETLOGPERIOD [ms], receive it using
+# "tools/debug.pl udp:6455"
+CONFIG_NETLOGHOST =
+CONFIG_NETLOGPORT = 6455
+CONFIG_NETLOGPERIOD = 2000
+
+# use static buffers (1) instead of the heap (0) for the fixed size allocations (JSON tokens,
+# monitor), this costs about 4kB of RAM but these can no longer fail or fragment the heap (see
+# the "mon: heap" output)
+CONFIG_HEAPPOOLS = 0
+
+# send a telemetry record (heap, task load and stack, interrupt load, backend connection) to the
+# backend every CONFIG_TELEMETRYPERIOD [s] (0 to disable), with a https backend URL it's only sent
+# when connecting (there's not enough memory for a second SSL connection)
+CONFIG_TELEMETRYPERIOD = 300
+
+# run the Jenkins state handling, the status LED timing and the monitor as jobs in a single
+# scheduler task (1) instead of in their own tasks and timer (0), this saves 1792 bytes of task
+# stack (448 instead of 512 + 384 words), one task control block and the timer
+# (see the "mon: sched" output for the runtime of the jobs)
+CONFIG_SCHED = 0
+
 # eof
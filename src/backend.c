@@ -14,6 +14,7 @@
 #include <lwip/netif.h>
 
 #include "stuff.h"
+#define DEBUG_MOD DEBUG_MOD_BACKEND
 #include "debug.h"
 #include "wifi.h"
 #include "jenkins.h"
@@ -21,6 +22,9 @@
 #include "tone.h"
 #include "config.h"
 #include "json.h"
+#include "heap.h"
+#include "crash.h"
+#include "mon.h"
 #include "backend.h"
 
 
@@ -93,6 +97,12 @@ void backendMonStatus(void)
         sLastHeartbeat ? now - sLastHeartbeat : 0, sBytesReceived);
 }
 
+void backendGetStats(uint32_t *pConnCount, uint32_t *pBytes)
+{
+    *pConnCount = sConnCount;
+    *pBytes = sBytesReceived;
+}
+
 bool backendIsOkay(void)
 {
     // check heartbeat
@@ -133,12 +143,17 @@ BACKEND_STATUS_t backendHandle(char *resp, const int len)
 
     //DEBUG("backendHandle() [%d] %s", len, resp);
 
+    // remember for the crash record (before we chop it up below)
+    crashBackendLine(resp);
+
     char *pConfig    = strstr(resp, "\r\n""config ");
     char *pStatus    = strstr(resp, "\r\n""status ");
     char *pHeartbeat = strstr(resp, "\r\n""heartbeat ");
     char *pError     = strstr(resp, "\r\n""error ");
     char *pReconnect = strstr(resp, "\r\n""reconnect ");
     char *pCommand   = strstr(resp, "\r\n""command ");
+    char *pMelody    = strstr(resp, "\r\n""melody ");
+    char *pTrace     = strstr(resp, "\r\n""trace ");
 
     // "\r\nerror 1491146601 WTF?\r\n"
     if (pError != NULL)
@@ -205,6 +220,30 @@ BACKEND_STATUS_t backendHandle(char *resp, const int len)
         }
     }
 
+    // "\r\nmelody 1491146576 5f2a0c1d name:d=4,o=5,b=100:c,e,g\r\n"
+    if (pMelody != NULL)
+    {
+        pMelody += 2;
+        char *endOfLine = strstr(pMelody, "\r\n");
+        if (endOfLine != NULL)
+        {
+            *endOfLine = '\0';
+            sBackendHandleSetTime(&pMelody[7]);
+            const char *pHash = &pMelody[7 + 10 + 1];
+            char *pRtttl = NULL;
+            const uint32_t hash = strtoul(pHash, &pRtttl, 16);
+            DEBUG("backend: melody %08x", hash);
+            if ( (pRtttl != NULL) && (*pRtttl == ' ') && toneCacheStore(hash, &pRtttl[1]) )
+            {
+                statusNoise(STATUS_NOISE_OTHER);
+            }
+            else
+            {
+                statusNoise(STATUS_NOISE_ERROR);
+            }
+        }
+    }
+
     // "\r\nstatus 1491146576 json={"jobs": ... }\r\n"
     if (pStatus != NULL)
     {
@@ -214,6 +253,7 @@ BACKEND_STATUS_t backendHandle(char *resp, const int len)
         {
             *endOfLine = '\0';
             sBackendHandleSetTime(&pStatus[7]);
+            monTrace(MON_TRACE_PARSE);
             DEBUG("backend: status");
             char *pJson = &pStatus[7 + 10 + 1];
             const int jsonLen = strlen(pJson);
@@ -221,6 +261,24 @@ BACKEND_STATUS_t backendHandle(char *resp, const int len)
         }
     }
 
+    // "\r\ntrace 1491146576 3 250 800\r\n" (channel, Jenkins to backend [ms], backend to us [ms])
+    if (pTrace != NULL)
+    {
+        pTrace += 2;
+        char *endOfLine = strstr(pTrace, "\r\n");
+        if (endOfLine != NULL)
+        {
+            *endOfLine = '\0';
+            sBackendHandleSetTime(&pTrace[6]);
+            char *pNext = NULL;
+            const int chIx = strtol(&pTrace[6 + 10 + 1], &pNext, 10);
+            const uint32_t updateMs = strtoul(pNext, &pNext, 10);
+            const uint32_t sendMs = strtoul(pNext, NULL, 10);
+            DEBUG("backend: trace #%02d %u %u", chIx, updateMs, sendMs);
+            monTraceBackend(updateMs, sendMs);
+        }
+    }
+
     // "\r\ncommand 1491146601 reset\r\n"
     if (pCommand != NULL)
     {
@@ -256,6 +314,27 @@ BACKEND_STATUS_t backendHandle(char *resp, const int len)
                 toneStop();
                 toneBuiltinMelodyRandom();
             }
+            else if (strncmp("loglevel ", pCmd, 9) == 0)
+            {
+                if (debugSetLevel(&pCmd[9]))
+                {
+                    PRINT("backend: command loglevel %s", &pCmd[9]);
+                }
+                else
+                {
+                    WARNING("backend: command loglevel %s ???", &pCmd[9]);
+                    statusNoise(STATUS_NOISE_ERROR);
+                }
+            }
+            else if (strncmp("melody ", pCmd, 7) == 0)
+            {
+                const uint32_t hash = strtoul(&pCmd[7], NULL, 16);
+                PRINT("backend: command melody %08x", hash);
+                if (!toneCacheMelody(hash)) // ignore noise config
+                {
+                    statusNoise(STATUS_NOISE_ERROR);
+                }
+            }
             else if ( (configGetModel() == CONFIG_MODEL_CHEWIE) && (strcmp("chewie", pCmd) == 0) )
             {
                 PRINT("backend: command chewie");
@@ -283,8 +362,8 @@ void sBackendProcessStatus(char *resp, const int respLen)
 {
     DEBUG("backend: [%d] %s", respLen, resp);
 
-    const int maxTokens = (6 * JENKINS_MAX_CH) + 20;
-    jsmntok_t *pTokens = jsmnAllocTokens(maxTokens);
+    const int maxTokens = BACKEND_STATUS_TOKENS;
+    jsmntok_t *pTokens = jsmnAllocTokens(HEAP_SITE_BACKEND, maxTokens);
     if (pTokens == NULL)
     {
         ERROR("backend: json malloc fail");
@@ -419,7 +498,7 @@ void sBackendProcessStatus(char *resp, const int respLen)
     }
 
     // cleanup
-    free(pTokens);
+    heapFree(pTokens);
 }
 
 
@@ -14,6 +14,7 @@
 #define __BACKEND_H__
 
 #include "stdinc.h"
+#include "jenkins.h"
 
 //! initialise
 void backendInit(void);
@@ -26,6 +27,9 @@ typedef enum BACKEND_STATUS_e
 
 } BACKEND_STATUS_t;
 
+//! maximum number of JSON tokens in a status update
+#define BACKEND_STATUS_TOKENS ((6 * JENKINS_MAX_CH) + 20)
+
 #define BACKEND_STABLE_CONN_THRS  300 // [s]
 #define BACKEND_RECONNECT_INTERVAL 10 // [s]
 #define BACKEND_RECONNECT_INTERVAL_SLOW 300 // [s]
@@ -42,6 +46,13 @@ void backendDisconnect(void);
 
 void backendMonStatus(void);
 
+//! get backend connection statistics
+/*!
+    \param[out] pConnCount  number of connections since boot
+    \param[out] pBytes      number of bytes received on the current connection
+*/
+void backendGetStats(uint32_t *pConnCount, uint32_t *pBytes);
+
 #endif // __BACKEND_H__
 //@}
 // eof
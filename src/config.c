@@ -8,11 +8,15 @@
 
 #include "stdinc.h"
 
+#include <sysparam.h>
+
 #include "stuff.h"
 #include "debug.h"
 #include "status.h"
 #include "config.h"
 #include "json.h"
+#include "heap.h"
+#include "ledfx.h"
 #include "cfg_gen.h"
 
 CONFIG_MODEL_t  sConfigModel;
@@ -20,6 +24,46 @@ CONFIG_DRIVER_t sConfigDriver;
 CONFIG_ORDER_t  sConfigOrder;
 CONFIG_BRIGHT_t sConfigBright;
 CONFIG_NOISE_t  sConfigNoise;
+uint32_t        sConfigMelSuccess;
+uint32_t        sConfigMelFailure;
+
+// flash (sysparam) key and format
+#define CONFIG_SYSPARAM_KEY "config"
+#define CONFIG_STORE_VERSION 1
+
+typedef struct CONFIG_STORE_s
+{
+    uint8_t  version;
+    uint8_t  model;
+    uint8_t  driver;
+    uint8_t  order;
+    uint8_t  bright;
+    uint8_t  noise;
+    uint8_t  reserved[2];
+    uint32_t melSuccess;
+    uint32_t melFailure;
+} CONFIG_STORE_t;
+
+static CONFIG_STORE_t sConfigStored; // what's in the flash
+
+static void sConfigStore(const CONFIG_STORE_t *pkStore)
+{
+    if (memcmp(pkStore, &sConfigStored, sizeof(sConfigStored)) == 0)
+    {
+        return;
+    }
+    PRINT("config: store");
+    const sysparam_status_t res = sysparam_set_data(
+        CONFIG_SYSPARAM_KEY, (const uint8_t *)pkStore, sizeof(*pkStore), true);
+    if (res == SYSPARAM_OK)
+    {
+        sConfigStored = *pkStore;
+    }
+    else
+    {
+        WARNING("config: sysparam set fail (%d)", res);
+    }
+}
 
 void configInit(void)
 {
@@ -29,6 +73,46 @@ void configInit(void)
     sConfigOrder  = CONFIG_ORDER_UNKNOWN;
     sConfigBright = CONFIG_BRIGHT_UNKNOWN;
     sConfigNoise  = CONFIG_NOISE_SOME;
+    sConfigMelSuccess = 0;
+    sConfigMelFailure = 0;
+
+    // load last config from flash
+    size_t len = 0;
+    bool isBinary = false;
+    const sysparam_status_t res = sysparam_get_data_static(
+        CONFIG_SYSPARAM_KEY, (uint8_t *)&sConfigStored, sizeof(sConfigStored), &len, &isBinary);
+    if (res == SYSPARAM_OK)
+    {
+        if ( isBinary && (len == sizeof(sConfigStored)) && (sConfigStored.version == CONFIG_STORE_VERSION) &&
+             (sConfigStored.model  != CONFIG_MODEL_UNKNOWN)  && (sConfigStored.model  <= CONFIG_MODEL_HELLO)    &&
+             (sConfigStored.driver != CONFIG_DRIVER_UNKNOWN) && (sConfigStored.driver <= CONFIG_DRIVER_SK9822)  &&
+             (sConfigStored.order  != CONFIG_ORDER_UNKNOWN)  && (sConfigStored.order  <= CONFIG_ORDER_BGR)      &&
+             (sConfigStored.bright != CONFIG_BRIGHT_UNKNOWN) && (sConfigStored.bright <= CONFIG_BRIGHT_FULL)    &&
+             (sConfigStored.noise  != CONFIG_NOISE_UNKNOWN)  && (sConfigStored.noise  <= CONFIG_NOISE_MOST) )
+        {
+            sConfigModel  = sConfigStored.model;
+            sConfigDriver = sConfigStored.driver;
+            sConfigOrder  = sConfigStored.order;
+            sConfigBright = sConfigStored.bright;
+            sConfigNoise  = sConfigStored.noise;
+            sConfigMelSuccess = sConfigStored.melSuccess;
+            sConfigMelFailure = sConfigStored.melFailure;
+            PRINT("config: loaded");
+        }
+        else
+        {
+            WARNING("config: bad stored config");
+            memset(&sConfigStored, 0, sizeof(sConfigStored));
+        }
+    }
+    else
+    {
+        if (res != SYSPARAM_NOTFOUND)
+        {
+            WARNING("config: sysparam get fail (%d)", res);
+        }
+        memset(&sConfigStored, 0, sizeof(sConfigStored));
+    }
 }
 
 __INLINE CONFIG_MODEL_t  configGetModel(void)  { return sConfigModel; }
@@ -36,6 +120,8 @@ __INLINE CONFIG_DRIVER_t configGetDriver(void) { return sConfigDriver; }
 __INLINE CONFIG_ORDER_t  configGetOrder(void)  { return sConfigOrder; }
 __INLINE CONFIG_BRIGHT_t configGetBright(void) { return sConfigBright; }
 __INLINE CONFIG_NOISE_t  configGetNoise(void)  { return sConfigNoise; }
+__INLINE uint32_t        configGetMelSuccess(void) { return sConfigMelSuccess; }
+__INLINE uint32_t        configGetMelFailure(void) { return sConfigMelFailure; }
 
 static const char * const skConfigModelStrs[] =
 {
@@ -84,10 +170,10 @@ static const char * const skConfigNoiseStrs[] =
 
 void configMonStatus(void)
 {
-    DEBUG("mon: config: model=%s driver=%s order=%s bright=%s noise=%s",
+    DEBUG("mon: config: model=%s driver=%s order=%s bright=%s noise=%s melodies=%08x/%08x",
         skConfigModelStrs[sConfigModel], skConfigDriverStrs[sConfigDriver],
         skConfigOrderStrs[sConfigOrder], skConfigBrightStrs[sConfigBright],
-        skConfigNoiseStrs[sConfigNoise]);
+        skConfigNoiseStrs[sConfigNoise], sConfigMelSuccess, sConfigMelFailure);
 }
 
 static CONFIG_MODEL_t sConfigStrToModel(const char *str)
@@ -139,8 +225,8 @@ bool configParseJson(char *resp, const int respLen)
 {
     DEBUG("config: [%d] %s", respLen, resp);
 
-    const int maxTokens = (4 * 2) + 10;
-    jsmntok_t *pTokens = jsmnAllocTokens(maxTokens);
+    const int maxTokens = CONFIG_JSON_TOKENS;
+    jsmntok_t *pTokens = jsmnAllocTokens(HEAP_SITE_CONFIG, maxTokens);
     if (pTokens == NULL)
     {
         ERROR("config: json malloc fail");
@@ -179,6 +265,9 @@ bool configParseJson(char *resp, const int respLen)
         CONFIG_ORDER_t  configOrder  = CONFIG_ORDER_UNKNOWN;
         CONFIG_BRIGHT_t configBright = CONFIG_BRIGHT_UNKNOWN;
         CONFIG_NOISE_t  configNoise  = CONFIG_NOISE_UNKNOWN;
+        const char     *configFx     = ""; // no effect programs
+        uint32_t        configMelSuccess = 0; // builtin melodies
+        uint32_t        configMelFailure = 0;
 
         for (int ix = 0; ix < (numTokens - 1); ix++)
         {
@@ -200,6 +289,9 @@ bool configParseJson(char *resp, const int respLen)
                     else if (strcmp("order",  key) == 0) { configOrder  = sConfigStrToOrder(val); }
                     else if (strcmp("bright", key) == 0) { configBright = sConfigStrToBright(val); }
                     else if (strcmp("noise",  key) == 0) { configNoise  = sConfigStrToNoise(val); }
+                    else if (strcmp("fx",     key) == 0) { configFx     = val; }
+                    else if (strcmp("melsuccess", key) == 0) { configMelSuccess = strtoul(val, NULL, 16); }
+                    else if (strcmp("melfailure", key) == 0) { configMelFailure = strtoul(val, NULL, 16); }
                 }
             }
         }
@@ -216,7 +308,21 @@ bool configParseJson(char *resp, const int respLen)
             sConfigOrder  = configOrder;
             sConfigBright = configBright;
             sConfigNoise  = configNoise;
+            sConfigMelSuccess = configMelSuccess;
+            sConfigMelFailure = configMelFailure;
             CS_LEAVE;
+
+            // remember for the next boot
+            const CONFIG_STORE_t store =
+            {
+                .version = CONFIG_STORE_VERSION, .model = configModel, .driver = configDriver,
+                .order = configOrder, .bright = configBright, .noise = configNoise,
+                .melSuccess = configMelSuccess, .melFailure = configMelFailure,
+            };
+            sConfigStore(&store);
+
+            // LED effect programs (failure is not fatal, the previous programs are kept)
+            ledfxLoad(configFx);
         }
         else
         {
@@ -226,7 +332,7 @@ bool configParseJson(char *resp, const int respLen)
     }
 
     // cleanup
-    free(pTokens);
+    heapFree(pTokens);
 
     return okay;
 }
@@ -8,6 +8,10 @@
     \defgroup FF_CONFIG CONFIG
     \ingroup FF
 
+    The config is delivered by the backend (the "config" line, see configParseJson()). The last
+    valid config is stored in the flash (sysparam, only written if it has changed) and applied in
+    configInit(), so that the LEDs work correctly right after boot, before the backend connects.
+
     @{
 */
 #ifndef __CONFIG_H__
@@ -18,6 +22,9 @@
 //! initialise
 void configInit(void);
 
+//! maximum number of JSON tokens in a config update
+#define CONFIG_JSON_TOKENS ((8 * 2) + 10)
+
 void configMonStatus(void);
 
 typedef enum CONFIG_MODEL_e
@@ -71,6 +78,11 @@ CONFIG_ORDER_t  configGetOrder(void);
 CONFIG_BRIGHT_t configGetBright(void);
 CONFIG_NOISE_t  configGetNoise(void);
 
+//! custom melody (hash, see toneCacheMelody()) for jenkins success, 0 for the builtin melody
+uint32_t configGetMelSuccess(void);
+//! custom melody (hash, see toneCacheMelody()) for jenkins failure, 0 for the builtin melody
+uint32_t configGetMelFailure(void);
+
 bool configParseJson(char *resp, const int respLen);
 
 
@@ -0,0 +1,252 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: crash records (see \ref FF_CRASH)
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+*/
+
+#include "stdinc.h"
+
+#include <esp/rtcmem_regs.h>
+#include <xtensa_ops.h>
+
+#include "stuff.h"
+#include "debug.h"
+#include "heap.h"
+#include "crash.h"
+
+typedef struct CRASH_RECORD_s
+{
+    uint32_t magic;
+    uint32_t checksum;
+    uint8_t  version;
+    uint8_t  type;
+    uint8_t  cause;
+    uint8_t  logLen;
+    uint32_t epc1;
+    uint32_t excvaddr;
+    uint32_t depc;
+    uint32_t uptime;
+    char     task[12];
+    uint32_t stack[CRASH_STACK_NUM];
+    char     backend[CRASH_BACKEND_NUM][CRASH_BACKEND_LEN];
+    char     log[CRASH_LOG_LEN];
+} CRASH_RECORD_t;
+
+// the record is stored in the user part of the RTC memory
+#define CRASH_RECORD_WORDS (sizeof(CRASH_RECORD_t) / sizeof(uint32_t))
+
+static CRASH_RECORD_t sCrashRecord;     // record from previous run resp. snapshot
+static char sCrashBackend[CRASH_BACKEND_NUM][CRASH_BACKEND_LEN]; // last backend lines (ring)
+static int sCrashBackendIx;             // next backend line to write
+static char *spCrashUpload;             // upload parameter (malloc()ed)
+
+static IRAM uint32_t sCrashChecksum(const CRASH_RECORD_t *pkRecord)
+{
+    const uint32_t *pkWords = (const uint32_t *)pkRecord;
+    uint32_t checksum = 0;
+    for (int ix = 2; ix < (int)CRASH_RECORD_WORDS; ix++)
+    {
+        checksum += pkWords[ix];
+    }
+    return checksum;
+}
+
+static IRAM void sCrashStrncpy(char *dst, const char *src, const int size)
+{
+    int ix = 0;
+    while ( (ix < (size - 1)) && (src[ix] != '\0') )
+    {
+        dst[ix] = src[ix];
+        ix++;
+    }
+    dst[ix] = '\0';
+}
+
+// code addresses (IRAM and IROM)
+#define CRASH_IS_CODE(addr) ( ( ((addr) >= 0x40100000) && ((addr) < 0x40108000) ) || \
+                              ( ((addr) >= 0x40200000) && ((addr) < 0x40300000) ) )
+
+// end of DRAM (the stacks are below this)
+#define CRASH_DRAM_END 0x3fffc000
+
+// maximum number of stack words to scan
+#define CRASH_STACK_SCAN 512
+
+IRAM void crashSnapshot(void)
+{
+    CRASH_RECORD_t *pRecord = &sCrashRecord;
+
+    pRecord->version = CRASH_VERSION;
+    pRecord->type    = CRASH_TYPE_EXCEPTION;
+    uint32_t cause;
+    RSR(cause, exccause);
+    pRecord->cause = cause;
+    RSR(pRecord->epc1, epc1);
+    RSR(pRecord->excvaddr, excvaddr);
+    RSR(pRecord->depc, depc);
+    pRecord->uptime = osTime();
+    const char *pkTask = pcTaskGetName(NULL);
+    sCrashStrncpy(pRecord->task, pkTask != NULL ? pkTask : "?", sizeof(pRecord->task));
+
+    // there's no frame pointer, so collect everything on the stack that looks like a return address
+    const uint32_t *sp;
+    __asm__ __volatile__ ("mov %0, a1" : "=r" (sp));
+    int nStack = 0;
+    for (int ix = 0; (ix < CRASH_STACK_SCAN) && ((uint32_t)&sp[ix] < CRASH_DRAM_END) &&
+             (nStack < CRASH_STACK_NUM); ix++)
+    {
+        if (CRASH_IS_CODE(sp[ix]))
+        {
+            pRecord->stack[nStack++] = sp[ix];
+        }
+    }
+    while (nStack < CRASH_STACK_NUM)
+    {
+        pRecord->stack[nStack++] = 0;
+    }
+
+    // last backend lines, oldest first
+    for (int ix = 0; ix < CRASH_BACKEND_NUM; ix++)
+    {
+        sCrashStrncpy(pRecord->backend[ix], sCrashBackend[(sCrashBackendIx + ix) % CRASH_BACKEND_NUM],
+            CRASH_BACKEND_LEN);
+    }
+
+    // end of the debug output
+    pRecord->logLen = debugGetTail(pRecord->log, sizeof(pRecord->log));
+
+    pRecord->magic = CRASH_MAGIC;
+    pRecord->checksum = sCrashChecksum(pRecord);
+
+    // the RTC memory must be written word by word
+    const uint32_t *pkWords = (const uint32_t *)pRecord;
+    for (int ix = 0; ix < (int)CRASH_RECORD_WORDS; ix++)
+    {
+        RTCMEM_FREE[ix] = pkWords[ix];
+    }
+}
+
+void crashBackendLine(const char *line)
+{
+    // skip leading "\r\n"
+    while ( (*line == '\r') || (*line == '\n') )
+    {
+        line++;
+    }
+    char *pLine = sCrashBackend[sCrashBackendIx];
+    int ix = 0;
+    while ( (ix < (CRASH_BACKEND_LEN - 1)) && (line[ix] != '\0') && (line[ix] != '\r') )
+    {
+        pLine[ix] = line[ix];
+        ix++;
+    }
+    pLine[ix] = '\0';
+    sCrashBackendIx = (sCrashBackendIx + 1) % CRASH_BACKEND_NUM;
+}
+
+// base64url (RFC 4648) without padding
+static void sCrashBase64url(const uint8_t *pkData, const int size, char *str)
+{
+    static const char skChars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    for (int ix = 0; ix < size; ix += 3)
+    {
+        const int n = MIN(size - ix, 3);
+        const uint32_t val = (pkData[ix] << 16) | (n > 1 ? pkData[ix + 1] << 8 : 0) | (n > 2 ? pkData[ix + 2] : 0);
+        *str++ = skChars[(val >> 18) & 0x3f];
+        *str++ = skChars[(val >> 12) & 0x3f];
+        if (n > 1)
+        {
+            *str++ = skChars[(val >> 6) & 0x3f];
+        }
+        if (n > 2)
+        {
+            *str++ = skChars[val & 0x3f];
+        }
+    }
+    *str = '\0';
+}
+
+#define CRASH_UPLOAD_PREFIX ";crash="
+
+const char *crashUploadParam(void)
+{
+    return spCrashUpload != NULL ? spCrashUpload : "";
+}
+
+void crashUploaded(void)
+{
+    if (spCrashUpload != NULL)
+    {
+        PRINT("crash: uploaded");
+        heapFree(spCrashUpload);
+        spCrashUpload = NULL;
+    }
+}
+
+void crashInit(void)
+{
+    // load record from previous run
+    const uint32_t magic = RTCMEM_FREE[0];
+    if (magic == CRASH_MAGIC)
+    {
+        uint32_t *pWords = (uint32_t *)&sCrashRecord;
+        for (int ix = 0; ix < (int)CRASH_RECORD_WORDS; ix++)
+        {
+            pWords[ix] = RTCMEM_FREE[ix];
+        }
+        if ( (sCrashRecord.checksum != sCrashChecksum(&sCrashRecord)) ||
+             (sCrashRecord.version != CRASH_VERSION) )
+        {
+            WARNING("crash: bad record");
+            memset(&sCrashRecord, 0, sizeof(sCrashRecord));
+        }
+        // consume it
+        RTCMEM_FREE[0] = 0;
+    }
+    else
+    {
+        memset(&sCrashRecord, 0, sizeof(sCrashRecord));
+    }
+
+    // no record, but maybe the SDK knows something
+    if (sCrashRecord.type == CRASH_TYPE_NONE)
+    {
+        const struct sdk_rst_info *pkResetInfo = sdk_system_get_rst_info();
+        if ( (pkResetInfo->reason == WDT_RST) || (pkResetInfo->reason == EXCEPTION_RST) )
+        {
+            sCrashRecord.magic    = CRASH_MAGIC;
+            sCrashRecord.version  = CRASH_VERSION;
+            sCrashRecord.type     = pkResetInfo->reason == WDT_RST ? CRASH_TYPE_RST_WDT : CRASH_TYPE_RST_EXCEPTION;
+            sCrashRecord.cause    = pkResetInfo->exccause;
+            sCrashRecord.epc1     = pkResetInfo->epc1;
+            sCrashRecord.excvaddr = pkResetInfo->excvaddr;
+            sCrashRecord.depc     = pkResetInfo->depc;
+            sCrashRecord.checksum = sCrashChecksum(&sCrashRecord);
+        }
+    }
+
+    if (sCrashRecord.type == CRASH_TYPE_NONE)
+    {
+        DEBUG("crash: none");
+        return;
+    }
+
+    ERROR("crash: type=%u cause=%u epc1=0x%08x excvaddr=0x%08x task=%s uptime=%u",
+        sCrashRecord.type, sCrashRecord.cause, sCrashRecord.epc1, sCrashRecord.excvaddr,
+        sCrashRecord.task, sCrashRecord.uptime);
+
+    // prepare upload
+    spCrashUpload = heapAlloc(HEAP_SITE_CRASH, sizeof(CRASH_UPLOAD_PREFIX) + (((sizeof(sCrashRecord) + 2) / 3) * 4));
+    if (spCrashUpload == NULL)
+    {
+        ERROR("crash: malloc");
+        return;
+    }
+    strcpy(spCrashUpload, CRASH_UPLOAD_PREFIX);
+    sCrashBase64url((const uint8_t *)&sCrashRecord, sizeof(sCrashRecord),
+        &spCrashUpload[sizeof(CRASH_UPLOAD_PREFIX) - 1]);
+}
+
+// eof
@@ -0,0 +1,93 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: crash records (see \ref FF_CRASH)
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+
+    \defgroup FF_CRASH CRASH
+    \ingroup FF
+
+    On a fatal exception a snapshot of the system is stored in the RTC memory (the first
+    #CRASH_RECORD_SIZE bytes of the user part, RTCMEM_FREE, which survives the following reset).
+    On the next boot the record is loaded and uploaded to the backend (the \c crash parameter of
+    the backend query) on the next successful connect. If the reset was caused
+    by the watchdog or by an exception that the exception handler did not see, a record is made
+    from the SDK reset info (without stack, log and backend lines).
+
+    Record format (#CRASH_RECORD_SIZE bytes, little endian, uploaded base64url encoded without
+    padding):
+    - magic (uint32_t, #CRASH_MAGIC)
+    - checksum (uint32_t, sum of all following words)
+    - version (uint8_t, #CRASH_VERSION), type (uint8_t, #CRASH_TYPE_t), exception cause
+      (uint8_t, EXCCAUSE), log length (uint8_t, number of valid bytes in log)
+    - epc1, excvaddr, depc (uint32_t)
+    - uptime (uint32_t, ms)
+    - task (char[12], name of the crashed task, nul-terminated)
+    - stack (uint32_t[#CRASH_STACK_NUM], code addresses found on the stack, zero-terminated)
+    - backend (char[#CRASH_BACKEND_NUM][#CRASH_BACKEND_LEN], last backend lines, oldest first)
+    - log (char[#CRASH_LOG_LEN], end of the debug output)
+
+    Use "make crash CRASH=..." (tools/symbols.pl) to decode and symbolise the record.
+
+    @{
+*/
+#ifndef __CRASH_H__
+#define __CRASH_H__
+
+#include "stdinc.h"
+
+//! record magic
+#define CRASH_MAGIC 0x68736172
+
+//! record format version
+#define CRASH_VERSION 0x01
+
+//! number of stack entries
+#define CRASH_STACK_NUM 24
+
+//! number of backend lines
+#define CRASH_BACKEND_NUM 2
+
+//! maximum length of the backend lines (incl. nul termination)
+#define CRASH_BACKEND_LEN 40
+
+//! size of the log excerpt
+#define CRASH_LOG_LEN 160
+
+//! size of the record [bytes]
+#define CRASH_RECORD_SIZE (40 + (4 * CRASH_STACK_NUM) + (CRASH_BACKEND_NUM * CRASH_BACKEND_LEN) + CRASH_LOG_LEN)
+
+//! crash types
+typedef enum CRASH_TYPE_e
+{
+    CRASH_TYPE_NONE = 0,       //!< no crash
+    CRASH_TYPE_EXCEPTION,      //!< fatal exception (snapshot from exception handler)
+    CRASH_TYPE_RST_EXCEPTION,  //!< reset due to exception (from SDK reset info)
+    CRASH_TYPE_RST_WDT,        //!< reset due to watchdog (from SDK reset info)
+} CRASH_TYPE_t;
+
+//! initialise, loads the crash record from the previous run (if any), must be called after debugInit()
+void crashInit(void);
+
+//! take snapshot, to be called from the exception handler
+void crashSnapshot(void);
+
+//! remember backend line
+/*!
+    \param[in] line  the data received from the backend
+*/
+void crashBackendLine(const char *line);
+
+//! get crash report parameter for backend query
+/*!
+    \returns the query parameter (";crash=...") or an empty string if there's nothing to report
+*/
+const char *crashUploadParam(void);
+
+//! notify that the crash report was uploaded
+void crashUploaded(void);
+
+#endif // __CRASH_H__
+//@}
+// eof
@@ -8,6 +8,7 @@
 
 #include "stdinc.h"
 
+#include <stdarg.h>
 #include <stdout_redirect.h>
 #include <user_exception.h>
 #include <esp/uart.h>
@@ -15,6 +16,7 @@
 
 #include "stuff.h"
 #include "mon.h"
+#include "crash.h"
 #include "debug.h"
 
 #define UART_NUM 0
@@ -33,6 +35,26 @@ IRAM static ssize_t sWriteStdoutFunc(struct _reent *r, int fd, const void *ptr,
     return len;
 }
 
+#if (DEBUG_LOGBIN > 0)
+// output binary debug message record
+static bool sDebugWriteBin(const uint8_t *pkData, const int len)
+{
+    sWriteStdoutFunc(NULL, 1, pkData, len);
+    return true;
+}
+#endif
+
+int debugReadNet(uint8_t *pBuf, const int size, uint32_t *pLost)
+{
+    *pLost = 0;
+    return 0;
+}
+
+IRAM int debugGetTail(char *pBuf, const int size)
+{
+    return 0;
+}
+
 void debugLock(void)
 {
 }
@@ -45,59 +67,150 @@ void debugUnlock(void)
 #else // (TXBUF_SIZE <= 0)
 // non-blocking, buffered
 
+// The buffer is a ring buffer with free-running indices. Writers reserve a span in a short critical
+// section, copy their data with the interrupts enabled, and then commit. The ISR sends data up to
+// the commit index only, which advances to the head once the last pending writer has committed.
+// (There's no compare-and-swap on the lx106, so reserving and committing is done with the
+// interrupts disabled, but only for a few instructions and independent of the data size.)
+#if ((TXBUF_SIZE & (TXBUF_SIZE - 1)) != 0)
+#  error TXBUF_SIZE must be a power of 2
+#endif
+#define TXBUF_MASK (TXBUF_SIZE - 1)
+
 static volatile char     svDebugBuf[TXBUF_SIZE];       // debug buffer
-static volatile uint16_t svDebugBufHead;               // write-to-buffer pointer (index)
-static volatile uint16_t svDebugBufTail;               // read-from-buffer pointer (index)
-static volatile uint16_t svDebugBufSize;               // size of buffered data
+static volatile uint32_t svDebugBufHead;               // reserved up to here (writers)
+static volatile uint32_t svDebugBufCommit;             // committed up to here (writers)
+static volatile uint32_t svDebugBufTail;               // sent up to here (ISR)
+static volatile uint16_t svDebugBufWriters;            // number of writers that have not committed yet
 static volatile uint16_t svDebugBufPeak;               // peak output buffer size
 static volatile uint16_t svDebugBufDrop;               // number of dropped bytes
+static volatile uint32_t svDebugBufCsMax;              // max. time with interrupts disabled [cycles]
+static volatile uint32_t svDebugBufNetTail;            // read up to here (network sink, see debugReadNet())
+static volatile uint32_t svDebugBufNetLost;            // number of bytes lost for the network sink
 
-// add stdio output data to buffer
-static ssize_t sWriteStdoutFunc(struct _reent *r, int fd, const void *ptr, size_t len)
-{
-    CS_ENTER;
+// critical section that keeps track of the time the interrupts are disabled \hideinitializer
+#define DEBUG_CS_ENTER CS_ENTER; const uint32_t _csT0 = monCcount()
+#define DEBUG_CS_LEAVE { const uint32_t _csDt = monCcount() - _csT0; \
+        if (_csDt > svDebugBufCsMax) { svDebugBufCsMax = _csDt; } } CS_LEAVE
 
-    const char *pkBuf = (const char *)ptr;
-    for (int i = 0; i < len; i++)
+// add data to buffer, either all of it or as much as fits (drops the rest)
+static bool sDebugBufPut(const uint8_t *pkData, const int len, const bool all)
+{
+    // reserve
+    uint32_t start;
+    int num;
+    DEBUG_CS_ENTER;
+    const uint32_t size = svDebugBufHead - svDebugBufTail;
+    const int space = TXBUF_SIZE - size;
+    num = space >= len ? len : (all ? 0 : space);
+    start = svDebugBufHead;
+    svDebugBufHead += num;
+    svDebugBufWriters++;
+    // keep statistics on the buffer size
+    if ((size + num) > svDebugBufPeak)
     {
+        svDebugBufPeak = size + num;
+    }
+    // FIXME: put "\nE: tx buf\n" into buffer
+    svDebugBufDrop += len - num;
+    // the network sink doesn't hold back the writers, it loses the data it hasn't read in time
+    if ((svDebugBufHead - svDebugBufNetTail) > TXBUF_SIZE)
+    {
+        svDebugBufNetLost += svDebugBufHead - TXBUF_SIZE - svDebugBufNetTail;
+        svDebugBufNetTail = svDebugBufHead - TXBUF_SIZE;
+    }
+    DEBUG_CS_LEAVE;
+
+    // copy, in two parts if the span wraps around
+    const uint32_t ix = start & TXBUF_MASK;
+    const int num1 = MIN(num, (int)(TXBUF_SIZE - ix));
+    memcpy((char *)&svDebugBuf[ix], pkData, num1);
+    memcpy((char *)&svDebugBuf[0], &pkData[num1], num - num1);
+
+    // commit
+    DEBUG_CS_ENTER;
+    svDebugBufWriters--;
+    if (svDebugBufWriters == 0)
+    {
+        svDebugBufCommit = svDebugBufHead;
+    }
+    DEBUG_CS_LEAVE;
 
-        // add to ring buffer if there's space
-        if ( (svDebugBufSize == 0) || (svDebugBufHead != svDebugBufTail) )
-        {
-            svDebugBuf[svDebugBufHead] = *pkBuf;
-            svDebugBufHead += 1;
-            svDebugBufHead %= sizeof(svDebugBuf);
-            svDebugBufSize++;
-            // keep statistics on the buffer size
-            if (svDebugBufSize > svDebugBufPeak)
-            {
-                svDebugBufPeak = svDebugBufSize;
-            }
-        }
-        // drop char otherwise
-        else
-        {
-            // FIXME: put "\nE: tx buf\n" into buffer
-            svDebugBufDrop++;
-        }
+    // enable tx fifo empty interrupt
+    UART(UART_NUM).INT_ENABLE |= UART_INT_ENABLE_TXFIFO_EMPTY;
 
-        pkBuf++;
+    return num == len;
+}
+
+int debugReadNet(uint8_t *pBuf, const int size, uint32_t *pLost)
+{
+    // span to read
+    uint32_t start;
+    int num;
+    DEBUG_CS_ENTER;
+    start = svDebugBufNetTail;
+    num = (int32_t)(svDebugBufCommit - start);
+    num = CLIP(num, 0, size);
+    DEBUG_CS_LEAVE;
+
+    // copy, in two parts if the span wraps around
+    const uint32_t ix = start & TXBUF_MASK;
+    const int num1 = MIN(num, (int)(TXBUF_SIZE - ix));
+    memcpy(pBuf, (const char *)&svDebugBuf[ix], num1);
+    memcpy(&pBuf[num1], (const char *)&svDebugBuf[0], num - num1);
+
+    // writers may have overwritten the beginning of the span while we were copying
+    int lost;
+    DEBUG_CS_ENTER;
+    lost = CLIP((int32_t)(svDebugBufNetTail - start), 0, num);
+    if ((int32_t)(start + num - svDebugBufNetTail) > 0)
+    {
+        svDebugBufNetTail = start + num;
     }
+    *pLost = svDebugBufNetLost;
+    svDebugBufNetLost = 0;
+    DEBUG_CS_LEAVE;
 
-    CS_LEAVE;
+    if (lost > 0)
+    {
+        memmove(pBuf, &pBuf[lost], num - lost);
+    }
+    return num - lost;
+}
 
-    // enable tx fifo empty interrupt
-    UART(UART_NUM).INT_ENABLE |= UART_INT_ENABLE_TXFIFO_EMPTY;
+// (called from the exception handler)
+IRAM int debugGetTail(char *pBuf, const int size)
+{
+    const uint32_t end = svDebugBufCommit;
+    const int num = MIN(MIN(end, TXBUF_SIZE), (uint32_t)size);
+    for (int ix = 0; ix < num; ix++)
+    {
+        pBuf[ix] = svDebugBuf[(end - num + ix) & TXBUF_MASK];
+    }
+    return num;
+}
 
+// add stdio output data to buffer
+static ssize_t sWriteStdoutFunc(struct _reent *r, int fd, const void *ptr, size_t len)
+{
+    sDebugBufPut((const uint8_t *)ptr, len, false);
     return len;
 }
 
+#if (DEBUG_LOGBIN > 0)
+// output binary debug message record (all or nothing)
+static bool sDebugWriteBin(const uint8_t *pkData, const int len)
+{
+    return sDebugBufPut(pkData, len, true);
+}
+#endif
+
 
 // interrupt handler (for *any* UART interrupt of *any* UART peripheral)
 // flushs buffered debug data to the tx fifo
 IRAM static void sUartISR(void *pArg) // RAM function
 {
-    monIsrEnter();
+    monIsrEnter(MON_ISR_UART);
 
     //UNUSED(pArg);
 
@@ -109,18 +222,16 @@ IRAM static void sUartISR(void *pArg) // RAM function
 
         // write more data to the UART tx FIFO
         uint8_t fifoRemaining = (UART_FIFO_MAX + 1) - FIELD2VAL(UART_STATUS_TXFIFO_COUNT, UART(UART_NUM).STATUS);
-        while (svDebugBufSize && fifoRemaining--)
+        while ( (svDebugBufTail != svDebugBufCommit) && fifoRemaining-- )
         {
-            const char c = svDebugBuf[svDebugBufTail];
+            const char c = svDebugBuf[svDebugBufTail & TXBUF_MASK];
             svDebugBufTail += 1;
-            svDebugBufTail %= sizeof(svDebugBuf);
-            svDebugBufSize--;
             UART(UART_NUM).FIFO = (c & UART_FIFO_DATA_M) << UART_FIFO_DATA_S;
             //UART(UART_NUM).FIFO = SET_FIELD_M(UART(UART_NUM).FIFO, UART_FIFO_DATA, c);
         }
 
         // there's more data to fill to the FIFO once it's empty
-        if (svDebugBufSize)
+        if (svDebugBufTail != svDebugBufCommit)
         {
             UART(UART_NUM).INT_ENABLE |= UART_INT_ENABLE_TXFIFO_EMPTY;
         }
@@ -130,7 +241,7 @@ IRAM static void sUartISR(void *pArg) // RAM function
     }
     // else if (...) // handle other sources of this interrupt
 
-    monIsrLeave();
+    monIsrLeave(MON_ISR_UART);
 }
 
 static SemaphoreHandle_t sDebugMutex;
@@ -149,49 +260,313 @@ __INLINE void debugUnlock(void)
 #endif // (TXBUF_SIZE <= 0)
 
 
+volatile uint8_t debugLevels[DEBUG_MOD_NUM] = { [0 ... (DEBUG_MOD_NUM - 1)] = DEBUG_LEVEL_MAX };
+
+static const char * const skDebugModStrs[] =
+{
+    [DEBUG_MOD_OTHER] = "other", [DEBUG_MOD_BACKEND] = "backend", [DEBUG_MOD_WIFI] = "wifi",
+    [DEBUG_MOD_LEDS] = "leds", [DEBUG_MOD_JENKINS] = "jenkins", [DEBUG_MOD_TONE] = "tone",
+    [DEBUG_MOD_MON] = "mon",
+};
+
+static const char * const skDebugLevelStrs[] =
+{
+    [DEBUG_LEVEL_NONE] = "none", [DEBUG_LEVEL_ERROR] = "error", [DEBUG_LEVEL_WARNING] = "warning",
+    [DEBUG_LEVEL_NOTICE] = "notice", [DEBUG_LEVEL_PRINT] = "print", [DEBUG_LEVEL_DEBUG] = "debug",
+};
+
+bool debugSetLevel(const char *str)
+{
+    // "<module> <level>"
+    const char *pLevel = strchr(str, ' ');
+    if (pLevel == NULL)
+    {
+        return false;
+    }
+    const int modLen = pLevel - str;
+    pLevel++;
+
+    int level = NUMOF(skDebugLevelStrs);
+    while (level--)
+    {
+        if (strcmp(skDebugLevelStrs[level], pLevel) == 0)
+        {
+            break;
+        }
+    }
+    if (level < 0)
+    {
+        return false;
+    }
+    if (level > DEBUG_LEVEL_MAX)
+    {
+        level = DEBUG_LEVEL_MAX;
+    }
+
+    bool res = false;
+    for (int mod = 0; mod < DEBUG_MOD_NUM; mod++)
+    {
+        if ( ((modLen == 3) && (strncmp("all", str, 3) == 0)) ||
+             ((modLen == (int)strlen(skDebugModStrs[mod])) && (strncmp(skDebugModStrs[mod], str, modLen) == 0)) )
+        {
+            debugLevels[mod] = level;
+            res = true;
+        }
+    }
+    return res;
+}
+
+#if (DEBUG_LOGBIN > 0)
+
+static uint32_t sDebugLogBinCnt;    // number of binary records
+static uint32_t sDebugLogBinBytes;  // number of bytes of binary records
+static uint32_t sDebugLogBinTxtCnt; // number of messages that had to be printed as text
+static uint32_t sDebugLogBinLastMs; // time of last record
+
+// format strings must be in the dRAM (.rodata) for the decoder to find them
+#define DEBUG_LOGBIN_IDMAX 0x18000
+
+// encode unsigned LEB128 varint, returns number of bytes used (1..5)
+static int sDebugVarint(uint8_t *pBuf, uint32_t val)
+{
+    int len = 0;
+    do
+    {
+        const uint8_t byte = val & 0x7f;
+        val >>= 7;
+        pBuf[len++] = val ? (byte | 0x80) : byte;
+    }
+    while (val);
+    return len;
+}
+
+// worst-case space for one conversion (other than %s): width and precision varints (5 bytes each) and
+// a 64 bit integer (two varints, 10 bytes), a double is only 8 bytes
+#define DEBUG_LOGBIN_ARGMAX (5 + 5 + 10)
+
+// encode payload (the arguments as described by the format string), returns payload length or 0 if
+// it's too large
+static int sDebugLogBinPayload(uint8_t *pPayload, const int maxLen, const uint32_t id, const uint32_t dt,
+    const char *fmt, va_list args)
+{
+    int len = 0;
+    len += sDebugVarint(&pPayload[len], id);
+    len += sDebugVarint(&pPayload[len], dt);
+
+    // Walk the format string. This must match tools/debug.pl (and printf()).
+    for (const char *p = fmt; *p != '\0'; p++)
+    {
+        if (*p != '%')
+        {
+            continue;
+        }
+        p++;
+        if (*p == '%')
+        {
+            continue;
+        }
+        // space required for the worst-case conversion
+        if ((len + DEBUG_LOGBIN_ARGMAX) > maxLen)
+        {
+            return 0;
+        }
+        // flags
+        while ( (*p != '\0') && (strchr("-+ #0", *p) != NULL) )
+        {
+            p++;
+        }
+        // width
+        if (*p == '*')
+        {
+            len += sDebugVarint(&pPayload[len], va_arg(args, int));
+            p++;
+        }
+        while (isdigit((int)*p))
+        {
+            p++;
+        }
+        // precision
+        if (*p == '.')
+        {
+            p++;
+            if (*p == '*')
+            {
+                len += sDebugVarint(&pPayload[len], va_arg(args, int));
+                p++;
+            }
+            while (isdigit((int)*p))
+            {
+                p++;
+            }
+        }
+        // length
+        int nL = 0;
+        while ( (*p == 'l') || (*p == 'h') || (*p == 'z') )
+        {
+            nL += (*p == 'l') ? 1 : 0;
+            p++;
+        }
+        // conversion
+        switch (*p)
+        {
+            case '\0':
+                return len;
+            case 's':
+            {
+                const char *str = va_arg(args, const char *);
+                const int strLen = strlen(str != NULL ? str : "(null)");
+                if ((len + strLen + 1) > maxLen)
+                {
+                    return 0;
+                }
+                memcpy(&pPayload[len], str != NULL ? str : "(null)", strLen + 1);
+                len += strLen + 1;
+                break;
+            }
+            case 'f':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            {
+                const double val = va_arg(args, double);
+                memcpy(&pPayload[len], &val, sizeof(val));
+                len += sizeof(val);
+                break;
+            }
+            default:
+                if (nL > 1)
+                {
+                    const uint64_t val = va_arg(args, uint64_t);
+                    len += sDebugVarint(&pPayload[len], (uint32_t)val);
+                    len += sDebugVarint(&pPayload[len], (uint32_t)(val >> 32));
+                }
+                else
+                {
+                    len += sDebugVarint(&pPayload[len], va_arg(args, uint32_t));
+                }
+                break;
+        }
+    }
+    return len;
+}
+
+void debugLogBin(const char *fmt, ...)
+{
+    // (wraps around if the format string is below the base)
+    const uint32_t id = (uint32_t)fmt - DEBUG_LOGBIN_BASE;
+
+    debugLock();
+
+    // record (static, we have the lock)
+    static uint8_t sRecord[2 + 255 + 1];
+    const uint32_t now = osTime();
+    int payloadLen = 0;
+    if (id < DEBUG_LOGBIN_IDMAX)
+    {
+        va_list args;
+        va_start(args, fmt);
+        payloadLen = sDebugLogBinPayload(&sRecord[2], 255, id, now - sDebugLogBinLastMs, fmt, args);
+        va_end(args);
+    }
+
+    if (payloadLen > 0)
+    {
+        uint8_t sum = 0;
+        for (int ix = 0; ix < payloadLen; ix++)
+        {
+            sum += sRecord[2 + ix];
+        }
+        sRecord[0] = DEBUG_LOGBIN_SYNC;
+        sRecord[1] = payloadLen;
+        sRecord[2 + payloadLen] = sum;
+        const int recordLen = 2 + payloadLen + 1;
+        // the time is relative to the last record that made it into the output
+        if (sDebugWriteBin(sRecord, recordLen))
+        {
+            sDebugLogBinLastMs = now;
+            sDebugLogBinCnt++;
+            sDebugLogBinBytes += recordLen;
+        }
+    }
+    // can't encode it (the decoder wouldn't find the format string, or the arguments don't fit)
+    else
+    {
+        va_list args;
+        va_start(args, fmt);
+        vprintf(fmt, args);
+        va_end(args);
+        putchar('\n');
+        sDebugLogBinTxtCnt++;
+    }
+
+    debugUnlock();
+}
+
+#endif // (DEBUG_LOGBIN > 0)
+
+
 void debugMonStatus(void)
 {
 #if (TXBUF_SIZE > 0)
     uint16_t size, peak, drop;
+    uint32_t csMax;
     CS_ENTER;
-    size = svDebugBufSize;
+    size = svDebugBufHead - svDebugBufTail;
     peak = svDebugBufPeak;
     drop = svDebugBufDrop;
+    csMax = svDebugBufCsMax;
     svDebugBufPeak = 0;
     svDebugBufDrop = 0;
+    svDebugBufCsMax = 0;
     CS_LEAVE;
     uint16_t percPeak = ((peak * 8 * 100 / sizeof(svDebugBuf)) + 4) >> 3;
+    const double csMaxUs = (double)csMax / (double)sdk_system_get_cpu_freq();
     if (drop)
     {
-        WARNING("mon: debug: size=%u/%u peak=%u (%u%%) drop=%u",
-            size, sizeof(svDebugBuf), peak, percPeak, drop);
+        WARNING("mon: debug: size=%u/%u peak=%u (%u%%) drop=%u csmax=%.1fus",
+            size, sizeof(svDebugBuf), peak, percPeak, drop, csMaxUs);
     }
     else
     {
-        DEBUG("mon: debug: size=%u/%u peak=%u (%u%%) drop=%u",
-            size, sizeof(svDebugBuf), peak, percPeak, drop);
+        DEBUG("mon: debug: size=%u/%u peak=%u (%u%%) drop=%u csmax=%.1fus",
+            size, sizeof(svDebugBuf), peak, percPeak, drop, csMaxUs);
     }
+#endif
+    char levels[(DEBUG_MOD_NUM * 10) + 1];
+    int len = 0;
+    for (int mod = 0; mod < DEBUG_MOD_NUM; mod++)
+    {
+        len += snprintf(&levels[len], sizeof(levels) - len, "%s%s:%c", mod > 0 ? " " : "",
+            skDebugModStrs[mod], "-EWNPD"[debugLevels[mod]]);
+    }
+    DEBUG("mon: debug: levels=%s (max %s)", levels, skDebugLevelStrs[DEBUG_LEVEL_MAX]);
+#if (DEBUG_LOGBIN > 0)
+    DEBUG("mon: debug: logbin=%u (%u bytes avg) text=%u", sDebugLogBinCnt,
+        sDebugLogBinCnt ? sDebugLogBinBytes / sDebugLogBinCnt : 0, sDebugLogBinTxtCnt);
 #endif
 }
 
 
-// turn off buffered output, for exceptions
+// take crash snapshot and turn off buffered output, for exceptions
 // https://github.com/SuperHouse/esp-open-rtos/wiki/Crash-Dumps
 // to test: *((volatile uint32_t *)0) = 0;
-static void sDebugResetStdout(void)
+static void sDebugException(void)
 {
+    crashSnapshot();
+
+#if (TXBUF_SIZE > 0)
     // dump what's in the buffer
-    while (svDebugBufSize > 0)
+    while (svDebugBufTail != svDebugBufCommit)
     {
-        const char c = svDebugBuf[svDebugBufTail];
+        const char c = svDebugBuf[svDebugBufTail & TXBUF_MASK];
         svDebugBufTail += 1;
-        svDebugBufTail %= sizeof(svDebugBuf);
-        svDebugBufSize--;
         uart_putc(0, c);
     }
 
     // revert back to blocking direct-to-UART stdout
     set_write_stdout(NULL);
+#endif
 }
 
 void debugInit(void)
@@ -202,7 +577,7 @@ void debugInit(void)
     uart_set_stopbits(UART_NUM, UART_STOPBITS_1);
 
     printf("..................................................\n");
-    osSleep(250);
+    uart_flush_txfifo(UART_NUM);
 
     static StaticSemaphore_t sMutex;
     sDebugMutex = xSemaphoreCreateMutexStatic(&sMutex);
@@ -212,7 +587,7 @@ void debugInit(void)
     // clear tx fifo
     uart_clear_txfifo(UART_NUM);
 
-    DEBUG("debug: init buf=%u fifo=%u", sizeof(svDebugBuf), UART_FIFO_MAX);
+    DEBUG("debug: init buf=%u fifo=%u logbin=%d", sizeof(svDebugBuf), UART_FIFO_MAX, DEBUG_LOGBIN);
 
     set_write_stdout(sWriteStdoutFunc);
     //stderr = stdout; // FIXME: makes the system freeze (or stops output?) at some point.. :-(
@@ -230,8 +605,6 @@ void debugInit(void)
     // unmask (enable) UART interrupts
     _xt_isr_unmask(BIT(INUM_UART));
 
-    set_user_exception_handler(sDebugResetStdout);
-
 #else
 
     DEBUG("debug: init (blocking, unbuffered)");
@@ -239,6 +612,8 @@ void debugInit(void)
     set_write_stdout(sWriteStdoutFunc);
 
 #endif
+
+    set_user_exception_handler(sDebugException);
 }
 
 void HEXDUMP(const void *pkData, int size)
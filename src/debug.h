@@ -11,6 +11,26 @@
     usable from interrupts!). The output goes via the normal stdout handle, so that it mixes well
     with direct printf() calls (incl. those from the SDK).
 
+    With CONFIG_LOGBIN = 1 (see config-sample.mk) the DEBUG(), PRINT() etc. messages are not
+    formatted on the device. Instead a compact binary record is sent, which tools/debug.pl decodes
+    using the string table extracted from the ELF file at build time (make debug does this). The
+    record is (all integers are unsigned LEB128 varints unless noted):
+    - #DEBUG_LOGBIN_SYNC
+    - payload length (one byte)
+    - payload:
+      - format string ID (address of the format string - #DEBUG_LOGBIN_BASE)
+      - time since previous record [ms]
+      - the arguments: integers (incl. "*" widths and precisions) as varints (64 bits integers as
+        two varints, low word first), strings nul-terminated, doubles as 8 bytes (little endian)
+    - checksum (sum of the payload bytes, one byte)
+
+    Messages whose arguments don't fit into the 255 bytes payload are sent as text instead.
+
+    Each module (see #DEBUG_MOD_t) has a debug level (see #DEBUG_LEVEL_t), which can be changed at
+    run-time (see debugSetLevel(), and the "loglevel" backend command). Messages above the level
+    are not formatted at all. Messages above the build-time ceiling (CONFIG_LOGLEVEL) are compiled
+    out.
+
     \defgroup FF_DEBUG DEBUG
     \ingroup FF
 
@@ -21,6 +41,20 @@
 
 #include "stdinc.h"
 
+#include "cfg_gen.h"
+
+#if defined(FF_CFG_LOGBIN) && (FF_CFG_LOGBIN > 0)
+#  define DEBUG_LOGBIN 1 //!< binary (tokenized) debug messages
+#else
+#  define DEBUG_LOGBIN 0 //!< normal (text) debug messages
+#endif
+
+//! binary debug message record start
+#define DEBUG_LOGBIN_SYNC 0x1e
+
+//! base address for the format string IDs (start of dRAM, where the .rodata lives)
+#define DEBUG_LOGBIN_BASE 0x3ffe8000
+
 //! initialise debugging output
 void debugInit(void);
 
@@ -29,20 +63,108 @@ void debugMonStatus(void);
 void debugLock(void);
 void debugUnlock(void);
 
+//! debug levels
+typedef enum DEBUG_LEVEL_e
+{
+    DEBUG_LEVEL_NONE = 0,    //!< no output
+    DEBUG_LEVEL_ERROR,       //!< ERROR() only
+    DEBUG_LEVEL_WARNING,     //!< .. and WARNING()
+    DEBUG_LEVEL_NOTICE,      //!< .. and NOTICE()
+    DEBUG_LEVEL_PRINT,       //!< .. and PRINT()
+    DEBUG_LEVEL_DEBUG,       //!< .. and DEBUG(), i.e. everything
+} DEBUG_LEVEL_t;
+
+//! modules with individual debug levels
+typedef enum DEBUG_MOD_e
+{
+    DEBUG_MOD_OTHER = 0,     //!< everything else
+    DEBUG_MOD_BACKEND,       //!< backend.c
+    DEBUG_MOD_WIFI,          //!< wifi.c
+    DEBUG_MOD_LEDS,          //!< leds.c, ledfx.c
+    DEBUG_MOD_JENKINS,       //!< jenkins.c
+    DEBUG_MOD_TONE,          //!< tone.c
+    DEBUG_MOD_MON,           //!< mon.c
+    DEBUG_MOD_NUM
+} DEBUG_MOD_t;
+
+//! the module of the source file (define before including debug.h)
+#ifndef DEBUG_MOD
+#  define DEBUG_MOD DEBUG_MOD_OTHER
+#endif
+
+//! build-time ceiling for the debug levels (CONFIG_LOGLEVEL), messages above are compiled out
+#if defined(FF_CFG_LOGLEVEL)
+#  define DEBUG_LEVEL_MAX FF_CFG_LOGLEVEL
+#else
+#  define DEBUG_LEVEL_MAX DEBUG_LEVEL_DEBUG
+#endif
+
+//! current debug levels of the modules (use DEBUG_ON(), debugSetLevel())
+extern volatile uint8_t debugLevels[DEBUG_MOD_NUM];
+
+//! check if messages of the given level are output (in the current module)
+#define DEBUG_ON(level) ( ((level) <= DEBUG_LEVEL_MAX) && ((level) <= debugLevels[DEBUG_MOD]) )
+
+//! set debug level
+/*!
+    \param[in] str  module and level, e.g. "backend debug" or "all warning", see debugMonStatus()
+                    output for the names
+
+    \returns true if the level was set, false otherwise (illegal module or level)
+*/
+bool debugSetLevel(const char *str);
+
+#if (DEBUG_LOGBIN > 0)
+
+//! output binary debug message (use the macros below)
+void debugLogBin(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#  define DEBUG_OUT_(level, prefix, fmt, ...) \
+    do { if (DEBUG_ON(level)) { debugLogBin(prefix fmt, ## __VA_ARGS__); } } while (0)
+
+#else // (DEBUG_LOGBIN > 0)
+
+#  define DEBUG_OUT_(level, prefix, fmt, ...) \
+    do { if (DEBUG_ON(level)) { debugLock(); printf(prefix fmt "\n", ## __VA_ARGS__); debugUnlock(); } } while (0)
+
+#endif // (DEBUG_LOGBIN > 0)
+
 //! print an error message \hideinitializer
-#define ERROR(fmt, ...)   debugLock(); printf("E: " fmt "\n", ## __VA_ARGS__); debugUnlock()
+#define ERROR(fmt, ...)   DEBUG_OUT_(DEBUG_LEVEL_ERROR,   "E: ", fmt, ## __VA_ARGS__)
 
 //! print a warning message \hideinitializer
-#define WARNING(fmt, ...) debugLock(); printf("W: " fmt "\n", ## __VA_ARGS__); debugUnlock()
+#define WARNING(fmt, ...) DEBUG_OUT_(DEBUG_LEVEL_WARNING, "W: ", fmt, ## __VA_ARGS__)
 
 //! print a notice \hideinitializer
-#define NOTICE(fmt, ...)  debugLock(); printf("N: " fmt "\n", ## __VA_ARGS__); debugUnlock()
+#define NOTICE(fmt, ...)  DEBUG_OUT_(DEBUG_LEVEL_NOTICE,  "N: ", fmt, ## __VA_ARGS__)
 
 //! print a normal message \hideinitializer
-#define PRINT(fmt, ...)   debugLock(); printf("P: " fmt "\n", ## __VA_ARGS__); debugUnlock()
+#define PRINT(fmt, ...)   DEBUG_OUT_(DEBUG_LEVEL_PRINT,   "P: ", fmt, ## __VA_ARGS__)
 
 //! print a debug message \hideinitializer
-#define DEBUG(fmt, ...)   debugLock(); printf("D: " fmt "\n", ## __VA_ARGS__); debugUnlock()
+#define DEBUG(fmt, ...)   DEBUG_OUT_(DEBUG_LEVEL_DEBUG,   "D: ", fmt, ## __VA_ARGS__)
+
+//! read debug output for the network sink (see \ref FF_NETLOG)
+/*!
+    This is a second reader of the debug output buffer, independent of the UART output. It never
+    holds back the output, data that is not read in time is lost.
+
+    \param[out] pBuf   buffer for the data
+    \param[in]  size   size of the buffer
+    \param[out] pLost  number of bytes lost since the previous call
+
+    \returns the number of bytes read (0 if there's nothing to read)
+*/
+int debugReadNet(uint8_t *pBuf, const int size, uint32_t *pLost);
+
+//! get end of debug output (for the crash record, see \ref FF_CRASH)
+/*!
+    \param[out] pBuf  buffer for the data
+    \param[in]  size  size of the buffer
+
+    \returns the number of bytes copied (0 if there's no output buffer)
+*/
+int debugGetTail(char *pBuf, const int size);
 
 //! hex dump data
 void HEXDUMP(const void *pkData, int size);
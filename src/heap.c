@@ -0,0 +1,257 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: heap accounting (see \ref FF_HEAP)
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+*/
+
+#include "stdinc.h"
+
+#include <jsmn.h>
+
+#include "stuff.h"
+#include "debug.h"
+#include "backend.h"
+#include "config.h"
+#include "mon.h"
+#include "heap.h"
+#include "cfg_gen.h"
+
+// heap allocations have a header that says where they're from and how large they are, and that
+// keeps the memory aligned
+typedef struct HEAP_HEADER_s
+{
+    uint32_t site;
+    uint32_t size;
+} HEAP_HEADER_t;
+
+typedef struct HEAP_STATS_s
+{
+    uint32_t bytes;   // currently allocated [bytes]
+    uint32_t peak;    // peak allocated [bytes]
+    uint32_t live;    // currently allocated [number]
+    uint32_t allocs;  // total number of allocations
+    uint32_t fails;   // failed allocations
+    uint32_t pool;    // allocations served by the pool
+} HEAP_STATS_t;
+
+static HEAP_STATS_t sHeapStats[HEAP_SITE_NUM];
+static uint32_t sHeapMinFree = UINT32_MAX;
+static uint32_t sHeapMinLargest = UINT32_MAX;
+static uint32_t sHeapLastLargest;
+
+static const char * const skHeapSiteStrs[] =
+{
+    [HEAP_SITE_BACKEND] = "backend", [HEAP_SITE_CONFIG] = "config",
+    [HEAP_SITE_MON] = "mon", [HEAP_SITE_CRASH] = "crash",
+};
+
+#if (FF_CFG_HEAPPOOLS)
+
+// one static buffer per fixed size call site
+static uint32_t sHeapPoolBackend[ (BACKEND_STATUS_TOKENS * sizeof(jsmntok_t) + 3) / 4 ];
+static uint32_t sHeapPoolConfig[ (CONFIG_JSON_TOKENS * sizeof(jsmntok_t) + 3) / 4 ];
+static uint32_t sHeapPoolMon[ (MON_MAX_TASKS * sizeof(TaskStatus_t) + 3) / 4 ];
+
+typedef struct HEAP_POOL_s
+{
+    void *pBuf;
+    int   size;
+    bool  busy;
+} HEAP_POOL_t;
+
+static HEAP_POOL_t sHeapPools[HEAP_SITE_NUM] =
+{
+    [HEAP_SITE_BACKEND] = { .pBuf = sHeapPoolBackend, .size = sizeof(sHeapPoolBackend) },
+    [HEAP_SITE_CONFIG]  = { .pBuf = sHeapPoolConfig,  .size = sizeof(sHeapPoolConfig) },
+    [HEAP_SITE_MON]     = { .pBuf = sHeapPoolMon,     .size = sizeof(sHeapPoolMon) },
+};
+
+// try to get memory from the pool
+static void *sHeapPoolAlloc(const HEAP_SITE_t site, const int size)
+{
+    HEAP_POOL_t *pPool = &sHeapPools[site];
+    void *ptr = NULL;
+    CS_ENTER;
+    if ( (pPool->pBuf != NULL) && !pPool->busy && (size <= pPool->size) )
+    {
+        pPool->busy = true;
+        sHeapStats[site].pool++;
+        sHeapStats[site].allocs++;
+        ptr = pPool->pBuf;
+    }
+    CS_LEAVE;
+    return ptr;
+}
+
+// return memory to the pool, returns false if the memory isn't from any pool
+static bool sHeapPoolFree(void *ptr)
+{
+    for (int site = 0; site < HEAP_SITE_NUM; site++)
+    {
+        HEAP_POOL_t *pPool = &sHeapPools[site];
+        if ( (pPool->pBuf != NULL) && (ptr == pPool->pBuf) )
+        {
+            CS_ENTER;
+            pPool->busy = false;
+            CS_LEAVE;
+            return true;
+        }
+    }
+    return false;
+}
+
+#else
+
+static void *sHeapPoolAlloc(const HEAP_SITE_t site, const int size)
+{
+    return NULL;
+}
+
+static bool sHeapPoolFree(void *ptr)
+{
+    return false;
+}
+
+#endif // FF_CFG_HEAPPOOLS
+
+void *heapAlloc(const HEAP_SITE_t site, const int size)
+{
+    void *pPool = sHeapPoolAlloc(site, size);
+    if (pPool != NULL)
+    {
+        return pPool;
+    }
+
+    HEAP_HEADER_t *pHeader = malloc(sizeof(HEAP_HEADER_t) + size);
+    HEAP_STATS_t *pStats = &sHeapStats[site];
+    CS_ENTER;
+    pStats->allocs++;
+    if (pHeader != NULL)
+    {
+        pStats->bytes += size;
+        pStats->live++;
+        if (pStats->bytes > pStats->peak)
+        {
+            pStats->peak = pStats->bytes;
+        }
+    }
+    else
+    {
+        pStats->fails++;
+    }
+    CS_LEAVE;
+
+    if (pHeader == NULL)
+    {
+        WARNING("heap: %s: alloc %d fail (free %u)", skHeapSiteStrs[site], size,
+            sdk_system_get_free_heap_size());
+        return NULL;
+    }
+    pHeader->site = site;
+    pHeader->size = size;
+    return &pHeader[1];
+}
+
+void heapFree(void *ptr)
+{
+    if ( (ptr == NULL) || sHeapPoolFree(ptr) )
+    {
+        return;
+    }
+
+    HEAP_HEADER_t *pHeader = &((HEAP_HEADER_t *)ptr)[-1];
+    if (pHeader->site >= HEAP_SITE_NUM)
+    {
+        ERROR("heap: bad free %p", ptr);
+        return;
+    }
+    HEAP_STATS_t *pStats = &sHeapStats[pHeader->site];
+    CS_ENTER;
+    pStats->bytes -= pHeader->size;
+    pStats->live--;
+    CS_LEAVE;
+    free(pHeader);
+}
+
+#define HEAP_PROBE_RES 64 // [bytes]
+#define HEAP_PROBE_PERIOD 30000 // [ms]
+
+int heapLargestFree(void)
+{
+    // binary search for the largest block malloc() can give us, with the scheduler suspended so
+    // that no other task runs into a failed allocation while we hold a big block (interrupts keep
+    // running, none of them allocates)
+    vTaskSuspendAll();
+    int lo = 0;
+    int hi = sdk_system_get_free_heap_size();
+    while ( (hi - lo) > HEAP_PROBE_RES )
+    {
+        const int mid = (lo + hi) / 2;
+        void *ptr = malloc(mid);
+        if (ptr != NULL)
+        {
+            free(ptr);
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    xTaskResumeAll();
+    return lo;
+}
+
+int heapGetLargest(void)
+{
+    return sHeapLastLargest;
+}
+
+void heapMonStatus(void)
+{
+    const uint32_t freeSize = sdk_system_get_free_heap_size();
+
+    // probing is expensive, so don't do it on every call
+    static uint32_t sLastProbe;
+    const uint32_t now = osTime();
+    if ( (sHeapLastLargest == 0) || ((now - sLastProbe) >= HEAP_PROBE_PERIOD) )
+    {
+        sHeapLastLargest = heapLargestFree();
+        sLastProbe = now;
+    }
+    const uint32_t largest = sHeapLastLargest;
+    if (freeSize < sHeapMinFree)
+    {
+        sHeapMinFree = freeSize;
+    }
+    if (largest < sHeapMinLargest)
+    {
+        sHeapMinLargest = largest;
+    }
+    DEBUG("mon: heap: free=%u (min %u) largest=%u (min %u) frag=%.1f%% pools=%s",
+        freeSize, sHeapMinFree, largest, sHeapMinLargest,
+        freeSize > 0 ? (double)(freeSize - largest) * 100.0 / (double)freeSize : 0.0,
+        FF_CFG_HEAPPOOLS ? "on" : "off");
+
+    HEAP_STATS_t stats[HEAP_SITE_NUM];
+    CS_ENTER;
+    memcpy(stats, sHeapStats, sizeof(stats));
+    CS_LEAVE;
+    for (int site = 0; site < HEAP_SITE_NUM; site++)
+    {
+        const HEAP_STATS_t *pkStats = &stats[site];
+        DEBUG("mon: heap: %-7s bytes=%u (%u) peak=%u allocs=%u pool=%u fails=%u",
+            skHeapSiteStrs[site], pkStats->bytes, pkStats->live, pkStats->peak,
+            pkStats->allocs, pkStats->pool, pkStats->fails);
+    }
+
+    if ((int)largest < HEAP_LARGEST_MIN)
+    {
+        WARNING("mon: heap: fragmented, largest block %u < %u, reconnecting may fail",
+            largest, HEAP_LARGEST_MIN);
+    }
+}
+
+// eof
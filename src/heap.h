@@ -0,0 +1,82 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: heap accounting (see \ref FF_HEAP)
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+
+    \defgroup FF_HEAP HEAP
+    \ingroup FF
+
+    All allocations of the firmware go through heapAlloc() and heapFree(), which keep statistics
+    per call site (#HEAP_SITE_t): current and peak bytes, number of allocations and failures. The
+    monitor prints these along with the free heap and the largest block that can currently be
+    allocated (which is what fragmentation eats and what the network stack needs for reconnecting
+    to the backend).
+
+    The allocations of the SDK, lwip and newlib don't go through this and only show in the free
+    heap and the largest block.
+
+    With CONFIG_HEAPPOOLS=1 (see config-sample.mk) the call sites that allocate a fixed size get a
+    static buffer (pool) instead of heap memory. This costs RAM all the time, but these
+    allocations can no longer fail or fragment the heap. If a pool is busy (or too small), the
+    allocation falls back to the heap.
+
+    @{
+*/
+#ifndef __HEAP_H__
+#define __HEAP_H__
+
+#include "stdinc.h"
+
+//! allocation call sites
+typedef enum HEAP_SITE_e
+{
+    HEAP_SITE_BACKEND = 0,  //!< backend status JSON tokens (pool)
+    HEAP_SITE_CONFIG,       //!< backend config JSON tokens (pool)
+    HEAP_SITE_MON,          //!< monitor task status array (pool)
+    HEAP_SITE_CRASH,        //!< crash record upload parameter
+    HEAP_SITE_NUM           //!< number of sites
+} HEAP_SITE_t;
+
+//! largest block below which the heap is considered too fragmented for (re)connecting [bytes]
+#define HEAP_LARGEST_MIN 4096
+
+//! allocate memory
+/*!
+    \param[in] site  the call site
+    \param[in] size  the number of bytes to allocate
+
+    \returns pointer to the memory, or NULL on failure
+*/
+void *heapAlloc(const HEAP_SITE_t site, const int size);
+
+//! release memory
+/*!
+    \param[in] ptr  memory from heapAlloc() (or NULL)
+*/
+void heapFree(void *ptr);
+
+//! find the largest block that can currently be allocated
+/*!
+    This probes the heap by allocating (and releasing) blocks of different sizes, with the
+    scheduler suspended. It's too expensive to be called often, use heapGetLargest() instead.
+
+    \returns the size of the largest block that can be allocated [bytes]
+*/
+int heapLargestFree(void);
+
+//! print heap monitor info
+void heapMonStatus(void);
+
+//! get the largest free block found by the last probe in heapMonStatus()
+/*!
+    The heap is probed at most every 30 seconds.
+
+    \returns the size of the largest block that could be allocated [bytes] (0 if not yet probed)
+*/
+int heapGetLargest(void);
+
+#endif // __HEAP_H__
+//@}
+// eof
@@ -14,6 +14,7 @@
 
 #include "stdinc.h"
 
+#include "stuff.h"
 #include "hsv2rgb.h"
 
 
@@ -21,78 +22,104 @@
 
 /* ***** HSV to RGB conversion ******************************************************************* */
 
-#if ( (HSV2RGB_METHOD == 1) || (HSV2RGB_METHOD == 2) )
-// classic HSV2RGB code (#HSV2RGB_METHOD 1 and 2) à la Wikipedia
-#  define HSV2RGB_CLASSIC(_H, _S, _V, _R, _G, _B) \
-    const uint8_t __H = _H; \
-    const uint8_t __S = _S; \
-    const uint8_t __V = _V; \
-    const uint32_t s = (6 * (uint32_t)__H) >> 8;               /* the segment 0..5 (360/60 * [0..255] / 256) */ \
-    const uint32_t t = (6 * (uint32_t)__H) & 0xff;             /* within the segment 0..255 (360/60 * [0..255] % 256) */ \
-    const uint32_t l = ((uint32_t)__V * (255 - (uint32_t)__S)) >> 8; /* lower level */ \
-    const uint32_t r = ((uint32_t)__V * (uint32_t)__S * t) >> 16;    /* ramp */ \
-    switch (s) \
-    { \
-        case 0: (_R) = (uint8_t)__V;        (_G) = (uint8_t)(l + r);    (_B) = (uint8_t)l;          break; \
-        case 1: (_R) = (uint8_t)(__V - r);  (_G) = (uint8_t)__V;        (_B) = (uint8_t)l;          break; \
-        case 2: (_R) = (uint8_t)l;          (_G) = (uint8_t)__V;        (_B) = (uint8_t)(l + r);    break; \
-        case 3: (_R) = (uint8_t)l;          (_G) = (uint8_t)(__V - r);  (_B) = (uint8_t)__V;        break; \
-        case 4: (_R) = (uint8_t)(l + r);    (_G) = (uint8_t)l;          (_B) = (uint8_t)__V;        break; \
-        case 5: (_R) = (uint8_t)__V;        (_G) = (uint8_t)l;          (_B) = (uint8_t)(__V - r);  break; \
-    }
-#endif
-
 // ***** classic conversion *****
 #if (HSV2RGB_METHOD == 1)
 
-
-void hsv2rgb(const uint8_t H, const uint8_t S, uint8_t V, uint8_t *R, uint8_t *G, uint8_t *B)
-{
-    HSV2RGB_CLASSIC(H, S, V, *R, *G, *B);
-}
+#  define HSV2RGB_SAT16(_S) ((uint32_t)(_S) * 257)
+#  define HSV2RGB_VAL16(_V) ((uint32_t)(_V) * 257)
 
 // ***** saturation/value dimming *****
 #elif (HSV2RGB_METHOD == 2)
 
-// saturation/value lookup table
-// Saturation/Value lookup table to compensate for the nonlinearity of human
-// vision. Used in the getRGB function on saturation and brightness to make
-// dimming look more natural. Exponential function used to create values below
-// : x from 0 - 255 : y = round(pow( 2.0, x+64/40.0) - 1)
-// From: http://www.kasperkamperman.com/blog/arduino/arduino-programming-hsb-to-rgb/
-static const uint8_t skMatrixDimCurve[] = // RAM
+// Saturation/value lookup table to compensate for the nonlinearity of human vision. Used on
+// saturation and brightness to make dimming look more natural. This is the exponential curve
+// y = round(pow(2.0, (x + 64) / 40.0) - 1) for x = 0..255 from
+// http://www.kasperkamperman.com/blog/arduino/arduino-programming-hsb-to-rgb/ with 16 bits
+// resolution: the 8 bit curve has long runs of identical values at the low end (e.g. fourteen
+// 3s), which makes for visible steps in slow fades, so this is linearly interpolated through the
+// centres of these runs (times 257, so that 255 maps to 65535). It deviates less than one 8 bit
+// step from the 8 bit curve.
+static IROM uint16_t skMatrixDimCurve16[] __ALIGN(4) = // flash
 {
-      0,   1,   1,   2,   2,   2,   2,   2,   2,   3,   3,   3,   3,   3,   3,   3,
-      3,   3,   3,   3,   3,   3,   3,   4,   4,   4,   4,   4,   4,   4,   4,   4,
-      4,   4,   4,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5,   6,   6,   6,
-      6,   6,   6,   6,   6,   7,   7,   7,   7,   7,   7,   7,   8,   8,   8,   8,
-      8,   8,   9,   9,   9,   9,   9,   9,  10,  10,  10,  10,  10,  11,  11,  11,
-     11,  11,  12,  12,  12,  12,  12,  13,  13,  13,  13,  14,  14,  14,  14,  15,
-     15,  15,  16,  16,  16,  16,  17,  17,  17,  18,  18,  18,  19,  19,  19,  20,
-     20,  20,  21,  21,  22,  22,  22,  23,  23,  24,  24,  25,  25,  25,  26,  26,
-     27,  27,  28,  28,  29,  29,  30,  30,  31,  32,  32,  33,  33,  34,  35,  35,
-     36,  36,  37,  38,  38,  39,  40,  40,  41,  42,  43,  43,  44,  45,  46,  47,
-     48,  48,  49,  50,  51,  52,  53,  54,  55,  56,  57,  58,  59,  60,  61,  62,
-     63,  64,  65,  66,  68,  69,  70,  71,  73,  74,  75,  76,  78,  79,  81,  82,
-     83,  85,  86,  88,  90,  91,  93,  94,  96,  98,  99, 101, 103, 105, 107, 109,
-    110, 112, 114, 116, 118, 121, 123, 125, 127, 129, 132, 134, 136, 139, 141, 144,
-    146, 149, 151, 154, 157, 159, 162, 165, 168, 171, 174, 177, 180, 183, 186, 190,
-    193, 196, 200, 203, 207, 211, 214, 218, 222, 226, 230, 234, 238, 242, 248, 255
+        0,   171,   289,   353,   418,   482,   527,   553,   578,   604,   630,   655,   681,   707,   732,   758,
+      781,   801,   820,   840,   860,   880,   900,   919,   939,   959,   979,   998,  1018,  1040,  1063,  1086,
+     1110,  1133,  1156,  1180,  1203,  1227,  1250,  1273,  1299,  1328,  1356,  1385,  1414,  1442,  1471,  1499,
+     1528,  1559,  1593,  1628,  1662,  1696,  1730,  1765,  1799,  1839,  1878,  1918,  1957,  1997,  2036,  2077,
+     2120,  2163,  2206,  2249,  2292,  2336,  2383,  2430,  2477,  2523,  2570,  2621,  2673,  2724,  2776,  2827,
+     2878,  2930,  2981,  3033,  3084,  3141,  3198,  3255,  3312,  3373,  3437,  3502,  3566,  3635,  3708,  3782,
+     3855,  3928,  4002,  4075,  4149,  4222,  4296,  4369,  4455,  4540,  4626,  4712,  4797,  4883,  4969,  5054,
+     5140,  5243,  5346,  5448,  5551,  5654,  5757,  5860,  5975,  6104,  6219,  6322,  6425,  6528,  6631,  6746,
+     6875,  7003,  7132,  7260,  7389,  7517,  7646,  7796,  7967,  8138,  8288,  8417,  8567,  8738,  8909,  9059,
+     9188,  9338,  9509,  9680,  9852, 10023, 10194, 10366, 10537, 10794, 10965, 11137, 11308, 11565, 11822, 12079,
+    12250, 12422, 12593, 12850, 13107, 13364, 13621, 13878, 14135, 14392, 14649, 14906, 15163, 15420, 15677, 15934,
+    16191, 16448, 16705, 16962, 17476, 17733, 17990, 18247, 18761, 19018, 19275, 19532, 20046, 20303, 20817, 21074,
+    21331, 21845, 22102, 22616, 23130, 23387, 23901, 24158, 24672, 25186, 25443, 25957, 26471, 26985, 27499, 28013,
+    28270, 28784, 29298, 29812, 30326, 31097, 31611, 32125, 32639, 33153, 33924, 34438, 34952, 35723, 36237, 37008,
+    37522, 38293, 38807, 39578, 40349, 40863, 41634, 42405, 43176, 43947, 44718, 45489, 46260, 47031, 47802, 48830,
+    49601, 50372, 51400, 52171, 53199, 54227, 54998, 56026, 57054, 58082, 59110, 60138, 61166, 62194, 63736, 65535
 };
 
-
-void hsv2rgb(const uint8_t H, const uint8_t S, uint8_t V, uint8_t *R, uint8_t *G, uint8_t *B)
-{
-    HSV2RGB_CLASSIC(H, 255 - skMatrixDimCurve[255 - S], skMatrixDimCurve[V],
-        *R, *G, *B);
-}
-
+#  define HSV2RGB_SAT16(_S) (65535 - (uint32_t)romRead16(&skMatrixDimCurve16[255 - (_S)]))
+#  define HSV2RGB_VAL16(_V) ((uint32_t)romRead16(&skMatrixDimCurve16[_V]))
 
 #else
 #  error Illegal value for HSV2RGB_METHOD!
 #endif
 
+/* ***** frame conversion ************************************************************************ */
+
+// The classic conversion à la Wikipedia has four levels: value, lower + ramp, lower and
+// value - ramp. For each hue segment this table says which level goes to R, G and B, which
+// replaces the switch() by lookups.
+static const uint8_t skHsv2rgbSegLevel[6][3] =
+{
+    { 0, 1, 2 }, // 0: R = value,         G = lower + ramp,  B = lower
+    { 3, 0, 2 }, // 1: R = value - ramp,  G = value,         B = lower
+    { 2, 0, 1 }, // 2: R = lower,         G = value,         B = lower + ramp
+    { 2, 3, 0 }, // 3: R = lower,         G = value - ramp,  B = value
+    { 1, 2, 0 }, // 4: R = lower + ramp,  G = lower,         B = value
+    { 0, 2, 3 }, // 5: R = value,         G = lower,         B = value - ramp
+};
+
+// number of recent conversions remembered by hsv2rgbFrame16() (must be a power of two)
+#define HSV2RGB_CACHE_SIZE 4
 
+void hsv2rgbFrame16(const uint8_t (*pkHSV)[3], uint16_t (*pRGB)[3], const int num)
+{
+    // direct-mapped cache of recent conversions, keys are 0x00HHSSVV (0xffffffff = unused entry)
+    uint32_t cacheKey[HSV2RGB_CACHE_SIZE];
+    uint16_t cacheRGB[HSV2RGB_CACHE_SIZE][3];
+    memset(cacheKey, 0xff, sizeof(cacheKey));
+
+    for (int ix = 0; ix < num; ix++)
+    {
+        const uint32_t H = pkHSV[ix][0];
+        const uint32_t S = pkHSV[ix][1];
+        const uint32_t V = pkHSV[ix][2];
+        const uint32_t key = (H << 16) | (S << 8) | V;
+        const uint32_t cacheIx = (H ^ S ^ V) & (HSV2RGB_CACHE_SIZE - 1);
+
+        // many LEDs have the same colour (e.g. all green), so likely we have done this one already
+        if (cacheKey[cacheIx] != key)
+        {
+            const uint32_t s = HSV2RGB_SAT16(S);
+            const uint32_t v = HSV2RGB_VAL16(V);
+            const uint32_t seg = (6 * H) >> 8;             // the segment 0..5 (360/60 * [0..255] / 256)
+            const uint32_t t   = (6 * H) & 0xff;           // within the segment 0..255
+            const uint32_t l = (v * (65535 - s)) >> 16;    // lower level
+            const uint32_t r = (((v * s) >> 16) * t) >> 8; // ramp
+            const uint16_t levels[4] = { v, l + r, l, v - r };
+            const uint8_t *pkLevel = skHsv2rgbSegLevel[seg];
+            cacheKey[cacheIx] = key;
+            cacheRGB[cacheIx][0] = levels[ pkLevel[0] ];
+            cacheRGB[cacheIx][1] = levels[ pkLevel[1] ];
+            cacheRGB[cacheIx][2] = levels[ pkLevel[2] ];
+        }
+        pRGB[ix][0] = cacheRGB[cacheIx][0];
+        pRGB[ix][1] = cacheRGB[cacheIx][1];
+        pRGB[ix][2] = cacheRGB[cacheIx][2];
+    }
+}
 
 /* *********************************************************************************************** */
 
@@ -17,16 +17,16 @@
 
 #include "stdinc.h"
 
-//! hue, saturation and value (HSV) to red, green, blue (RGB) conversion
+//! HSV to RGB conversion of a whole frame with 16 bits output resolution
 /*!
-    \param[in]  H  hue value (scaled 0..255)
-    \param[in]  S  saturation value (scaled 0..255)
-    \param[in]  V  "brightness" value (scaled 0..255)
-    \param[out] R  red (0..255)
-    \param[out] G  green (0..255)
-    \param[out] B  blue (0..255)
+    The RGB values are 0..65535, which gives smooth fades at low values. Conversions are re-used
+    for elements with identical HSV values.
+
+    \param[in]  pkHSV  list of hue, saturation and value triplets
+    \param[out] pRGB   list of red, green and blue triplets (0..65535)
+    \param[in]  num    number of elements in the lists
 */
-void hsv2rgb(const uint8_t H, const uint8_t S, uint8_t V, uint8_t *R, uint8_t *G, uint8_t *B);
+void hsv2rgbFrame16(const uint8_t (*pkHSV)[3], uint16_t (*pRGB)[3], const int num);
 
 
 #endif // __HSV2RGB_H__
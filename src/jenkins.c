@@ -8,13 +8,20 @@
 
 #include "stdinc.h"
 
+#include <sysparam.h>
+#include <esp/rtcmem_regs.h>
+
+#define DEBUG_MOD DEBUG_MOD_JENKINS
 #include "debug.h"
+#include "mon.h"
 #include "stuff.h"
 #include "leds.h"
 #include "config.h"
 #include "tone.h"
 #include "jenkins.h"
 #include "status.h"
+#include "crash.h"
+#include "sched.h"
 
 /* ***** external interface ********************************************************************* */
 
@@ -121,6 +128,7 @@ void jenkinsSetInfo(const JENKINS_INFO_t *pkInfo)
         {
             ERROR("jenkins: queue full");
         }
+        schedTrigger(SCHED_JOB_JENKINS);
     }
 }
 
@@ -133,6 +141,7 @@ void jenkinsClearAll(void)
     {
         ERROR("jenkins: queue full");
     }
+    schedTrigger(SCHED_JOB_JENKINS);
 }
 
 void jenkinsUnknownAll(void)
@@ -144,6 +153,7 @@ void jenkinsUnknownAll(void)
     {
         ERROR("jenkins: queue full");
     }
+    schedTrigger(SCHED_JOB_JENKINS);
 }
 
 
@@ -268,6 +278,164 @@ static JENKINS_RESULT_t sJenkinsWorstResult;
 // currently most active state
 static JENKINS_STATE_t sJenkinsActiveState;
 
+// The results of the active channels are kept in a snapshot, which is stored in the RTC memory
+// (after the crash record, see crash.h) on every change and in the flash (sysparam) at most every
+// JENKINS_SNAPSHOT_FLASH_INTERVAL. On boot the snapshot is restored (from the RTC memory if it
+// survived the reset, otherwise from the flash) with all states set to unknown, i.e. the channels
+// are shown as stale (flicker) until the backend sends the real states.
+
+#define JENKINS_SNAPSHOT_MAGIC 0x6e656a53
+#define JENKINS_SNAPSHOT_SYSPARAM_KEY "jenkins"
+#define JENKINS_SNAPSHOT_FLASH_INTERVAL 600 // [s]
+#define JENKINS_SNAPSHOT_RTCMEM_OFFS (CRASH_RECORD_SIZE / sizeof(uint32_t))
+#define JENKINS_SNAPSHOT_ACTIVE 0x80
+
+typedef struct JENKINS_SNAPSHOT_s
+{
+    uint32_t magic;
+    uint32_t checksum;
+    uint8_t  channels[JENKINS_MAX_CH]; // JENKINS_SNAPSHOT_ACTIVE | result, 0 for inactive channels
+} JENKINS_SNAPSHOT_t;
+
+#define JENKINS_SNAPSHOT_WORDS (sizeof(JENKINS_SNAPSHOT_t) / sizeof(uint32_t))
+
+// must fit into the RTC memory after the crash record (RTCMEM_FREE is 512 bytes), word-aligned
+#if ( ((CRASH_RECORD_SIZE % 4) != 0) || ((JENKINS_MAX_CH % 4) != 0) || \
+      ((CRASH_RECORD_SIZE + 8 + JENKINS_MAX_CH) > 512) )
+#  error Nope!
+#endif
+
+static JENKINS_SNAPSHOT_t sJenkinsSnapshot;   // current snapshot (as in the RTC memory)
+static JENKINS_SNAPSHOT_t sJenkinsSnapshotFl; // snapshot in the flash
+static bool     sJenkinsSnapshotDirty;        // new info stored since the last snapshot
+static uint32_t sJenkinsSnapshotFlTime;       // last flash write [ms]
+static bool     sJenkinsRestored;             // snapshot was restored
+
+static uint32_t sJenkinsSnapshotChecksum(const JENKINS_SNAPSHOT_t *pkSnapshot)
+{
+    const uint32_t *pkWords = (const uint32_t *)pkSnapshot;
+    uint32_t checksum = 0;
+    for (int ix = 2; ix < (int)JENKINS_SNAPSHOT_WORDS; ix++)
+    {
+        checksum += pkWords[ix];
+    }
+    return ~checksum;
+}
+
+static bool sJenkinsSnapshotValid(const JENKINS_SNAPSHOT_t *pkSnapshot)
+{
+    return (pkSnapshot->magic == JENKINS_SNAPSHOT_MAGIC) &&
+        (pkSnapshot->checksum == sJenkinsSnapshotChecksum(pkSnapshot));
+}
+
+// update snapshot from current info, store in RTC memory and, if it's time, in the flash
+static void sJenkinsSnapshotStore(void)
+{
+    if (sJenkinsSnapshotDirty)
+    {
+        sJenkinsSnapshotDirty = false;
+        JENKINS_SNAPSHOT_t snapshot;
+        memset(&snapshot, 0, sizeof(snapshot));
+        for (int ix = 0; ix < NUMOF(sJenkinsInfo); ix++)
+        {
+            if (sJenkinsInfo[ix].active)
+            {
+                snapshot.channels[ix] = JENKINS_SNAPSHOT_ACTIVE | (sJenkinsInfo[ix].result & 0x0f);
+            }
+        }
+        snapshot.magic = JENKINS_SNAPSHOT_MAGIC;
+        snapshot.checksum = sJenkinsSnapshotChecksum(&snapshot);
+        if (memcmp(&snapshot, &sJenkinsSnapshot, sizeof(snapshot)) != 0)
+        {
+            sJenkinsSnapshot = snapshot;
+            // the RTC memory must be written word by word
+            const uint32_t *pkWords = (const uint32_t *)&sJenkinsSnapshot;
+            for (int ix = 0; ix < (int)JENKINS_SNAPSHOT_WORDS; ix++)
+            {
+                RTCMEM_FREE[JENKINS_SNAPSHOT_RTCMEM_OFFS + ix] = pkWords[ix];
+            }
+        }
+    }
+
+    // limit flash writes
+    const uint32_t now = osTime();
+    if ( (memcmp(&sJenkinsSnapshot, &sJenkinsSnapshotFl, sizeof(sJenkinsSnapshot)) != 0) &&
+         ( (sJenkinsSnapshotFlTime == 0) || ((now - sJenkinsSnapshotFlTime) > (1000 * JENKINS_SNAPSHOT_FLASH_INTERVAL)) ) )
+    {
+        sJenkinsSnapshotFlTime = now;
+        DEBUG("jenkins: snapshot store");
+        const sysparam_status_t res = sysparam_set_data(JENKINS_SNAPSHOT_SYSPARAM_KEY,
+            (const uint8_t *)&sJenkinsSnapshot, sizeof(sJenkinsSnapshot), true);
+        if (res == SYSPARAM_OK)
+        {
+            sJenkinsSnapshotFl = sJenkinsSnapshot;
+        }
+        else
+        {
+            WARNING("jenkins: sysparam set fail (%d)", res);
+        }
+    }
+}
+
+// restore info from snapshot
+static void sJenkinsSnapshotRestore(void)
+{
+    // load snapshot from flash
+    size_t len = 0;
+    bool isBinary = false;
+    const sysparam_status_t res = sysparam_get_data_static(JENKINS_SNAPSHOT_SYSPARAM_KEY,
+        (uint8_t *)&sJenkinsSnapshotFl, sizeof(sJenkinsSnapshotFl), &len, &isBinary);
+    if ( (res != SYSPARAM_OK) || !isBinary || (len != sizeof(sJenkinsSnapshotFl)) ||
+         !sJenkinsSnapshotValid(&sJenkinsSnapshotFl) )
+    {
+        if (res != SYSPARAM_NOTFOUND)
+        {
+            WARNING("jenkins: bad snapshot in flash (%d)", res);
+        }
+        memset(&sJenkinsSnapshotFl, 0, sizeof(sJenkinsSnapshotFl));
+    }
+
+    // RTC memory is newer (if it survived the reset)
+    uint32_t *pWords = (uint32_t *)&sJenkinsSnapshot;
+    for (int ix = 0; ix < (int)JENKINS_SNAPSHOT_WORDS; ix++)
+    {
+        pWords[ix] = RTCMEM_FREE[JENKINS_SNAPSHOT_RTCMEM_OFFS + ix];
+    }
+    const char *source = "rtc";
+    if (!sJenkinsSnapshotValid(&sJenkinsSnapshot))
+    {
+        sJenkinsSnapshot = sJenkinsSnapshotFl;
+        source = "flash";
+    }
+    if (!sJenkinsSnapshotValid(&sJenkinsSnapshot))
+    {
+        memset(&sJenkinsSnapshot, 0, sizeof(sJenkinsSnapshot));
+        DEBUG("jenkins: no snapshot");
+        return;
+    }
+
+    int nRestored = 0;
+    for (int ix = 0; ix < NUMOF(sJenkinsInfo); ix++)
+    {
+        const uint8_t ch = sJenkinsSnapshot.channels[ix];
+        const JENKINS_RESULT_t result = ch & 0x0f;
+        if ( ((ch & JENKINS_SNAPSHOT_ACTIVE) != 0) && (result <= JENKINS_RESULT_FAILURE) )
+        {
+            JENKINS_INFO_t *pInfo = &sJenkinsInfo[ix];
+            pInfo->chIx   = ix;
+            pInfo->active = true;
+            pInfo->state  = JENKINS_STATE_UNKNOWN; // stale
+            pInfo->result = result;
+            strcpy(pInfo->job, "?");
+            strcpy(pInfo->server, "?");
+            sJenkinsInfoDirty[ix] = true;
+            nRestored++;
+        }
+    }
+    PRINT("jenkins: restored %d channels from %s", nRestored, source);
+    sJenkinsRestored = true;
+}
+
 // store info
 static void sJenkinsStoreInfo(const JENKINS_INFO_t *pkInfo)
 {
@@ -284,6 +452,7 @@ static void sJenkinsStoreInfo(const JENKINS_INFO_t *pkInfo)
             pInfo->chIx = ix;
         }
         sJenkinsInfoDirty[pkInfo->chIx] = true;
+        sJenkinsSnapshotDirty = true;
     }
 
     // inform
@@ -330,6 +499,15 @@ static void sJenkinsUnknownAll(void)
     }
 }
 
+// play custom melody (from the melody cache), or the builtin melody if there's none
+static void sJenkinsMelody(const uint32_t hash, const char *builtin)
+{
+    if (!toneCacheMelody(hash))
+    {
+        toneBuiltinMelody(builtin);
+    }
+}
+
 // update all dirty channels, re-calculate worst result, play sounds
 void sJenkinsUpdate(void)
 {
@@ -410,6 +588,9 @@ void sJenkinsUpdate(void)
         ledsSetStateHello(sJenkinsLedStateFromJenkins(activeState, worstResult), pkState);
     }
 
+    // the LED states are set now, see sLedsRenderFrame() and ledsTick() for the next trace points
+    monTrace(MON_TRACE_APPLY);
+
     // play sound if we changed from failure/warning to success or from success/warning to failure
     // TODO: play more sounds if CONFIG_NOISE_MORE
     // FIXME: also check for state == idle?
@@ -430,18 +611,18 @@ void sJenkinsUpdate(void)
                                 statusChewie();
                                 if (configGetNoise() >= CONFIG_NOISE_MOST)
                                 {
-                                    toneBuiltinMelody("ImperialShort");
+                                    sJenkinsMelody(configGetMelFailure(), "ImperialShort");
                                 }
                                 break;
                             case CONFIG_MODEL_HELLO:
                                 statusHello();
                                 if (configGetNoise() >= CONFIG_NOISE_MOST)
                                 {
-                                    toneBuiltinMelody("ImperialShort");
+                                    sJenkinsMelody(configGetMelFailure(), "ImperialShort");
                                 }
                                 break;
                             default:
-                                toneBuiltinMelody("ImperialShort");
+                                sJenkinsMelody(configGetMelFailure(), "ImperialShort");
                                 break;
                         }
                     }
@@ -451,7 +632,7 @@ void sJenkinsUpdate(void)
                     if (configGetNoise() >= CONFIG_NOISE_MORE)
                     {
                         toneStop();
-                        toneBuiltinMelody("IndianaShort");
+                        sJenkinsMelody(configGetMelSuccess(), "IndianaShort");
                     }
                     break;
                 case JENKINS_RESULT_UNSTABLE:
@@ -466,40 +647,63 @@ void sJenkinsUpdate(void)
     sJenkinsActiveState = activeState;
 }
 
-// Jenkins task, waits for messages and updates LEDs accordingly
-static void sJenkinsTask(void *pArg)
+// handle messages (waiting up to timeout [ticks] for them) and update LEDs accordingly
+static void sJenkinsProcess(const TickType_t timeout)
 {
-    while (true)
+    static JENKINS_MSG_t msg;
+    static bool doUpdate;
+
+    // show restored snapshot
+    if (sJenkinsRestored)
     {
-        static JENKINS_MSG_t msg;
-        static bool doUpdate;
+        sJenkinsRestored = false;
+        doUpdate = true;
+    }
 
-        while (xQueueReceive(sJenkinsMsgQueue, &msg, 100))
+    while (xQueueReceive(sJenkinsMsgQueue, &msg, timeout))
+    {
+        switch (msg.type)
         {
-            switch (msg.type)
-            {
-                case JENKINS_MSG_TYPE_INFO:
-                    sJenkinsStoreInfo(&msg.info);
-                    doUpdate = true;
-                    break;
-                case JENKINS_MSG_TYPE_CLEAR_ALL:
-                    sJenkinsClearAll();
-                    doUpdate = true;
-                    break;
-                case JENKINS_MSG_TYPE_UNKNOWN_ALL:
-                    sJenkinsUnknownAll();
-                    doUpdate = true;
-                    break;
-            }
+            case JENKINS_MSG_TYPE_INFO:
+                sJenkinsStoreInfo(&msg.info);
+                doUpdate = true;
+                break;
+            case JENKINS_MSG_TYPE_CLEAR_ALL:
+                sJenkinsClearAll();
+                doUpdate = true;
+                break;
+            case JENKINS_MSG_TYPE_UNKNOWN_ALL:
+                sJenkinsUnknownAll();
+                doUpdate = true;
+                break;
         }
+    }
 
-        if (doUpdate)
-        {
-            sJenkinsUpdate();
-            doUpdate = false;
-        }
+    if (doUpdate)
+    {
+        sJenkinsUpdate();
+        doUpdate = false;
+    }
+
+    sJenkinsSnapshotStore();
+}
+
+#if (FF_CFG_SCHED)
+// Jenkins job, triggered by the messages
+static void sJenkinsJob(void)
+{
+    sJenkinsProcess(0);
+}
+#else
+// Jenkins task, waits for messages
+static void sJenkinsTask(void *pArg)
+{
+    while (true)
+    {
+        sJenkinsProcess(100);
     }
 }
+#endif // FF_CFG_SCHED
 
 
 /* ***** init and monitoring stuff ************************************************************** */
@@ -545,15 +749,20 @@ void jenkinsInit(void)
     static uint8_t sQueueBuf[sizeof(JENKINS_MSG_t) * JENKINS_MSG_QUEUE_LEN];
     sJenkinsMsgQueue = xQueueCreateStatic(JENKINS_MSG_QUEUE_LEN, sizeof(JENKINS_MSG_t), sQueueBuf, &sQueue);
     sJenkinsClearAll();
+    sJenkinsSnapshotRestore();
 }
 
 void jenkinsStart(void)
 {
     DEBUG("jenkins: start");
 
+#if (FF_CFG_SCHED)
+    schedAdd(SCHED_JOB_JENKINS, sJenkinsJob, 1000, 0);
+#else
     static StackType_t sJenkinsTaskStack[512];
     static StaticTask_t sJenkinsTaskTCB;
     xTaskCreateStatic(sJenkinsTask, "ff_jenkins", NUMOF(sJenkinsTaskStack), NULL, 2, sJenkinsTaskStack, &sJenkinsTaskTCB);
+#endif
 }
 
 // eof
@@ -14,10 +14,10 @@
 #include "stuff.h"
 #include "json.h"
 
-jsmntok_t *jsmnAllocTokens(const int maxTokens)
+jsmntok_t *jsmnAllocTokens(const HEAP_SITE_t site, const int maxTokens)
 {
     const int tokensSize = maxTokens * sizeof(jsmntok_t);
-    jsmntok_t *pTokens = malloc(tokensSize);
+    jsmntok_t *pTokens = heapAlloc(site, tokensSize);
     if (pTokens == NULL)
     {
         return NULL;
@@ -16,6 +16,7 @@
 #include <jsmn.h>
 
 #include "stdinc.h"
+#include "heap.h"
 
 #define JSMN_STREQ(json, pkTok, str) (    \
         ((pkTok)->type == JSMN_STRING) && \
@@ -28,8 +29,8 @@
         (strncmp(&json[(pkTok)->start], str, (pkTok)->end - (pkTok)->start) == 0) )
 
 
-//! memory for JSON parser
-jsmntok_t *jsmnAllocTokens(const int maxTokens);
+//! memory for JSON parser (release with heapFree())
+jsmntok_t *jsmnAllocTokens(const HEAP_SITE_t site, const int maxTokens);
 
 //! parse JSON into tokens
 int jsmnParse(char *json, const int len, jsmntok_t *pTokens, const int maxTokens);
@@ -0,0 +1,476 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: LED effect programs (see \ref FF_LEDFX)
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+
+    \addtogroup FF_LEDFX
+
+    @{
+*/
+
+#include "stdinc.h"
+
+#include <sysparam.h>
+
+#include "base64.h"
+
+#include "stuff.h"
+#define DEBUG_MOD DEBUG_MOD_LEDS
+#include "debug.h"
+#include "ledfx.h"
+
+// number of effects (LEDS_FX_t) that can be replaced by a program
+#define LEDFX_NUM_FX (LEDS_FX_BLINK + 1)
+
+// maximum size of the (decoded) data [bytes]
+#define LEDFX_DATA_SIZE (1 + (LEDFX_NUM_FX * (2 + LEDFX_PROG_SIZE)))
+
+// flash (sysparam) key
+#define LEDFX_SYSPARAM_KEY "ledfx"
+
+// number of registers
+#define LEDFX_NUM_REGS 8
+
+// maximum number of keyframes for the KEY instruction
+#define LEDFX_MAX_KEYS 8
+
+typedef enum LEDFX_OP_e
+{
+    LEDFX_OP_END  = 0x00,
+    LEDFX_OP_LDI  = 0x01,
+    LEDFX_OP_MOV  = 0x02,
+    LEDFX_OP_ADD  = 0x03,
+    LEDFX_OP_SUB  = 0x04,
+    LEDFX_OP_MUL  = 0x05,
+    LEDFX_OP_SHR  = 0x06,
+    LEDFX_OP_MOD  = 0x07,
+    LEDFX_OP_MIN  = 0x08,
+    LEDFX_OP_MAX  = 0x09,
+    LEDFX_OP_SIN  = 0x0a,
+    LEDFX_OP_EASE = 0x0b,
+    LEDFX_OP_KEY  = 0x0c,
+    LEDFX_OP_RND  = 0x0d,
+    LEDFX_OP_SKZ  = 0x0e,
+
+} LEDFX_OP_t;
+
+// loaded programs
+static uint8_t sLedfxProgs[LEDFX_NUM_FX][LEDFX_PROG_SIZE];
+static int     sLedfxProgLen[LEDFX_NUM_FX];
+static uint32_t sLedfxRunCount;
+static uint32_t sLedfxErrCount;
+
+// copy of the loaded data (for comparing it to new data and storing it in the flash)
+static uint8_t sLedfxData[LEDFX_DATA_SIZE];
+static int     sLedfxDataLen;
+
+static SemaphoreHandle_t sLedfxMutex;
+
+// quarter sine wave (0..255), see sLedfxInitTables()
+static uint8_t sLedfxSinQ[64 + 1];
+
+static void sLedfxInitTables(void)
+{
+    // floor(sin(0:pi/2/64:pi/2).*255)
+    for (int ix = 0; ix < NUMOF(sLedfxSinQ); ix++)
+    {
+        sLedfxSinQ[ix] = floor(sin((double)ix * M_PI / (double)(2 * 64)) * 255.0);
+    }
+}
+
+// sine of phase (0..255) scaled to 0..255
+static int32_t sLedfxSin(const int32_t phase)
+{
+    const int32_t p = phase & 0xff;
+    int32_t s;
+    if      (p < 64)  { s =  sLedfxSinQ[p]; }
+    else if (p < 128) { s =  sLedfxSinQ[128 - p]; }
+    else if (p < 192) { s = -sLedfxSinQ[p - 128]; }
+    else              { s = -sLedfxSinQ[256 - p]; }
+    return (s + 256) >> 1;
+}
+
+// smoothstep of level (0..255) scaled to 0..255
+static int32_t sLedfxEase(const int32_t level)
+{
+    const int32_t x = CLIP(level, 0, 255);
+    return (x * x * ((3 * 255) - (2 * x))) / (255 * 255);
+}
+
+// piecewise-linear interpolation through n (t, v) keyframes
+static int32_t sLedfxKey(const int32_t phase, const uint8_t *pkKeys, const int n)
+{
+    const int32_t p = CLIP(phase, 0, 255);
+    if (p <= pkKeys[0])
+    {
+        return pkKeys[1];
+    }
+    for (int ix = 1; ix < n; ix++)
+    {
+        const int32_t t0 = pkKeys[(2 * ix) - 2];
+        const int32_t v0 = pkKeys[(2 * ix) - 1];
+        const int32_t t1 = pkKeys[(2 * ix) + 0];
+        const int32_t v1 = pkKeys[(2 * ix) + 1];
+        if (p <= t1)
+        {
+            return v0 + (((v1 - v0) * (p - t0)) / (t1 - t0));
+        }
+    }
+    return pkKeys[(2 * n) - 1];
+}
+
+// size of instruction [bytes], or 0 if it's illegal
+static int sLedfxInstrSize(const uint8_t *pkCode, const int remaining)
+{
+    const uint8_t op = pkCode[0];
+    const uint8_t d  = remaining > 1 ? (pkCode[1] >> 4) : 0xff;
+    int size = 0;
+    switch (op)
+    {
+        case LEDFX_OP_END:
+            size = 1;
+            break;
+        case LEDFX_OP_LDI:
+            size = 4;
+            break;
+        case LEDFX_OP_MOV:
+        case LEDFX_OP_ADD:
+        case LEDFX_OP_SUB:
+        case LEDFX_OP_MUL:
+        case LEDFX_OP_SHR:
+        case LEDFX_OP_MOD:
+        case LEDFX_OP_MIN:
+        case LEDFX_OP_MAX:
+        case LEDFX_OP_SIN:
+        case LEDFX_OP_EASE:
+        case LEDFX_OP_RND:
+        case LEDFX_OP_SKZ:
+            size = 2;
+            if ( (remaining >= 2) && ((pkCode[1] & 0x0f) >= LEDFX_NUM_REGS) && (op != LEDFX_OP_SKZ) )
+            {
+                return 0;
+            }
+            break;
+        case LEDFX_OP_KEY:
+        {
+            if (remaining < 3)
+            {
+                return 0;
+            }
+            const int n = pkCode[2];
+            if ( (n < 1) || (n > LEDFX_MAX_KEYS) || ((pkCode[1] & 0x0f) >= LEDFX_NUM_REGS) )
+            {
+                return 0;
+            }
+            size = 3 + (2 * n);
+            if (size > remaining)
+            {
+                return 0;
+            }
+            for (int ix = 1; ix < n; ix++)
+            {
+                if (pkCode[3 + (2 * ix)] <= pkCode[3 + (2 * ix) - 2])
+                {
+                    return 0;
+                }
+            }
+            break;
+        }
+        default:
+            return 0;
+    }
+    if ( (size > remaining) || ((size > 1) && (d >= LEDFX_NUM_REGS)) )
+    {
+        return 0;
+    }
+    return size;
+}
+
+// check program
+static bool sLedfxCheck(const uint8_t *pkCode, const int len)
+{
+    // find instruction boundaries
+    bool boundary[LEDFX_PROG_SIZE + 1];
+    memset(boundary, 0, sizeof(boundary));
+    int pc = 0;
+    while (pc < len)
+    {
+        const int size = sLedfxInstrSize(&pkCode[pc], len - pc);
+        if (size == 0)
+        {
+            WARNING("ledfx: illegal instruction 0x%02x at %d", pkCode[pc], pc);
+            return false;
+        }
+        boundary[pc] = true;
+        pc += size;
+    }
+    boundary[len] = true;
+
+    // skips must land on an instruction (or the end of the program)
+    pc = 0;
+    while (pc < len)
+    {
+        const int size = sLedfxInstrSize(&pkCode[pc], len - pc);
+        if (pkCode[pc] == LEDFX_OP_SKZ)
+        {
+            const int target = pc + size + (pkCode[pc + 1] & 0x0f);
+            if ( (target > len) || !boundary[target] )
+            {
+                WARNING("ledfx: illegal skip at %d", pc);
+                return false;
+            }
+        }
+        pc += size;
+    }
+    return true;
+}
+
+// decode data into the programs
+static bool sLedfxDecode(const uint8_t *pkData, const int dataLen,
+    uint8_t progs[LEDFX_NUM_FX][LEDFX_PROG_SIZE], int progLen[LEDFX_NUM_FX])
+{
+    memset(progLen, 0, LEDFX_NUM_FX * sizeof(*progLen));
+    if (dataLen == 0)
+    {
+        return true;
+    }
+    if (pkData[0] != LEDFX_VERSION)
+    {
+        WARNING("ledfx: wrong version (%u)", pkData[0]);
+        return false;
+    }
+    int offs = 1;
+    while (offs < dataLen)
+    {
+        if ((offs + 2) > dataLen)
+        {
+            WARNING("ledfx: truncated data");
+            return false;
+        }
+        const int fx  = pkData[offs + 0];
+        const int len = pkData[offs + 1];
+        offs += 2;
+        if ( (fx >= LEDFX_NUM_FX) || (len < 1) || (len > LEDFX_PROG_SIZE) || ((offs + len) > dataLen) )
+        {
+            WARNING("ledfx: illegal program (fx=%d, len=%d)", fx, len);
+            return false;
+        }
+        if (!sLedfxCheck(&pkData[offs], len))
+        {
+            return false;
+        }
+        memcpy(progs[fx], &pkData[offs], len);
+        progLen[fx] = len;
+        offs += len;
+    }
+    return true;
+}
+
+// decode and load data, returns true if it was loaded
+static bool sLedfxLoadData(const uint8_t *pkData, const int dataLen)
+{
+    static uint8_t progs[LEDFX_NUM_FX][LEDFX_PROG_SIZE];
+    static int progLen[LEDFX_NUM_FX];
+    if (!sLedfxDecode(pkData, dataLen, progs, progLen))
+    {
+        return false;
+    }
+
+    xSemaphoreTake(sLedfxMutex, portMAX_DELAY);
+    memcpy(sLedfxProgs, progs, sizeof(sLedfxProgs));
+    memcpy(sLedfxProgLen, progLen, sizeof(sLedfxProgLen));
+    memcpy(sLedfxData, pkData, dataLen);
+    sLedfxDataLen = dataLen;
+    xSemaphoreGive(sLedfxMutex);
+
+    for (int fx = 0; fx < LEDFX_NUM_FX; fx++)
+    {
+        if (progLen[fx] > 0)
+        {
+            DEBUG("ledfx: fx %d program (%d bytes)", fx, progLen[fx]);
+        }
+    }
+    return true;
+}
+
+void ledfxInit(void)
+{
+    DEBUG("ledfx: init (%u+%u)", sizeof(sLedfxProgs), sizeof(sLedfxData));
+
+    static StaticSemaphore_t sMutex;
+    sLedfxMutex = xSemaphoreCreateMutexStatic(&sMutex);
+
+    sLedfxInitTables();
+
+    // load cached programs
+    static uint8_t data[LEDFX_DATA_SIZE];
+    size_t dataLen = 0;
+    bool isBinary = false;
+    const sysparam_status_t res = sysparam_get_data_static(
+        LEDFX_SYSPARAM_KEY, data, sizeof(data), &dataLen, &isBinary);
+    if (res == SYSPARAM_OK)
+    {
+        if ( !isBinary || !sLedfxLoadData(data, dataLen) )
+        {
+            WARNING("ledfx: bad cached programs");
+        }
+    }
+    else if (res != SYSPARAM_NOTFOUND)
+    {
+        WARNING("ledfx: sysparam get fail (%d)", res);
+    }
+}
+
+bool ledfxLoad(const char *base64)
+{
+    // decode base64
+    const int b64Len = strlen(base64);
+    static char data[BASE64_DECLEN(BASE64_ENCLEN(LEDFX_DATA_SIZE))];
+    if ( (b64Len > 0) && ( (BASE64_DECLEN(b64Len) > (int)sizeof(data)) || !base64dec(base64, data, sizeof(data)) ) )
+    {
+        WARNING("ledfx: bad base64");
+        return false;
+    }
+    int dataLen = (b64Len / 4) * 3;
+    if ( (b64Len > 0) && (base64[b64Len - 1] == '=') ) { dataLen--; }
+    if ( (b64Len > 1) && (base64[b64Len - 2] == '=') ) { dataLen--; }
+    if (dataLen > LEDFX_DATA_SIZE)
+    {
+        WARNING("ledfx: too much data");
+        return false;
+    }
+
+    // unchanged?
+    xSemaphoreTake(sLedfxMutex, portMAX_DELAY);
+    const bool unchanged = (dataLen == sLedfxDataLen) && (memcmp(data, sLedfxData, dataLen) == 0);
+    xSemaphoreGive(sLedfxMutex);
+    if (unchanged)
+    {
+        return true;
+    }
+
+    // load
+    if (!sLedfxLoadData((const uint8_t *)data, dataLen))
+    {
+        return false;
+    }
+
+    // store in flash
+    PRINT("ledfx: store %d bytes", dataLen);
+    const sysparam_status_t res = sysparam_set_data(LEDFX_SYSPARAM_KEY, (const uint8_t *)data, dataLen, true);
+    if (res != SYSPARAM_OK)
+    {
+        WARNING("ledfx: sysparam set fail (%d)", res);
+    }
+
+    return true;
+}
+
+bool ledfxRun(const LEDS_FX_t fx, const uint16_t ledIx, const int32_t ms, const LEDS_PARAM_t *pkParam,
+    uint8_t *pHue, uint8_t *pSat, uint8_t *pVal)
+{
+    if (fx >= LEDFX_NUM_FX)
+    {
+        return false;
+    }
+
+    xSemaphoreTake(sLedfxMutex, portMAX_DELAY);
+
+    const uint8_t *pkCode = sLedfxProgs[fx];
+    const int len = sLedfxProgLen[fx];
+    if (len == 0)
+    {
+        xSemaphoreGive(sLedfxMutex);
+        return false;
+    }
+
+    int32_t r[LEDFX_NUM_REGS] = { pkParam->hue, pkParam->sat, pkParam->val, ledIx, ms, pkParam->arg, 0, 0 };
+
+    // programs have been checked in sLedfxDecode(), and there are no backward jumps
+    int pc = 0;
+    while (pc < len)
+    {
+        const uint8_t op = pkCode[pc];
+        if (op == LEDFX_OP_END)
+        {
+            break;
+        }
+        const int d = pkCode[pc + 1] >> 4;
+        const int s = pkCode[pc + 1] & 0x0f;
+        pc += 2;
+        switch (op)
+        {
+            case LEDFX_OP_LDI:
+                r[d] = (int16_t)((uint16_t)pkCode[pc] | ((uint16_t)pkCode[pc + 1] << 8));
+                pc += 2;
+                break;
+            case LEDFX_OP_MOV:  r[d] = r[s]; break;
+            // (wrap around on overflow, signed overflow would be undefined)
+            case LEDFX_OP_ADD:  r[d] = (int32_t)((uint32_t)r[d] + (uint32_t)r[s]); break;
+            case LEDFX_OP_SUB:  r[d] = (int32_t)((uint32_t)r[d] - (uint32_t)r[s]); break;
+            case LEDFX_OP_MUL:  r[d] = (int32_t)((uint32_t)r[d] * (uint32_t)r[s]); break;
+            case LEDFX_OP_SHR:  r[d] >>= CLIP(r[s], 0, 31); break;
+            case LEDFX_OP_MOD:
+                // (INT32_MIN % -1 would overflow, and so would ABS(INT32_MIN))
+                if ( (r[s] != 0) && (r[s] != -1) )
+                {
+                    r[d] %= r[s];
+                    if (r[d] < 0)
+                    {
+                        r[d] = (int32_t)((uint32_t)r[d] + (uint32_t)ABS((int64_t)r[s]));
+                    }
+                }
+                else
+                {
+                    r[d] = 0;
+                }
+                break;
+            case LEDFX_OP_MIN:  r[d] = MIN(r[d], r[s]); break;
+            case LEDFX_OP_MAX:  r[d] = MAX(r[d], r[s]); break;
+            case LEDFX_OP_SIN:  r[d] = sLedfxSin(r[s]); break;
+            case LEDFX_OP_EASE: r[d] = sLedfxEase(r[s]); break;
+            case LEDFX_OP_KEY:
+            {
+                const int n = pkCode[pc];
+                r[d] = sLedfxKey(r[s], &pkCode[pc + 1], n);
+                pc += 1 + (2 * n);
+                break;
+            }
+            case LEDFX_OP_RND:  r[d] = rand() & 0xff; break;
+            case LEDFX_OP_SKZ:
+                if (r[d] == 0)
+                {
+                    pc += s;
+                }
+                break;
+            default:
+                // cannot happen (see sLedfxCheck())
+                sLedfxErrCount++;
+                pc = len;
+                break;
+        }
+    }
+    sLedfxRunCount++;
+
+    xSemaphoreGive(sLedfxMutex);
+
+    *pHue = CLIP(r[0], 0, 255);
+    *pSat = CLIP(r[1], 0, 255);
+    *pVal = CLIP(r[2], 0, 255);
+
+    return true;
+}
+
+void ledfxMonStatus(void)
+{
+    DEBUG("mon: ledfx: progs=%d/%d/%d/%d size=%d run=%u err=%u",
+        sLedfxProgLen[LEDS_FX_STILL], sLedfxProgLen[LEDS_FX_PULSE],
+        sLedfxProgLen[LEDS_FX_FLICKER], sLedfxProgLen[LEDS_FX_BLINK],
+        sLedfxDataLen, sLedfxRunCount, sLedfxErrCount);
+}
+
+/* *********************************************************************************************** */
+//@}
+// eof
@@ -0,0 +1,97 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: LED effect programs (see \ref FF_LEDFX)
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+
+    \defgroup FF_LEDFX LEDFX
+    \ingroup FF
+
+    This implements a tiny integer-only interpreter for LED effect programs. The programs are
+    downloaded from the backend (the "fx" key of the config line, base64 encoded) and cached in the
+    flash (sysparam). A program replaces the built-in effect (#LEDS_FX_t) it is loaded for.
+
+    Data format (binary, before base64 encoding):
+    - version (#LEDFX_VERSION)
+    - zero or more programs, each: fx (#LEDS_FX_t), length (1..#LEDFX_PROG_SIZE), code
+
+    A program has eight registers (signed 32 bits, ADD, SUB and MUL wrap around), initialised as follows:
+    - r0 = hue, r1 = saturation, r2 = value (of the LED state, 0..255)
+    - r3 = LED index (for per-LED phase offsets)
+    - r4 = time since the LED state was set [ms] (wraps every 1000s)
+    - r5 = effect argument (LEDS_PARAM_t.arg)
+    - r6, r7 = 0 (scratch)
+
+    The instructions are (d = destination register, s = source register, encoded as one byte
+    0xds, phases and levels are 0..255):
+    - 0x00 END              -- stop, output is r0, r1, r2 (clipped to 0..255)
+    - 0x01 LDI  d, lo, hi   -- d = (int16_t)(hi << 8 | lo)
+    - 0x02 MOV  ds          -- d = s
+    - 0x03 ADD  ds          -- d = d + s
+    - 0x04 SUB  ds          -- d = d - s
+    - 0x05 MUL  ds          -- d = d * s
+    - 0x06 SHR  ds          -- d = d >> s (arithmetic, s clipped to 0..31)
+    - 0x07 MOD  ds          -- d = d mod s (result >= 0, 0 if s is 0)
+    - 0x08 MIN  ds          -- d = min(d, s)
+    - 0x09 MAX  ds          -- d = max(d, s)
+    - 0x0a SIN  ds          -- d = sine of phase s (0..255, 0 at phase 192, 255 at phase 64)
+    - 0x0b EASE ds          -- d = smoothstep of level s (0..255)
+    - 0x0c KEY  ds, n, t1, v1, .., tn, vn -- d = keyframe interpolation at phase s (n = 1..8,
+                               t1 < .. < tn, constant before t1 and after tn)
+    - 0x0d RND  d0          -- d = random level (0..255)
+    - 0x0e SKZ  dn          -- skip n (0..15) bytes of code if d is zero (must land on an instruction)
+
+    There are no backward jumps, so a program cannot run for longer than its length. The
+    interpreter therefore needs a bounded number of cycles per LED and frame.
+
+    @{
+*/
+#ifndef __LEDFX_H__
+#define __LEDFX_H__
+
+#include "stdinc.h"
+
+#include "leds.h"
+
+//! data format version
+#define LEDFX_VERSION 0x01
+
+//! maximum size of one program [bytes]
+#define LEDFX_PROG_SIZE 64
+
+//! initialise, loads the cached programs from the flash
+void ledfxInit(void);
+
+//! print LED effect programs monitor info
+void ledfxMonStatus(void);
+
+//! load effect programs (from the backend)
+/*!
+    Decodes, checks and loads the programs and stores them in the flash if they have changed.
+
+    \param[in] base64  the base64 encoded programs (see \ref FF_LEDFX), empty string to unload all
+
+    \returns true if the programs were loaded, false otherwise (and the previous programs are kept)
+*/
+bool ledfxLoad(const char *base64);
+
+//! run effect program
+/*!
+    \param[in]  fx       the effect
+    \param[in]  ledIx    the LED index
+    \param[in]  ms       time since the LED state was set [ms]
+    \param[in]  pkParam  LED state parameters
+    \param[out] pHue     hue
+    \param[out] pSat     saturation
+    \param[out] pVal     value
+
+    \returns true if the program was run, false if there's no program (outputs are unchanged)
+*/
+bool ledfxRun(const LEDS_FX_t fx, const uint16_t ledIx, const int32_t ms, const LEDS_PARAM_t *pkParam,
+    uint8_t *pHue, uint8_t *pSat, uint8_t *pVal);
+
+
+#endif // __LEDFX_H__
+//@}
+// eof
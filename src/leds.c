@@ -14,6 +14,12 @@
     - GPIO 13 (D7) = MOSI
     - GPIO 14 (D5) = SCK
 
+    Optionally, the LEDs can be split into two strips (see CONFIG_LEDSI2S in config-sample.mk), where
+    the second strip is connected to the I2S peripheral (which works like SPI for the WS2801 and
+    SK9822, and it uses DMA, so there's no gap problem as described below):
+    - GPIO  3 (RX) = I2SO_DATA
+    - GPIO 15 (D8) = I2SO_BCK
+
     Note that this has a problem: we can load 16 words into the SPI buffers ("W" registers). The SPI
     hardware will then output these automatically and fire the SPI interrupt with the
     SPI_SLAVE0_TRANS_DONE set. This takes a wile (a few us, depends on SPI clock). Only then we can
@@ -29,18 +35,57 @@
 #include "stdinc.h"
 
 #include <esp/spi.h>
+#include <i2s_dma/i2s_dma.h>
 
 #include "stuff.h"
+#define DEBUG_MOD DEBUG_MOD_LEDS
 #include "debug.h"
 #include "mon.h"
 #include "jenkins.h"
 #include "config.h"
 #include "hsv2rgb.h"
+#include "ledfx.h"
 #include "leds.h"
+#include "cfg_gen.h"
 
 #define LEDS_SPI 1
 #define LEDS_NUM JENKINS_MAX_CH
-#define LEDS_FPS 100
+
+// frame rate (see CONFIG_LEDSFPS in config-sample.mk)
+#ifdef FF_CFG_LEDSFPS
+#  define LEDS_FPS FF_CFG_LEDSFPS
+#else
+#  define LEDS_FPS 100
+#endif
+#if ( (LEDS_FPS < 10) || (LEDS_FPS > 500) )
+#  error Illegal LEDS_FPS (CONFIG_LEDSFPS) value!
+#endif
+
+// frame period [ticks], frame rates above configTICK_RATE_HZ are not possible and other rates are
+// rounded to whole ticks, e.g. 30fps gives a 30ms period (33.3fps) with the default 100Hz tick
+#define LEDS_FRAME_TICKS MAX(1, MS2TICKS(1000 / LEDS_FPS))
+
+// actual frame period [ms], all effect timing is based on this (not on LEDS_FPS)
+#define LEDS_FRAME_MS TICKS2MS(LEDS_FRAME_TICKS)
+
+// convert duration [ms] to number of frames
+#define LEDS_MS2FRAMES(ms) ( (ms) / LEDS_FRAME_MS )
+
+// number of LEDs on the I2S strip (see CONFIG_LEDSI2S in config-sample.mk)
+#ifdef FF_CFG_LEDSI2S
+#  define LEDS_I2S_NUM FF_CFG_LEDSI2S
+#else
+#  define LEDS_I2S_NUM 0
+#endif
+#if ( (LEDS_I2S_NUM < 0) || (LEDS_I2S_NUM > LEDS_NUM) )
+#  error Illegal LEDS_I2S_NUM (CONFIG_LEDSI2S) value!
+#endif
+#ifndef FF_CFG_LEDSI2SDRIVER
+#  define FF_CFG_LEDSI2SDRIVER CONFIG_DRIVER_UNKNOWN
+#endif
+#ifndef FF_CFG_LEDSI2SORDER
+#  define FF_CFG_LEDSI2SORDER CONFIG_ORDER_UNKNOWN
+#endif
 
 #if (LEDS_NUM > 20)
 #  warning LEDS_NUM > 20 (or so) is not going to work well. See comments above.
@@ -48,84 +93,183 @@
 
 /* *********************************************************************************************** */
 
-// LED frame buffer
+// LED frame buffer (16 bit intensities, R, G, B)
+static uint16_t sLedsData16[LEDS_NUM][3];
+
+// LED output data (8 bit, see sLedsQuantise())
 static uint8_t sLedsData[LEDS_NUM][3];
 
 static void sLedsClear(void)
 {
-    memset(&sLedsData, 0, sizeof(sLedsData));
+    memset(&sLedsData16, 0, sizeof(sLedsData16));
 }
 
 enum { _R_ = 0, _G_ = 1, _B_ = 2 };
 
-static void sLedsSetRGB(const uint16_t ix, const uint8_t R, const uint8_t G, const uint8_t B)
+static void sLedsSetRGB(const uint16_t ix, const uint16_t R, const uint16_t G, const uint16_t B)
 {
     if (ix < LEDS_NUM)
     {
-        switch (configGetOrder())
+        sLedsData16[ix][_R_] = R;
+        sLedsData16[ix][_G_] = G;
+        sLedsData16[ix][_B_] = B;
+    }
+}
+
+// LED strips (physical outputs), each one shows a range of the frame buffer
+typedef enum LEDS_OUTPUT_e
+{
+    LEDS_OUTPUT_SPI,
+    LEDS_OUTPUT_I2S,
+
+} LEDS_OUTPUT_t;
+
+typedef struct LEDS_STRIP_s
+{
+    LEDS_OUTPUT_t   output; // physical output (at most one strip per output)
+    uint16_t        first;  // first LED (index into the frame buffer)
+    uint16_t        num;    // number of LEDs
+    CONFIG_DRIVER_t driver; // LED driver, CONFIG_DRIVER_UNKNOWN = configured driver (configGetDriver())
+    CONFIG_ORDER_t  order;  // colour order, CONFIG_ORDER_UNKNOWN = configured order (configGetOrder())
+
+} LEDS_STRIP_t;
+
+static const LEDS_STRIP_t skLedsStrips[] =
+{
+    { .output = LEDS_OUTPUT_SPI, .first = 0, .num = LEDS_NUM - LEDS_I2S_NUM,
+      .driver = CONFIG_DRIVER_UNKNOWN, .order = CONFIG_ORDER_UNKNOWN },
+#if (LEDS_I2S_NUM > 0)
+    { .output = LEDS_OUTPUT_I2S, .first = LEDS_NUM - LEDS_I2S_NUM, .num = LEDS_I2S_NUM,
+      .driver = FF_CFG_LEDSI2SDRIVER, .order = FF_CFG_LEDSI2SORDER },
+#endif
+};
+
+// copy RGB to the output in the given colour order
+static void sLedsOrderRGB(const CONFIG_ORDER_t order, const uint8_t *pkRGB, uint8_t *pOut)
+{
+    const uint8_t R = pkRGB[_R_];
+    const uint8_t G = pkRGB[_G_];
+    const uint8_t B = pkRGB[_B_];
+    switch (order)
+    {
+        case CONFIG_ORDER_RGB: pOut[0] = R; pOut[1] = G; pOut[2] = B; break;
+        case CONFIG_ORDER_RBG: pOut[0] = R; pOut[1] = B; pOut[2] = G; break;
+        case CONFIG_ORDER_GRB: pOut[0] = G; pOut[1] = R; pOut[2] = B; break;
+        case CONFIG_ORDER_GBR: pOut[0] = G; pOut[1] = B; pOut[2] = R; break;
+        case CONFIG_ORDER_BRG: pOut[0] = B; pOut[1] = R; pOut[2] = G; break;
+        case CONFIG_ORDER_BGR: pOut[0] = B; pOut[1] = G; pOut[2] = R; break;
+        case CONFIG_ORDER_UNKNOWN:
         {
-            case CONFIG_ORDER_RGB: sLedsData[ix][0] = R; sLedsData[ix][1] = G; sLedsData[ix][2] = B; break;
-            case CONFIG_ORDER_RBG: sLedsData[ix][0] = R; sLedsData[ix][1] = B; sLedsData[ix][2] = G; break;
-            case CONFIG_ORDER_GRB: sLedsData[ix][0] = G; sLedsData[ix][1] = R; sLedsData[ix][2] = B; break;
-            case CONFIG_ORDER_GBR: sLedsData[ix][0] = G; sLedsData[ix][1] = B; sLedsData[ix][2] = R; break;
-            case CONFIG_ORDER_BRG: sLedsData[ix][0] = B; sLedsData[ix][1] = R; sLedsData[ix][2] = G; break;
-            case CONFIG_ORDER_BGR: sLedsData[ix][0] = B; sLedsData[ix][1] = G; sLedsData[ix][2] = R; break;
-            case CONFIG_ORDER_UNKNOWN:
-            {
-                const uint8_t RGB = ((uint16_t)R + (uint16_t)G + (uint16_t)B) / 3;
-                sLedsData[ix][0] = RGB; sLedsData[ix][1] = RGB; sLedsData[ix][2] = RGB;
-                break;
-            }
+            const uint8_t RGB = ((uint16_t)R + (uint16_t)G + (uint16_t)B) / 3;
+            pOut[0] = RGB; pOut[1] = RGB; pOut[2] = RGB;
+            break;
         }
     }
 }
 
+// HSV and RGB values for the current frame
+static uint8_t sLedsHSV[LEDS_NUM][3];
+static uint16_t sLedsRGB16[LEDS_NUM][3];
+
 static void sLedsSetHSV(const uint16_t ix, const uint8_t H, const uint8_t S, const uint8_t V)
 {
     if (ix < LEDS_NUM)
     {
-        uint8_t R, G, B;
-        hsv2rgb(H, S, V, &R, &G, &B);
-        sLedsSetRGB(ix, R, G, B);
+        sLedsHSV[ix][0] = H;
+        sLedsHSV[ix][1] = S;
+        sLedsHSV[ix][2] = V;
     }
 }
 
-#define LEDS_WS2801_BUFSIZE sizeof(sLedsData)
+// convert HSV values of all LEDs to RGB and store them in the frame buffer
+static void sLedsHSVToData(void)
+{
+    hsv2rgbFrame16((const uint8_t (*)[3])sLedsHSV, sLedsRGB16, LEDS_NUM);
+    for (uint16_t ix = 0; ix < LEDS_NUM; ix++)
+    {
+        sLedsSetRGB(ix, sLedsRGB16[ix][0], sLedsRGB16[ix][1], sLedsRGB16[ix][2]);
+    }
+}
 
-static int sLedsRenderWS2801(uint8_t *outBuf, const int bufSize)
+// quantisation error carried over to the next frame (temporal error diffusion)
+static uint8_t sLedsDitherErr[LEDS_NUM][3];
+static MON_HIST_t sLedsDitherHist = MON_HIST_INIT(2); // quantisation time [us]
+static uint32_t sLedsCpuMhz;
+
+// scale a range of the 16 bit frame buffer by the brightness [1/256] and quantise it to the 8 bit output data
+static void sLedsQuantise(const int first, const int num, const uint32_t brightness)
 {
-    memset(outBuf, 0, bufSize);
-    const int outSize = MIN(bufSize, sizeof(sLedsData));
-    uint32_t brightness = 0;
+    const uint32_t t0 = monCcount();
+
+    const uint16_t *pkIn = &sLedsData16[first][0];
+    uint8_t *pOut = &sLedsData[first][0];
+    uint8_t *pErr = &sLedsDitherErr[first][0];
+    for (int ix = 0; ix < (num * 3); ix++)
+    {
+        const uint32_t in = ((uint32_t)pkIn[ix] * brightness) >> 8;
+        // less than one step: keep the LED on (dithering this would be visible as blinking)
+        if (in < 256)
+        {
+            pOut[ix] = pkIn[ix] != 0 ? 1 : 0;
+            pErr[ix] = 0;
+        }
+        // add the error from the previous frame, output the upper 8 bits and keep the rest for
+        // the next frame, so that the average output over a few frames has 16 bits resolution
+        else
+        {
+            const uint32_t sum = in + pErr[ix];
+            if (sum > 0xffff)
+            {
+                pOut[ix] = 0xff;
+                pErr[ix] = 0;
+            }
+            else
+            {
+                pOut[ix] = sum >> 8;
+                pErr[ix] = sum & 0xff;
+            }
+        }
+    }
+
+    const uint32_t t1 = monCcount();
+    CS_ENTER;
+    monHistAdd(&sLedsDitherHist, (t1 - t0) / sLedsCpuMhz);
+    CS_LEAVE;
+}
+
+// WS2801 brightness [1/256] (the SK9822 uses its global brightness instead)
+static uint32_t sLedsWS2801Brightness(void)
+{
+    uint32_t brightness = 256;
     switch (configGetBright())
     {
-        case CONFIG_BRIGHT_FULL:   brightness =   0; break;
+        case CONFIG_BRIGHT_FULL:   brightness = 256; break;
         case CONFIG_BRIGHT_HIGH:   brightness = 200; break;
         case CONFIG_BRIGHT_MEDIUM: brightness = 100; break;
         case CONFIG_BRIGHT_UNKNOWN:
         case CONFIG_BRIGHT_LOW:    brightness =  50; break;
     }
-    if (brightness == 0)
-    {
-        memcpy(outBuf, sLedsData, outSize);
-    }
-    else
+    return brightness;
+}
+
+#define LEDS_WS2801_BUFSIZE sizeof(sLedsData)
+
+static int sLedsRenderWS2801(const LEDS_STRIP_t *pkStrip, const CONFIG_ORDER_t order, uint8_t *outBuf, const int bufSize)
+{
+    memset(outBuf, 0, bufSize);
+    int outIx = 0;
+    for (int ix = pkStrip->first; (ix < (pkStrip->first + pkStrip->num)) && ((outIx + 3) <= bufSize); ix++)
     {
-        const uint32_t thrs = 256 / brightness;
-        const uint8_t *inBuf = (const uint8_t *)sLedsData;
-        for (uint32_t ix = 0; ix < bufSize; ix++)
-        {
-            const uint32_t in = inBuf[ix];
-            if (in != 0) { outBuf[ix] = (in <= thrs) ? 1 : ((in * brightness) >> 8); } else { outBuf[ix] = in; }
-        }
+        sLedsOrderRGB(order, sLedsData[ix], &outBuf[outIx]);
+        outIx += 3;
     }
-    return outSize;
+    return outIx;
 }
 
-#define LEDS_SK9822_END_BYTES ( LEDS_NUM / 2 / 8 + 1 )
-#define LEDS_SK9822_BUFSIZE ( 4 + (LEDS_NUM * 4) + 4 + LEDS_SK9822_END_BYTES )
+#define LEDS_SK9822_END_BYTES(num) ( (num) / 2 / 8 + 1 )
+#define LEDS_SK9822_BUFSIZE ( 4 + (LEDS_NUM * 4) + 4 + LEDS_SK9822_END_BYTES(LEDS_NUM) )
 
-static int sLedsRenderSK9822(uint8_t *outBuf, const int bufSize)
+static int sLedsRenderSK9822(const LEDS_STRIP_t *pkStrip, const CONFIG_ORDER_t order, uint8_t *outBuf, const int bufSize)
 {
     memset(outBuf, 0, bufSize);
 
@@ -155,12 +299,12 @@ static int sLedsRenderSK9822(uint8_t *outBuf, const int bufSize)
     outBuf[outIx++] = 0x00;
 
     // 2. LEDs data
-    for (int ix = 0; (ix < LEDS_NUM) && (outIx < (bufSize - 4 - LEDS_SK9822_END_BYTES )); ix++)
+    const int endBytes = LEDS_SK9822_END_BYTES(pkStrip->num);
+    for (int ix = pkStrip->first; (ix < (pkStrip->first + pkStrip->num)) && (outIx < (bufSize - 4 - 4 - endBytes)); ix++)
     {
         outBuf[outIx++] = 0xe0 | (brightness & 0x1f); // global brightness
-        outBuf[outIx++] = sLedsData[ix][0];
-        outBuf[outIx++] = sLedsData[ix][1];
-        outBuf[outIx++] = sLedsData[ix][2];
+        sLedsOrderRGB(order, sLedsData[ix], &outBuf[outIx]);
+        outIx += 3;
     }
 
     // 3. reset frame
@@ -170,7 +314,7 @@ static int sLedsRenderSK9822(uint8_t *outBuf, const int bufSize)
     outBuf[outIx++] = 0x00;
 
     // 4. end frame
-    int n = LEDS_SK9822_END_BYTES;
+    int n = endBytes;
     while (n-- > 0)
     {
         outBuf[outIx++] = 0x00;
@@ -179,26 +323,55 @@ static int sLedsRenderSK9822(uint8_t *outBuf, const int bufSize)
     return outIx;
 }
 
+// render the strip on an output into a buffer, returns number of bytes to send
+static int sLedsRenderOutput(const LEDS_OUTPUT_t output, const CONFIG_DRIVER_t configDriver, uint8_t *outBuf, const int bufSize)
+{
+    for (int stripIx = 0; stripIx < NUMOF(skLedsStrips); stripIx++)
+    {
+        const LEDS_STRIP_t *pkStrip = &skLedsStrips[stripIx];
+        if ( (pkStrip->output != output) || (pkStrip->num == 0) )
+        {
+            continue;
+        }
+        const CONFIG_DRIVER_t driver = pkStrip->driver != CONFIG_DRIVER_UNKNOWN ? pkStrip->driver : configDriver;
+        const CONFIG_ORDER_t  order  = pkStrip->order  != CONFIG_ORDER_UNKNOWN  ? pkStrip->order  : configGetOrder();
+        switch (driver)
+        {
+            case CONFIG_DRIVER_UNKNOWN:
+                break;
+            case CONFIG_DRIVER_WS2801:
+                sLedsQuantise(pkStrip->first, pkStrip->num, sLedsWS2801Brightness());
+                return sLedsRenderWS2801(pkStrip, order, outBuf, bufSize);
+            case CONFIG_DRIVER_SK9822:
+                sLedsQuantise(pkStrip->first, pkStrip->num, 256);
+                return sLedsRenderSK9822(pkStrip, order, outBuf, bufSize);
+        }
+    }
+    return 0;
+}
 
 
 /* *********************************************************************************************** */
 
-// copy of working frame buffer for transferring to SPI
-static uint32_t sLedsSpiBuf[ MAX(LEDS_WS2801_BUFSIZE, LEDS_SK9822_BUFSIZE) / 4 + 1 ];
-static int sLedsSpiBufIx;
-static int sLedsSpiBufNum;
+// SPI frame buffers: the front buffer is being transferred to SPI, the back buffer is being rendered
+static uint32_t sLedsSpiBufs[2][ MAX(LEDS_WS2801_BUFSIZE, LEDS_SK9822_BUFSIZE) / 4 + 1 ];
+static volatile int svLedsSpiBufNum[NUMOF(sLedsSpiBufs)];
+static volatile int svLedsBufFront; // front buffer index (for all outputs)
+static volatile int svLedsSpiBufIx;
 
 // load next words into SPI and send
 IRAM static void sLedsSpiBufLoad(void)
 {
     // fill SPI buffer
+    const uint32_t *pkSpiBuf = sLedsSpiBufs[svLedsBufFront];
+    const int spiBufNum = svLedsSpiBufNum[svLedsBufFront];
     uint32_t nBits = 0;
     uint32_t ix = 0;
-    while ( (sLedsSpiBufIx < sLedsSpiBufNum) && (ix < NUMOF(SPI(LEDS_SPI).W)) )
+    while ( (svLedsSpiBufIx < spiBufNum) && (ix < NUMOF(SPI(LEDS_SPI).W)) )
     {
-        SPI(LEDS_SPI).W[ix] = sLedsSpiBuf[sLedsSpiBufIx];
+        SPI(LEDS_SPI).W[ix] = pkSpiBuf[svLedsSpiBufIx];
         ix++;
-        sLedsSpiBufIx++;
+        svLedsSpiBufIx++;
         nBits += sizeof(uint32_t) * 8; // don't bother if the last word is only partially used
     }
 
@@ -231,7 +404,7 @@ IRAM static void sLedsSpiBufLoad(void)
 // SPI interrupt handler
 IRAM static void sLedsSpiIsr(void *pArg)
 {
-    monIsrEnter();
+    monIsrEnter(MON_ISR_SPI);
 
     // this must be read first (_before_ reading the status or clearing the interrupts)
     const uint32_t isrStatus = DPORT.SPI_INT_STATUS;
@@ -253,41 +426,29 @@ IRAM static void sLedsSpiIsr(void *pArg)
     // clear all interrupts (must be done _after_ reading the status registers)
     CLEAR_MASK_BITS(SPI(LEDS_SPI).SLAVE0, SPI_SLAVE0_ALL_DONE);
 
-    monIsrLeave();
+    monIsrLeave(MON_ISR_SPI);
 }
 
-// update LEDs (send data to SPI)
-static void sLedsFlush(const CONFIG_DRIVER_t driver)
+// render frame buffer into the SPI buffer for the given driver, returns number of words to send
+static int sLedsRenderSpiBuf(const CONFIG_DRIVER_t driver, uint32_t *pSpiBuf, const int bufSize)
+{
+    const int nBytesToSend = sLedsRenderOutput(LEDS_OUTPUT_SPI, driver, (uint8_t *)pSpiBuf, bufSize);
+    return nBytesToSend > 0 ? (nBytesToSend / 4 + 1) : 0;
+}
+
+// start sending the front buffer to SPI (may be called from interrupts)
+IRAM static void sLedsSpiStart(void)
 {
     // it seems to be crucial to clear and disable all interrupts on _both_ SPIs
     // (some enabled by default?!), similar to the UART IRQs (see user_stuff.c)
     CLEAR_MASK_BITS(SPI(0).SLAVE0, SPI_SLAVE0_ALL_DONE | SPI_SLAVE0_ALL_DONE_EN);
     CLEAR_MASK_BITS(SPI(1).SLAVE0, SPI_SLAVE0_ALL_DONE | SPI_SLAVE0_ALL_DONE_EN);
 
-    // copy framebuffer
-    int nBytesToSend = 0;
-    switch (driver)
-    {
-        case CONFIG_DRIVER_UNKNOWN:
-            break;
-        case CONFIG_DRIVER_WS2801:
-            nBytesToSend = sLedsRenderWS2801((uint8_t *)sLedsSpiBuf, sizeof(sLedsSpiBuf));
-            break;
-        case CONFIG_DRIVER_SK9822:
-            nBytesToSend = sLedsRenderSK9822((uint8_t *)sLedsSpiBuf, sizeof(sLedsSpiBuf));
-            break;
-    }
-    const int nWordsToSend = nBytesToSend / 4 + 1;
-    //DEBUG("sLedsFlush() %d %d", nBytesToSend, nWordsToSend);
-    if ( (nBytesToSend > 0) && (nWordsToSend > 0) )
-    {
-        sLedsSpiBufIx = 0;
-        sLedsSpiBufNum = nWordsToSend;
-    }
-    else
+    if (svLedsSpiBufNum[svLedsBufFront] <= 0)
     {
         return;
     }
+    svLedsSpiBufIx = 0;
 
     // enable transfer done interrupt source
     SET_MASK_BITS(SPI(LEDS_SPI).SLAVE0, SPI_SLAVE0_TRANS_DONE_EN);
@@ -306,6 +467,225 @@ static void sLedsFlush(const CONFIG_DRIVER_t driver)
 }
 
 
+/* ***** I2S output ****************************************************************************** */
+
+#if (LEDS_I2S_NUM > 0)
+
+// I2S bit clock [Hz] (same as SPI_FREQ_DIV_2M)
+#define LEDS_I2S_FREQ 2000000
+
+// I2S frame buffers (double-buffered like the SPI buffers, see svLedsBufFront), sent by DMA
+static uint32_t sLedsI2sBufs[2][ MAX(LEDS_WS2801_BUFSIZE, LEDS_SK9822_BUFSIZE) / 4 + 1 ];
+static volatile int svLedsI2sBufNum[NUMOF(sLedsI2sBufs)];
+static dma_descriptor_t sLedsI2sDescs[NUMOF(sLedsI2sBufs)];
+static volatile bool svLedsI2sBusy;
+
+// The I2S keeps clocking out data until stopped. So the frame is followed by zeros (which the
+// WS2801 and SK9822 ignore) until the end-of-frame interrupt stops the DMA.
+static uint32_t sLedsI2sZeros[4];
+static dma_descriptor_t sLedsI2sDescZeros;
+
+IRAM static void sLedsI2sIsr(void *pArg)
+{
+    monIsrEnter(MON_ISR_I2S);
+
+    if (i2s_dma_is_eof_interrupt())
+    {
+        i2s_dma_stop();
+        svLedsI2sBusy = false;
+    }
+    i2s_dma_clear_interrupt();
+
+    monIsrLeave(MON_ISR_I2S);
+}
+
+// render frame buffer into the I2S buffer
+static void sLedsI2sRenderBuf(const CONFIG_DRIVER_t driver, const int bufIx)
+{
+    uint32_t *pI2sBuf = sLedsI2sBufs[bufIx];
+    const int nBytesToSend = sLedsRenderOutput(LEDS_OUTPUT_I2S, driver, (uint8_t *)pI2sBuf, sizeof(sLedsI2sBufs[0]));
+    const int nWords = (nBytesToSend + 3) / 4;
+
+    // I2S sends the words MSB first
+    for (int ix = 0; ix < nWords; ix++)
+    {
+        pI2sBuf[ix] = __builtin_bswap32(pI2sBuf[ix]);
+    }
+    svLedsI2sBufNum[bufIx] = nWords;
+}
+
+// start sending the front buffer to I2S (may be called from interrupts)
+IRAM static void sLedsI2sStart(const int bufIx)
+{
+    const int nWords = svLedsI2sBufNum[bufIx];
+    if (nWords <= 0)
+    {
+        return;
+    }
+    dma_descriptor_t *pDesc = &sLedsI2sDescs[bufIx];
+    pDesc->blocksize = nWords * sizeof(uint32_t);
+    pDesc->datalen   = nWords * sizeof(uint32_t);
+    pDesc->buf_ptr   = sLedsI2sBufs[bufIx];
+    pDesc->next_link_ptr = &sLedsI2sDescZeros;
+    pDesc->sub_sof   = 0;
+    pDesc->unused    = 0;
+    pDesc->eof       = 1;
+    pDesc->owner     = 1;
+    svLedsI2sBusy = true;
+    i2s_dma_start(pDesc);
+}
+
+static void sLedsI2sInit(void)
+{
+    sLedsI2sDescZeros.blocksize = sizeof(sLedsI2sZeros);
+    sLedsI2sDescZeros.datalen   = sizeof(sLedsI2sZeros);
+    sLedsI2sDescZeros.buf_ptr   = sLedsI2sZeros;
+    sLedsI2sDescZeros.next_link_ptr = &sLedsI2sDescZeros;
+    sLedsI2sDescZeros.eof       = 0;
+    sLedsI2sDescZeros.owner     = 1;
+
+    const i2s_pins_t skPins = { .data = true, .clock = true, .ws = false };
+    i2s_dma_init(sLedsI2sIsr, NULL, i2s_get_clock_div(LEDS_I2S_FREQ), skPins);
+}
+
+#else
+
+static volatile bool svLedsI2sBusy; // always false
+static void sLedsI2sRenderBuf(const CONFIG_DRIVER_t driver, const int bufIx) { UNUSED(driver); UNUSED(bufIx); }
+static __INLINE void sLedsI2sStart(const int bufIx) { UNUSED(bufIx); }
+static void sLedsI2sInit(void) { }
+
+#endif // (LEDS_I2S_NUM > 0)
+
+// update LEDs now (render and send data to all outputs), only for use before the frame pipeline runs
+static void sLedsFlush(const CONFIG_DRIVER_t driver)
+{
+    uint32_t *pSpiBuf = sLedsSpiBufs[svLedsBufFront];
+    svLedsSpiBufNum[svLedsBufFront] = sLedsRenderSpiBuf(driver, pSpiBuf, sizeof(sLedsSpiBufs[0]));
+    sLedsI2sRenderBuf(driver, svLedsBufFront);
+    sLedsSpiStart();
+    sLedsI2sStart(svLedsBufFront);
+}
+
+// wait for the outputs to finish sending (plus the latch time)
+static void sLedsWaitIdle(void)
+{
+    for (int n = 0; (n < 10) && ( (svLedsSpiBufIx < svLedsSpiBufNum[svLedsBufFront]) || svLedsI2sBusy ); n++)
+    {
+        osSleep(10);
+    }
+    osSleep(10);
+}
+
+
+/* ***** frame pipeline ************************************************************************** */
+
+// The LED task renders the next frame into the back buffer ahead of time. The tick hook (which
+// runs in the FreeRTOS tick timer interrupt) flips the buffers and starts the SPI (and I2S)
+// transfer at the frame rate, and then wakes up the task to render the next frame. This way the
+// frame output cadence does not depend on when the task gets scheduled.
+
+static TaskHandle_t sLedsTaskHandle;
+static volatile bool svLedsBackReady; // back buffer rendered and ready for the flip
+static volatile bool svLedsActive;    // there's a driver, i.e. the task renders frames
+static volatile uint32_t svLedsFrameLate;    // number of frames not rendered in time
+static volatile uint32_t svLedsFrameOverrun; // number of frames where an output was still busy
+
+static MON_HIST_t sLedsJitterHist = MON_HIST_INIT(20); // frame start jitter [us]
+static MON_HIST_t sLedsRenderHist = MON_HIST_INIT(50); // frame render time [us]
+
+IRAM void ledsTick(void)
+{
+    static uint32_t sTicks;
+    static uint32_t sNextFrameStart;
+    if (sLedsTaskHandle == NULL)
+    {
+        return;
+    }
+    sTicks++;
+    if (sTicks < LEDS_FRAME_TICKS)
+    {
+        return;
+    }
+    sTicks = 0;
+
+    // frame start jitter, against the expected frame start (i.e. whole frame periods after the
+    // first one, the tick timer doesn't drift) rather than the previous frame start (which would
+    // count the latency of both)
+    const uint32_t now = monCcount();
+    const uint32_t period = LEDS_FRAME_MS * 1000 * sLedsCpuMhz;
+    const int32_t delta = (int32_t)(now - sNextFrameStart);
+    if ( (sNextFrameStart != 0) && (ABS(delta) < (int32_t)(period / 2)) )
+    {
+        monHistAdd(&sLedsJitterHist, ABS(delta) / sLedsCpuMhz);
+        sNextFrameStart += period;
+    }
+    // first frame, or we missed ticks
+    else
+    {
+        sNextFrameStart = now + period;
+    }
+
+    // flip and send, unless the previous transfer is still ongoing or there's no new frame (which
+    // is expected while there's no driver)
+    if ( (svLedsSpiBufIx < svLedsSpiBufNum[svLedsBufFront]) || svLedsI2sBusy )
+    {
+        if (svLedsActive)
+        {
+            svLedsFrameOverrun++;
+        }
+    }
+    else if (!svLedsBackReady)
+    {
+        if (svLedsActive)
+        {
+            svLedsFrameLate++;
+        }
+    }
+    else
+    {
+        svLedsBufFront = svLedsBufFront == 0 ? 1 : 0;
+        svLedsBackReady = false;
+        // all outputs send concurrently
+        sLedsSpiStart();
+        sLedsI2sStart(svLedsBufFront);
+        monTrace(MON_TRACE_FLUSH);
+    }
+
+    // render next frame
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(sLedsTaskHandle, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// render frame buffer into the back buffer
+static void sLedsRenderBack(const CONFIG_DRIVER_t driver)
+{
+    if (!svLedsBackReady)
+    {
+        const int back = svLedsBufFront == 0 ? 1 : 0;
+        svLedsSpiBufNum[back] = sLedsRenderSpiBuf(driver, sLedsSpiBufs[back], sizeof(sLedsSpiBufs[0]));
+        sLedsI2sRenderBuf(driver, back);
+        svLedsBackReady = true;
+    }
+}
+
+void ledsMonStatus(void)
+{
+    uint32_t late, overrun;
+    CS_ENTER;
+    late = svLedsFrameLate;
+    overrun = svLedsFrameOverrun;
+    svLedsFrameLate = 0;
+    svLedsFrameOverrun = 0;
+    CS_LEAVE;
+    DEBUG("mon: leds: fps=%u (%ums) late=%u overrun=%u", LEDS_FPS, LEDS_FRAME_MS, late, overrun);
+    monHistPrint("leds: jitter", &sLedsJitterHist, "us");
+    monHistPrint("leds: render", &sLedsRenderHist, "us");
+    monHistPrint("leds: dither", &sLedsDitherHist, "us");
+}
+
+
 /* *********************************************************************************************** */
 
 typedef struct LEDS_STATE_s
@@ -314,6 +694,7 @@ typedef struct LEDS_STATE_s
     bool         inited;
     uint8_t      val;
     int          count;
+    int32_t      frame; // frame counter for effect programs (see ledfxRun())
 
 } LEDS_STATE_t;
 
@@ -337,25 +718,28 @@ void ledsSetState(const uint16_t ledIx, const LEDS_PARAM_t *pkParam)
     }
 }
 
-static const int sLedsPulseAmpl[] =
-{
-#if (LEDS_FPS == 100)
-    // floor(sin(0:pi/2/100:pi).*100)
-    0, 1, 3, 4, 6, 7, 9, 10, 12, 14, 15, 17, 18, 20, 21, 23, 24, 26, 27, 29, 30, 32, 33, 35, 36, 38, 39,
-    41, 42, 43, 45, 46, 48, 49, 50, 52, 53, 54, 56, 57, 58, 60, 61, 62, 63, 64, 66, 67, 68, 69, 70, 71,
-    72, 73, 75, 76, 77, 78, 79, 79, 80, 81, 82, 83, 84, 85, 86, 86, 87, 88, 89, 89, 90, 91, 91, 92, 92,
-    93, 94, 94, 95, 95, 96, 96, 96, 97, 97, 97, 98, 98, 98, 99, 99, 99, 99, 99, 99, 99, 99, 99, 100, 99,
-    99, 99, 99, 99, 99, 99, 99, 99, 98, 98, 98, 97, 97, 97, 96, 96, 96, 95, 95, 94, 94, 93, 92, 92, 91,
-    91, 90, 89, 89, 88, 87, 86, 86, 85, 84, 83, 82, 81, 80, 79, 79, 78, 77, 76, 75, 73, 72, 71, 70, 69,
-    68, 67, 66, 64, 63, 62, 61, 60, 58, 57, 56, 54, 53, 52, 50, 49, 48, 46, 45, 43, 42, 41, 39, 38, 36,
-    35, 33, 32, 30, 29, 27, 26, 24, 23, 21, 20, 18, 17, 15, 14, 12, 10, 9, 7, 6, 4, 3, 1, 0,
-#else
-#  error missing LUT for LEDS_FPS value
-#endif
-};
+// pulse amplitude [%] over one period (2s), see sLedsInitTables()
+static uint8_t sLedsPulseAmpl[ LEDS_MS2FRAMES(2000) + 1 ];
 
-static void sLedsRenderFx(LEDS_STATE_t *pState, uint8_t *pHue, uint8_t *pSat, uint8_t *pVal)
+static void sLedsInitTables(void)
 {
+    // floor(sin(0:pi/(n-1):pi).*100)
+    for (int ix = 0; ix < NUMOF(sLedsPulseAmpl); ix++)
+    {
+        sLedsPulseAmpl[ix] = floor(sin((double)ix * M_PI / (double)(NUMOF(sLedsPulseAmpl) - 1)) * 100.0);
+    }
+}
+
+static void sLedsRenderFx(const uint16_t ledIx, LEDS_STATE_t *pState, uint8_t *pHue, uint8_t *pSat, uint8_t *pVal)
+{
+    // effect program loaded from the backend replaces the built-in effect
+    const int32_t ms = pState->frame * LEDS_FRAME_MS;
+    if (ledfxRun(pState->param.fx, ledIx, ms, &pState->param, pHue, pSat, pVal))
+    {
+        pState->frame = (pState->frame + 1) % LEDS_MS2FRAMES(1000000); // wrap every 1000s
+        return;
+    }
+
     if (!pState->inited)
     {
         switch (pState->param.fx)
@@ -363,12 +747,17 @@ static void sLedsRenderFx(LEDS_STATE_t *pState, uint8_t *pHue, uint8_t *pSat, ui
             case LEDS_FX_STILL:
                 break;
             case LEDS_FX_PULSE:
-                pState->count = pState->param.arg;
+                pState->count = LEDS_MS2FRAMES(10 * pState->param.arg) % NUMOF(sLedsPulseAmpl);
                 break;
             case LEDS_FX_FLICKER:
                 pState->count = pState->param.arg;
                 break;
             case LEDS_FX_BLINK:
+                pState->param.arg = LEDS_MS2FRAMES(10 * pState->param.arg);
+                if (pState->param.arg == 0)
+                {
+                    pState->param.arg = 1;
+                }
                 pState->count = -pState->param.arg;
                 break;
         }
@@ -421,11 +810,12 @@ static void sLedsRenderFx(LEDS_STATE_t *pState, uint8_t *pHue, uint8_t *pSat, ui
                 else if (pBright < 90)  { pState->val = 102 + (rand() % (128 - 102)); }
                 else                    { pState->val =  77 + (rand() % (102 -  77)); }
 
+                // (durations are doubled)
                 const int pTime = rand() % 100;
-                if      (pTime < 90) { pState->count =  20                         / (1000 / LEDS_FPS / 2); }
-                else if (pTime < 93) { pState->count = (20 + (rand() % (30 - 20))) / (1000 / LEDS_FPS / 2); }
-                else if (pTime < 96) { pState->count = (10 + (rand() % (20 - 10))) / (1000 / LEDS_FPS / 2); }
-                else                 { pState->count = (      rand() %  10       ) / (1000 / LEDS_FPS / 2); }
+                if      (pTime < 90) { pState->count = LEDS_MS2FRAMES(2 *  20                        ); }
+                else if (pTime < 93) { pState->count = LEDS_MS2FRAMES(2 * (20 + (rand() % (30 - 20)))); }
+                else if (pTime < 96) { pState->count = LEDS_MS2FRAMES(2 * (10 + (rand() % (20 - 10)))); }
+                else                 { pState->count = LEDS_MS2FRAMES(2 * (      rand() %  10       )); }
             }
             else
             {
@@ -469,80 +859,110 @@ static void sLedsRenderFx(LEDS_STATE_t *pState, uint8_t *pHue, uint8_t *pSat, ui
     *pVal = val;
 }
 
-static void sLedsTask(void *pArg)
+// duration of the demo after config changes [frames]
+#define LEDS_DEMO_FRAMES LEDS_MS2FRAMES(2000)
+
+// last seen config, seeded in ledsInit() with the config restored from the flash (if any), so that
+// there's no demo at boot
+static CONFIG_DRIVER_t sLedsConfigDriverLast = CONFIG_DRIVER_UNKNOWN;
+static CONFIG_ORDER_t  sLedsConfigOrderLast  = CONFIG_ORDER_UNKNOWN;
+static CONFIG_BRIGHT_t sLedsConfigBrightLast = CONFIG_BRIGHT_UNKNOWN;
+
+// render the next frame into the back buffer
+static void sLedsRenderFrame(void)
 {
-    static CONFIG_DRIVER_t sConfigDriverLast = CONFIG_DRIVER_UNKNOWN;
-    static CONFIG_ORDER_t  sConfigOrderLast  = CONFIG_ORDER_UNKNOWN;
-    static CONFIG_BRIGHT_t sConfigBrightLast = CONFIG_BRIGHT_UNKNOWN;
+    static uint32_t sDemoFrames;
 
-    while (true)
+    if (svLedsBackReady)
     {
-        const CONFIG_DRIVER_t configDriver = configGetDriver();
-        const CONFIG_ORDER_t  configOrder  = configGetOrder();
-        const CONFIG_BRIGHT_t configBright = configGetBright();
+        return;
+    }
 
-        // handle config changes
-        bool doDemo = false;
-        if (sConfigDriverLast != configDriver)
-        {
-            DEBUG("leds: driver change");
-            sLedsClear();
-            sLedsFlush(sConfigDriverLast);
-            sConfigDriverLast = configDriver;
-            doDemo = true;
-        }
-        if (sConfigOrderLast != configOrder)
-        {
-            DEBUG("leds: order change");
-            sConfigOrderLast = configOrder;
-            doDemo = true;
-        }
-        if (sConfigBrightLast != configBright)
-        {
-            DEBUG("leds: bright change");
-            sConfigBrightLast = configBright;
-            //doDemo = true;
-        }
+    const CONFIG_DRIVER_t configDriver = configGetDriver();
+    const CONFIG_ORDER_t  configOrder  = configGetOrder();
+    const CONFIG_BRIGHT_t configBright = configGetBright();
+    svLedsActive = (configDriver != CONFIG_DRIVER_UNKNOWN);
 
-        // cannot do much if we don't know the driver
-        if (configGetDriver() == CONFIG_DRIVER_UNKNOWN)
-        {
-            osSleep(100);
-            continue;
-        }
+    // handle config changes
+    if (sLedsConfigDriverLast != configDriver)
+    {
+        DEBUG("leds: driver change");
+        sLedsClear();
+        sLedsRenderBack(sLedsConfigDriverLast);
+        sLedsConfigDriverLast = configDriver;
+        sDemoFrames = LEDS_DEMO_FRAMES;
+        return;
+    }
+    if (sLedsConfigOrderLast != configOrder)
+    {
+        DEBUG("leds: order change");
+        sLedsConfigOrderLast = configOrder;
+        sDemoFrames = LEDS_DEMO_FRAMES;
+    }
+    if (sLedsConfigBrightLast != configBright)
+    {
+        DEBUG("leds: bright change");
+        sLedsConfigBrightLast = configBright;
+        //sDemoFrames = LEDS_DEMO_FRAMES;
+    }
+
+    // cannot do much if we don't know the driver
+    if (configDriver == CONFIG_DRIVER_UNKNOWN)
+    {
+        return;
+    }
 
-        // demo?
-        if (doDemo)
+    const uint32_t t0 = monCcount();
+
+    // demo?
+    if (sDemoFrames > 0)
+    {
+        if (sDemoFrames == LEDS_DEMO_FRAMES)
         {
             DEBUG("leds: demo");
-            for (uint16_t ix = 0; ix < LEDS_NUM; ix += 3)
-            {
-                sLedsSetRGB(ix + 0, 255, 0, 0);
-                sLedsSetRGB(ix + 1, 0, 255, 0);
-                sLedsSetRGB(ix + 2, 0, 0, 255);
-            }
-            for (uint16_t n = 0; n < 20; n++)
-            {
-                sLedsFlush(configDriver);
-                osSleep(100);
-            }
         }
-
-        // render next frame..
-        static uint32_t sTick;
+        for (uint16_t ix = 0; ix < LEDS_NUM; ix += 3)
+        {
+            sLedsSetRGB(ix + 0, 0xffff, 0, 0);
+            sLedsSetRGB(ix + 1, 0, 0xffff, 0);
+            sLedsSetRGB(ix + 2, 0, 0, 0xffff);
+        }
+        sDemoFrames--;
+    }
+    // render next frame..
+    else
+    {
         sLedsClear();
         for (uint16_t ix = 0; ix < NUMOF(sLedsStates); ix++)
         {
             uint8_t h = 0, s = 0, v = 0;
             xSemaphoreTake(sLedsStateMutex, portMAX_DELAY);
-            sLedsRenderFx(&sLedsStates[ix], &h, &s, &v);
+            sLedsRenderFx(ix, &sLedsStates[ix], &h, &s, &v);
             xSemaphoreGive(sLedsStateMutex);
             sLedsSetHSV(ix, h, s, v);
         }
-        vTaskDelayUntil(&sTick, MS2TICKS(1000 / LEDS_FPS));
-        sLedsFlush(configDriver);
+        sLedsHSVToData();
     }
 
+    // ..into the back buffer, ledsTick() will send it
+    sLedsRenderBack(configDriver);
+    monTrace(MON_TRACE_RENDER);
+    monBootMilestone(MON_BOOT_FIRSTLED);
+
+    const uint32_t t1 = monCcount();
+    CS_ENTER;
+    monHistAdd(&sLedsRenderHist, (t1 - t0) / sLedsCpuMhz);
+    CS_LEAVE;
+}
+
+static void sLedsTask(void *pArg)
+{
+    while (true)
+    {
+        // wait until it's time to render the next frame (see ledsTick())
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        sLedsRenderFrame();
+    }
 }
 
 void ledsSetStateHello(const LEDS_PARAM_t *pkParamHead, const LEDS_PARAM_t *pkParamBow)
@@ -570,12 +990,22 @@ void ledsSetStateHello(const LEDS_PARAM_t *pkParamHead, const LEDS_PARAM_t *pkPa
 
 void ledsInit(void)
 {
-    DEBUG("leds: init (%ux3=%u / %u, %u / %u*4=%u)",
+    DEBUG("leds: init (%ux3=%u / %u, %u / %u*4=%u, %ufps, %u strips)",
         LEDS_NUM, sizeof(sLedsData),
         LEDS_WS2801_BUFSIZE, LEDS_SK9822_BUFSIZE,
-        NUMOF(sLedsSpiBuf), sizeof(sLedsSpiBuf));
+        NUMOF(sLedsSpiBufs[0]), sizeof(sLedsSpiBufs[0]), LEDS_FPS, NUMOF(skLedsStrips));
 
     memset(&sLedsStates, 0, sizeof(sLedsStates));
+    sLedsInitTables();
+    sLedsConfigDriverLast = configGetDriver();
+    sLedsConfigOrderLast  = configGetOrder();
+    sLedsConfigBrightLast = configGetBright();
+    ledfxInit();
+    sLedsCpuMhz = sdk_system_get_cpu_freq();
+    if ((LEDS_FRAME_MS * LEDS_FPS) != 1000)
+    {
+        WARNING("leds: %ufps not possible, using %ums frame period", LEDS_FPS, LEDS_FRAME_MS);
+    }
 
     static const spi_settings_t skSpiSettings =
     {
@@ -593,11 +1023,14 @@ void ledsInit(void)
     _xt_isr_mask(BIT(INUM_SPI));
     _xt_isr_attach(INUM_SPI, sLedsSpiIsr, NULL);
 
+    sLedsI2sInit();
+
+    // we don't know (yet) which LEDs are connected, so clear both kinds
     sLedsClear();
     sLedsFlush(CONFIG_DRIVER_SK9822);
-    osSleep(100);
+    sLedsWaitIdle();
     sLedsFlush(CONFIG_DRIVER_WS2801);
-    osSleep(100);
+    sLedsWaitIdle();
 }
 
 void ledsStart(void)
@@ -609,7 +1042,7 @@ void ledsStart(void)
 
     static StackType_t sLedsTaskStack[512];
     static StaticTask_t sLedsTaskTCB;
-    xTaskCreateStatic(sLedsTask, "ff_leds", NUMOF(sLedsTaskStack), NULL, 2, sLedsTaskStack, &sLedsTaskTCB);
+    sLedsTaskHandle = xTaskCreateStatic(sLedsTask, "ff_leds", NUMOF(sLedsTaskStack), NULL, 2, sLedsTaskStack, &sLedsTaskTCB);
 }
 
 
@@ -21,6 +21,12 @@ void ledsInit(void);
 //! start
 void ledsStart(void);
 
+//! print LEDs monitor info
+void ledsMonStatus(void);
+
+//! flip frame buffers and start output (call from the OS tick hook)
+void ledsTick(void);
+
 typedef enum LEDS_FX_e
 {
     LEDS_FX_STILL,
@@ -40,7 +46,7 @@ typedef struct LEDS_PARAM_s
 
     // effect
     LEDS_FX_t fx;
-    int       arg;
+    int       arg;   // LEDS_FX_PULSE: phase [10ms], LEDS_FX_BLINK: on/off duration [10ms]
 
 } LEDS_PARAM_t;
 
@@ -20,6 +20,9 @@
 #include "status.h"
 #include "backend.h"
 #include "leds.h"
+#include "netlog.h"
+#include "crash.h"
+#include "sched.h"
 #include "ver_gen.h"
 
 //void vApplicationIdleHook(void)
@@ -89,19 +92,24 @@ static void sMainHello(void)
 }
 
 
+// initialise and record boot phase
+#define MAIN_INIT(_func) do { _func(); monBootPhase(STRINGIFY(_func)); } while (0)
+
 void user_init(void)
 {
     // initialise stuff
-    debugInit(); // must be first
-    stuffInit();
-    configInit();
-    monInit();
-    toneInit();
-    statusInit();
-    backendInit();
-    ledsInit();
-    jenkinsInit();
-    wifiInit();
+    monBootPhase("user_init");
+    MAIN_INIT(debugInit); // must be first
+    MAIN_INIT(crashInit);
+    MAIN_INIT(stuffInit);
+    MAIN_INIT(configInit);
+    MAIN_INIT(wifiInit); // as early as possible, the station associates while we do the rest
+    MAIN_INIT(monInit);
+    MAIN_INIT(toneInit);
+    MAIN_INIT(statusInit);
+    MAIN_INIT(backendInit);
+    MAIN_INIT(ledsInit);
+    MAIN_INIT(jenkinsInit);
 
     // trigger core dump
     //*((volatile uint32_t *)0) = 0; // null pointer deref, instant crash
@@ -112,13 +120,23 @@ void user_init(void)
 
     NOTICE("here we go...");
 
-    osSleep(100);
-
     // start stuff
-    ledsStart();
-    wifiStart();
-    jenkinsStart();
+    MAIN_INIT(ledsStart);
+    MAIN_INIT(jenkinsStart);
+    MAIN_INIT(schedStart);
+    MAIN_INIT(wifiStart);
+    MAIN_INIT(netlogStart);
+
+    monBootPrint();
+}
+
+
+#if (configUSE_TICK_HOOK == 1)
+IRAM void vApplicationTickHook(void)
+{
+    ledsTick();
 }
+#endif // (configUSE_TICK_HOOK == 1)
 
 
 #if (configSUPPORT_STATIC_ALLOCATION == 1)
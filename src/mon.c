@@ -7,35 +7,255 @@
 */
 
 #include "stdinc.h"
-#include <esp/rtc_regs.h>
 
+#define DEBUG_MOD DEBUG_MOD_MON
 #include "debug.h"
 #include "stuff.h"
 #include "wifi.h"
 #include "backend.h"
 #include "config.h"
 #include "jenkins.h"
+#include "leds.h"
+#include "ledfx.h"
+#include "tone.h"
+#include "netlog.h"
+#include "heap.h"
+#include "sched.h"
 #include "mon.h"
 
 
 #define MON_PERIOD 5000
 #define MON_FIRST 1000
-#define MAX_TASKS 10
 
 
+// interrupt service routine statistics, per source
+typedef struct MON_ISR_STATS_s
+{
+    uint32_t   cycles;  // total time [cycles]
+    MON_HIST_t hist;    // time per invocation [cycles] (also has the count and the max.)
+} MON_ISR_STATS_t;
+
+#define MON_ISR_HIST_BASE 256 // [cycles]
+
 static volatile uint32_t svMonIsrStart;
-static volatile uint32_t svMonIsrCount;
-static volatile uint32_t svMonIsrTime;
+static MON_ISR_STATS_t sMonIsrStats[MON_ISR_NUM] =
+{
+    [0 ... (MON_ISR_NUM - 1)] = { .hist = MON_HIST_INIT(MON_ISR_HIST_BASE) }
+};
+static const char * const skMonIsrStrs[] =
+{
+    [MON_ISR_UART] = "uart", [MON_ISR_SPI] = "spi", [MON_ISR_I2S] = "i2s", [MON_ISR_FRC1] = "frc1"
+};
+
+IRAM void monIsrEnter(const MON_ISR_t isr)
+{
+    svMonIsrStart = monCcount();
+}
+
+IRAM void monIsrLeave(const MON_ISR_t isr)
+{
+    const uint32_t dt = monCcount() - svMonIsrStart;
+    MON_ISR_STATS_t *pStats = &sMonIsrStats[isr];
+    pStats->cycles += dt;
+    monHistAdd(&pStats->hist, dt);
+}
 
-void monIsrEnter(void)
+IRAM void monHistAdd(MON_HIST_t *pHist, const uint32_t val)
 {
-    svMonIsrStart = RTC.COUNTER;
-    svMonIsrCount++;
+    uint32_t ix = 0;
+    uint32_t limit = pHist->base;
+    while ( (val >= limit) && (ix < (NUMOF(pHist->bins) - 1)) )
+    {
+        limit <<= 1;
+        ix++;
+    }
+    pHist->bins[ix]++;
+    pHist->count++;
+    if (val > pHist->max)
+    {
+        pHist->max = val;
+    }
 }
 
-void monIsrLeave(void)
+void monHistPrint(const char *name, MON_HIST_t *pHist, const char *unit)
 {
-    svMonIsrTime += RTC.COUNTER - svMonIsrStart;
+    MON_HIST_t hist;
+    CS_ENTER;
+    hist = *pHist;
+    memset(pHist->bins, 0, sizeof(pHist->bins));
+    pHist->max = 0;
+    pHist->count = 0;
+    CS_LEAVE;
+
+    char str[NUMOF(hist.bins) * 16];
+    int len = 0;
+    uint32_t limit = hist.base;
+    for (int ix = 0; ix < NUMOF(hist.bins); ix++)
+    {
+        len += snprintf(&str[len], sizeof(str) - len, ix < (NUMOF(hist.bins) - 1) ? " <%u:%u" : " >=%u:%u",
+            ix < (NUMOF(hist.bins) - 1) ? limit : (limit >> 1), hist.bins[ix]);
+        limit <<= 1;
+    }
+    DEBUG("mon: %s: n=%u max=%u%s%s", name, hist.count, hist.max, unit, str);
+}
+
+// latency trace
+static uint32_t          sMonCpuMhz;                          // for converting cycles to us
+static volatile uint32_t svMonTraceRx;                        // last receive [cycles]
+static volatile uint32_t svMonTraceTimes[MON_TRACE_NUM];      // current trace [cycles]
+static volatile MON_TRACE_t svMonTraceNext = MON_TRACE_NUM;   // next expected point (NUM = none)
+static volatile uint32_t svMonTraceLast[MON_TRACE_NUM];       // last trace, hops to each point [us]
+static MON_HIST_t sMonTraceHists[MON_TRACE_NUM] =             // hops to each point [us]
+{
+    [MON_TRACE_RX] = MON_HIST_INIT(1000), // total
+    [MON_TRACE_PARSE] = MON_HIST_INIT(50), [MON_TRACE_APPLY] = MON_HIST_INIT(100),
+    [MON_TRACE_RENDER] = MON_HIST_INIT(500), [MON_TRACE_FLUSH] = MON_HIST_INIT(500),
+};
+static MON_HIST_t sMonTraceUpdateHist = MON_HIST_INIT(16);    // Jenkins to backend [ms]
+static MON_HIST_t sMonTraceSendHist = MON_HIST_INIT(16);      // backend to us [ms]
+
+IRAM void monTrace(const MON_TRACE_t point)
+{
+    const uint32_t now = monCcount();
+    switch (point)
+    {
+        case MON_TRACE_RX:
+            svMonTraceRx = now;
+            break;
+        case MON_TRACE_PARSE:
+            svMonTraceTimes[MON_TRACE_RX] = svMonTraceRx;
+            svMonTraceTimes[MON_TRACE_PARSE] = now;
+            svMonTraceNext = MON_TRACE_APPLY;
+            break;
+        case MON_TRACE_APPLY:
+        case MON_TRACE_RENDER:
+        case MON_TRACE_FLUSH:
+            if ( (point == svMonTraceNext) && (sMonCpuMhz > 0) )
+            {
+                svMonTraceTimes[point] = now;
+                svMonTraceNext = point + 1;
+                // done, update statistics
+                if (point == MON_TRACE_FLUSH)
+                {
+                    for (int ix = MON_TRACE_PARSE; ix < MON_TRACE_NUM; ix++)
+                    {
+                        svMonTraceLast[ix] = (svMonTraceTimes[ix] - svMonTraceTimes[ix - 1]) / sMonCpuMhz;
+                        monHistAdd(&sMonTraceHists[ix], svMonTraceLast[ix]);
+                    }
+                    svMonTraceLast[MON_TRACE_RX] = (now - svMonTraceTimes[MON_TRACE_RX]) / sMonCpuMhz;
+                    monHistAdd(&sMonTraceHists[MON_TRACE_RX], svMonTraceLast[MON_TRACE_RX]);
+                }
+            }
+            break;
+        case MON_TRACE_NUM:
+            break;
+    }
+}
+
+void monTraceBackend(const uint32_t updateMs, const uint32_t sendMs)
+{
+    CS_ENTER;
+    monHistAdd(&sMonTraceUpdateHist, updateMs);
+    monHistAdd(&sMonTraceSendHist, sendMs);
+    CS_LEAVE;
+}
+
+static void sMonTraceStatus(void)
+{
+    if ( (sMonTraceHists[MON_TRACE_RX].count == 0) && (sMonTraceUpdateHist.count == 0) )
+    {
+        return;
+    }
+    uint32_t last[MON_TRACE_NUM];
+    CS_ENTER;
+    for (int ix = 0; ix < MON_TRACE_NUM; ix++)
+    {
+        last[ix] = svMonTraceLast[ix];
+    }
+    CS_LEAVE;
+    DEBUG("mon: trace: last rx>parse=%uus parse>apply=%uus apply>render=%uus render>flush=%uus total=%uus",
+        last[MON_TRACE_PARSE], last[MON_TRACE_APPLY], last[MON_TRACE_RENDER], last[MON_TRACE_FLUSH],
+        last[MON_TRACE_RX]);
+    monHistPrint("trace: jenkins>backend", &sMonTraceUpdateHist, "ms");
+    monHistPrint("trace: backend>send", &sMonTraceSendHist, "ms");
+    monHistPrint("trace: rx>parse", &sMonTraceHists[MON_TRACE_PARSE], "us");
+    monHistPrint("trace: parse>apply", &sMonTraceHists[MON_TRACE_APPLY], "us");
+    monHistPrint("trace: apply>render", &sMonTraceHists[MON_TRACE_RENDER], "us");
+    monHistPrint("trace: render>flush", &sMonTraceHists[MON_TRACE_FLUSH], "us");
+    monHistPrint("trace: total", &sMonTraceHists[MON_TRACE_RX], "us");
+}
+
+typedef struct MON_BOOT_PHASE_s
+{
+    const char *name;
+    uint32_t    time; // [us]
+} MON_BOOT_PHASE_t;
+
+static MON_BOOT_PHASE_t sMonBootPhases[MON_BOOT_PHASES_MAX];
+static int sMonBootNumPhases;
+static int sMonBootDropped; // phases that didn't fit into sMonBootPhases[]
+static uint32_t sMonBootMilestones[MON_BOOT_NUM]; // [us], 0 = not yet
+static const char * const skMonBootStrs[] =
+{
+    [MON_BOOT_FIRSTLED] = "first LED", [MON_BOOT_ONLINE] = "online", [MON_BOOT_BACKEND] = "backend"
+};
+
+void monBootPhase(const char *name)
+{
+    if (sMonBootNumPhases < MON_BOOT_PHASES_MAX)
+    {
+        sMonBootPhases[sMonBootNumPhases].name = name;
+        sMonBootPhases[sMonBootNumPhases].time = sdk_system_get_time();
+        sMonBootNumPhases++;
+    }
+    else
+    {
+        sMonBootDropped++; // can't print here, debugInit() may not have run yet
+    }
+}
+
+void monBootPrint(void)
+{
+    uint32_t last = 0;
+    for (int ix = 0; ix < sMonBootNumPhases; ix++)
+    {
+        const MON_BOOT_PHASE_t *pkPhase = &sMonBootPhases[ix];
+        DEBUG("mon: boot: %-16s %7.1fms (+%.1fms)", pkPhase->name,
+            (double)pkPhase->time / 1000.0, (double)(pkPhase->time - last) / 1000.0);
+        last = pkPhase->time;
+    }
+    if (sMonBootDropped > 0)
+    {
+        WARNING("mon: boot: %d phases dropped (increase MON_BOOT_PHASES_MAX)", sMonBootDropped);
+    }
+}
+
+void monBootMilestone(const MON_BOOT_t milestone)
+{
+    if (sMonBootMilestones[milestone] == 0)
+    {
+        const uint32_t now = sdk_system_get_time();
+        sMonBootMilestones[milestone] = now != 0 ? now : 1;
+        PRINT("mon: boot: %s after %.1fms", skMonBootStrs[milestone], (double)now / 1000.0);
+    }
+}
+
+static SemaphoreHandle_t sMonTelemetryMutex;
+static char sMonTelemetry[MON_TELEMETRY_SIZE];      // latest record
+static char sMonTelemetryNext[MON_TELEMETRY_SIZE];  // record in the making
+
+bool monTelemetry(char *str, const int size)
+{
+    bool res = false;
+    xSemaphoreTake(sMonTelemetryMutex, portMAX_DELAY);
+    if (sMonTelemetry[0] != '\0')
+    {
+        strncpy(str, sMonTelemetry, size);
+        str[size - 1] = '\0';
+        res = true;
+    }
+    xSemaphoreGive(sMonTelemetryMutex);
+    return res;
 }
 
 static int sTaskSortFunc(const void *a, const void *b)
@@ -43,160 +263,241 @@ static int sTaskSortFunc(const void *a, const void *b)
     return (int)((const TaskStatus_t *)a)->xTaskNumber - (int)((const TaskStatus_t *)b)->xTaskNumber;
 }
 
-static void sMonTask(void *pArg)
+// collect, print and record the monitor info
+static void sMonStatus(void)
 {
-    TaskStatus_t *pTasks = NULL;
+    const int nTasks = uxTaskGetNumberOfTasks();
+    if (nTasks > MON_MAX_TASKS)
+    {
+        ERROR("mon: too many tasks");
+        return;
+    }
 
-    static uint32_t sTick;
-    sTick = -MS2TICKS(MON_PERIOD - MON_FIRST);
+    // allocate memory for tasks status
+    const unsigned int allocSize = nTasks * sizeof(TaskStatus_t);
+    TaskStatus_t *pTasks = heapAlloc(HEAP_SITE_MON, allocSize);
+    if (pTasks == NULL)
+    {
+        ERROR("mon: malloc");
+        return;
+    }
+    memset(pTasks, 0, allocSize);
 
-    while (true)
+    // get ISR runtime stats
+    uint32_t isrCount = 0, isrCycles = 0, isrTotalCycles;
+    uint32_t isrSrcCycles[MON_ISR_NUM];
+    static uint32_t sIsrLastCcount;
+    CS_ENTER;
+    const uint32_t ccount = monCcount();
+    isrTotalCycles = ccount - sIsrLastCcount;
+    sIsrLastCcount = ccount;
+    for (int ix = 0; ix < MON_ISR_NUM; ix++)
     {
-        if (pTasks != NULL)
-        {
-            free(pTasks);
-        }
+        isrSrcCycles[ix] = sMonIsrStats[ix].cycles;
+        sMonIsrStats[ix].cycles = 0;
+        isrCycles += isrSrcCycles[ix];
+        isrCount += sMonIsrStats[ix].hist.count;
+    }
+    CS_LEAVE;
 
-        // wait until it's time to dump the status
-        vTaskDelayUntil(&sTick, MS2TICKS(MON_PERIOD));
+    // get tasks info
+    uint32_t totalRuntime;
+    const int nnTasks = uxTaskGetSystemState(pTasks, nTasks, &totalRuntime);
+    if (nTasks != nnTasks)
+    {
+        ERROR("mon: %u != %u", nTasks, nnTasks);
+        heapFree(pTasks);
+        return;
+    }
 
-        const int nTasks = uxTaskGetNumberOfTasks();
-        if (nTasks > MAX_TASKS)
-        {
-            ERROR("mon: too many tasks");
-            continue;
-        }
+    // sort by task ID
+    qsort(pTasks, nTasks, sizeof(TaskStatus_t), sTaskSortFunc);
 
-        // allocate memory for tasks status
-        const unsigned int allocSize = nTasks * sizeof(TaskStatus_t);
-        pTasks = malloc(allocSize);
-        if (pTasks == NULL)
-        {
-            ERROR("mon: malloc");
-            continue;
-        }
-        memset(pTasks, 0, allocSize);
-
-        // get ISR runtime stats
-        uint32_t isrCount, isrTime, isrTotalRuntime;
-        static uint32_t sIsrLastRuntime;
-        CS_ENTER;
-        const uint32_t rtcCounter = RTC.COUNTER;
-        isrTotalRuntime = rtcCounter - sIsrLastRuntime;
-        sIsrLastRuntime = rtcCounter;
-        isrCount = svMonIsrTime;
-        isrTime = svMonIsrCount;
-        svMonIsrCount = 0;
-        svMonIsrTime = 0;
-        CS_LEAVE;
-
-        // get tasks info
-        uint32_t totalRuntime;
-        const int nnTasks = uxTaskGetSystemState(pTasks, nTasks, &totalRuntime);
-        if (nTasks != nnTasks)
-        {
-            ERROR("mon: %u != %u", nTasks, nnTasks);
-            continue;
-        }
+    // total runtime (tasks, OS, ISRs) since we checked last
+    static uint32_t sLastTotalRuntime;
+    {
+        const uint32_t runtime = totalRuntime;
+        totalRuntime = totalRuntime - sLastTotalRuntime;
+        sLastTotalRuntime = runtime;
+    }
 
-        // sort by task ID
-        qsort(pTasks, nTasks, sizeof(TaskStatus_t), sTaskSortFunc);
+    // calculate time spent in each task since we checked last
+    static uint32_t sLastRuntimeCounter[MON_MAX_TASKS];
+    uint32_t totalRuntimeTasks = 0;
+    for (int ix = 0; ix < nTasks; ix++)
+    {
+        TaskStatus_t *pTask = &pTasks[ix];
+        const uint32_t runtime = pTask->ulRunTimeCounter;
+        pTask->ulRunTimeCounter = pTask->ulRunTimeCounter - sLastRuntimeCounter[ix];
+        sLastRuntimeCounter[ix] = runtime;
+        totalRuntimeTasks += pTask->ulRunTimeCounter;
+    }
+
+    // FIXME: why?
+    if (totalRuntimeTasks > totalRuntime)
+    {
+        totalRuntime = totalRuntimeTasks;
+    }
 
-        // total runtime (tasks, OS, ISRs) since we checked last
-        static uint32_t sLastTotalRuntime;
+    // RTC
+    static uint32_t sLastRtc;
+    const uint32_t msss = sdk_system_get_time() / 1000; // ms
+    const uint32_t thisRtc = sdk_system_get_rtc_time();
+    const uint32_t drtc = /*roundl*/( (double)(sLastRtc ? thisRtc - sLastRtc : 0)
+        * (1.0/1000.0/4096.0) * sdk_system_rtc_clock_cali_proc() ); // us -> ms
+    sLastRtc = thisRtc;
+
+    // print monitor info
+    DEBUG("--------------------------------------------------------------------------------");
+    DEBUG("mon: sys: ticks=%u msss=%u drtc=%u heap=%u isr=%u (%.2fkHz, %.1f%%) mhz=%u",
+        xTaskGetTickCount(), msss, drtc, /*xPortGetFreeHeapSize(), */sdk_system_get_free_heap_size(),
+        isrCount,
+        (double)isrCount / ((double)MON_PERIOD / 1000.0) / 1000.0,
+        (double)isrCycles * 100.0 / (double)isrTotalCycles, sdk_system_get_cpu_freq());
+    {
+        char str[MON_ISR_NUM * 16];
+        int len = 0;
+        for (int ix = 0; ix < MON_ISR_NUM; ix++)
         {
-            const uint32_t runtime = totalRuntime;
-            totalRuntime = totalRuntime - sLastTotalRuntime;
-            sLastTotalRuntime = runtime;
+            len += snprintf(&str[len], sizeof(str) - len, " %s=%.2f%%", skMonIsrStrs[ix],
+                (double)isrSrcCycles[ix] * 100.0 / (double)isrTotalCycles);
         }
-
-        // calculate time spent in each task since we checked last
-        static uint32_t sLastRuntimeCounter[MAX_TASKS];
-        uint32_t totalRuntimeTasks = 0;
-        for (int ix = 0; ix < nTasks; ix++)
+        DEBUG("mon: isr:%s", str);
+        for (int ix = 0; ix < MON_ISR_NUM; ix++)
         {
-            TaskStatus_t *pTask = &pTasks[ix];
-            const uint32_t runtime = pTask->ulRunTimeCounter;
-            pTask->ulRunTimeCounter = pTask->ulRunTimeCounter - sLastRuntimeCounter[ix];
-            sLastRuntimeCounter[ix] = runtime;
-            totalRuntimeTasks += pTask->ulRunTimeCounter;
+            char name[16];
+            snprintf(name, sizeof(name), "isr: %s", skMonIsrStrs[ix]);
+            monHistPrint(name, &sMonIsrStats[ix].hist, "cyc");
         }
+    }
+    heapMonStatus();
+    debugMonStatus();
+    wifiMonStatus();
+    backendMonStatus();
+    configMonStatus();
+    jenkinsMonStatus();
+    ledsMonStatus();
+    ledfxMonStatus();
+    toneMonStatus();
+    netlogMonStatus();
+    schedMonStatus();
+    sMonTraceStatus();
 
-        // FIXME: why?
-        if (totalRuntimeTasks > totalRuntime)
+    // telemetry record
+    int telLen;
+    {
+        uint32_t connCount, bytes;
+        backendGetStats(&connCount, &bytes);
+        telLen = snprintf(sMonTelemetryNext, sizeof(sMonTelemetryNext),
+            "up:%u,heap:%u,lrg:%d,isr:%.1f,conn:%u,rx:%u,tled:%u,tbe:%u",
+            msss / 1000, sdk_system_get_free_heap_size(), heapGetLargest(),
+            (double)isrCycles * 100.0 / (double)isrTotalCycles, connCount, bytes,
+            sMonBootMilestones[MON_BOOT_FIRSTLED] / 1000, sMonBootMilestones[MON_BOOT_BACKEND] / 1000);
+    }
+
+    // print tasks info
+    for (int ix = 0; ix < nTasks; ix++)
+    {
+        const TaskStatus_t *pkTask = &pTasks[ix];
+        char state = '?';
+        switch (pkTask->eCurrentState)
         {
-            totalRuntime = totalRuntimeTasks;
+            case eRunning:   state = 'X'; break;
+            case eReady:     state = 'R'; break;
+            case eBlocked:   state = 'B'; break;
+            case eSuspended: state = 'S'; break;
+            case eDeleted:   state = 'D'; break;
+            case eInvalid:   state = 'I'; break;
         }
-
-        // RTC
-        static uint32_t sLastRtc;
-        const uint32_t msss = sdk_system_get_time() / 1000; // ms
-        const uint32_t thisRtc = sdk_system_get_rtc_time();
-        const uint32_t drtc = /*roundl*/( (double)(sLastRtc ? thisRtc - sLastRtc : 0)
-            * (1.0/1000.0/4096.0) * sdk_system_rtc_clock_cali_proc() ); // us -> ms
-        sLastRtc = thisRtc;
-
-        // print monitor info
-        DEBUG("--------------------------------------------------------------------------------");
-        DEBUG("mon: sys: ticks=%u msss=%u drtc=%u heap=%u isr=%u (%.2fkHz, %.1f%%) mhz=%u",
-            sTick, msss, drtc, /*xPortGetFreeHeapSize(), */sdk_system_get_free_heap_size(),
-            isrCount,
-            (double)isrCount / ((double)MON_PERIOD / 1000.0) / 1000.0,
-            (double)isrTime * 100.0 / (double)isrTotalRuntime, sdk_system_get_cpu_freq());
-        debugMonStatus();
-        wifiMonStatus();
-        backendMonStatus();
-        configMonStatus();
-        jenkinsMonStatus();
-
-        // print tasks info
-        for (int ix = 0; ix < nTasks; ix++)
+        char perc[8];
+        if (pkTask->ulRunTimeCounter)
         {
-            const TaskStatus_t *pkTask = &pTasks[ix];
-            char state = '?';
-            switch (pkTask->eCurrentState)
+            const double p = (double)pkTask->ulRunTimeCounter * 100.0 / (double)totalRuntimeTasks;
+            if (p < 0.05)
             {
-                case eRunning:   state = 'X'; break;
-                case eReady:     state = 'R'; break;
-                case eBlocked:   state = 'B'; break;
-                case eSuspended: state = 'S'; break;
-                case eDeleted:   state = 'D'; break;
-                case eInvalid:   state = 'I'; break;
-            }
-            char perc[8];
-            if (pkTask->ulRunTimeCounter)
-            {
-                const double p = (double)pkTask->ulRunTimeCounter * 100.0 / (double)totalRuntimeTasks;
-                if (p < 0.05)
-                {
-                    strcpy(perc, "<0.1%");
-                }
-                else
-                {
-                    snprintf(perc, sizeof(perc), "%5.1f%%", p);
-                }
+                strcpy(perc, "<0.1%");
             }
             else
             {
-                strcpy(perc, "0.0%");
+                snprintf(perc, sizeof(perc), "%5.1f%%", p);
             }
-            DEBUG("mon: tsk: %02d %-16s %c %2i-%2i %4u %6s",
-                (int)pkTask->xTaskNumber, pkTask->pcTaskName, state,
-                (int)pkTask->uxCurrentPriority, (int)pkTask->uxBasePriority,
-                pkTask->usStackHighWaterMark, perc);
         }
-        DEBUG("--------------------------------------------------------------------------------");
-        //PRINT("runtime: %u %u %u, %u", totalRuntime, totalRuntimeTasks, totalRuntime - totalRuntimeTasks, isrTotalRuntime);
+        else
+        {
+            strcpy(perc, "0.0%");
+        }
+        DEBUG("mon: tsk: %02d %-16s %c %2i-%2i %4u %6s",
+            (int)pkTask->xTaskNumber, pkTask->pcTaskName, state,
+            (int)pkTask->uxCurrentPriority, (int)pkTask->uxBasePriority,
+            pkTask->usStackHighWaterMark, perc);
+
+        // no spaces and separators in the names
+        char name[16];
+        int nameIx = 0;
+        for (const char *pkName = pkTask->pcTaskName;
+             (*pkName != '\0') && (nameIx < (int)sizeof(name) - 1); pkName++)
+        {
+            name[nameIx++] = ( (*pkName == ' ') || (*pkName == ',') || (*pkName == ':') ) ? '_' : *pkName;
+        }
+        name[nameIx] = '\0';
+        if (telLen < (int)sizeof(sMonTelemetryNext))
+        {
+            telLen += snprintf(&sMonTelemetryNext[telLen], sizeof(sMonTelemetryNext) - telLen,
+                ",t.%s:%.1f/%u", name, totalRuntimeTasks > 0 ?
+                (double)pkTask->ulRunTimeCounter * 100.0 / (double)totalRuntimeTasks : 0.0,
+                pkTask->usStackHighWaterMark);
+        }
+    }
+    // drop the last (truncated) task if the record is full
+    if (telLen >= (int)sizeof(sMonTelemetryNext))
+    {
+        char *pComma = strrchr(sMonTelemetryNext, ',');
+        if (pComma != NULL)
+        {
+            *pComma = '\0';
+        }
     }
+    xSemaphoreTake(sMonTelemetryMutex, portMAX_DELAY);
+    strcpy(sMonTelemetry, sMonTelemetryNext);
+    xSemaphoreGive(sMonTelemetryMutex);
+    DEBUG("--------------------------------------------------------------------------------");
+    //PRINT("runtime: %u %u %u, %u", totalRuntime, totalRuntimeTasks, totalRuntime - totalRuntimeTasks, isrTotalRuntime);
+
+    heapFree(pTasks);
 }
 
+#if (!FF_CFG_SCHED)
+static void sMonTask(void *pArg)
+{
+    static uint32_t sTick;
+    sTick = -MS2TICKS(MON_PERIOD - MON_FIRST);
+
+    while (true)
+    {
+        // wait until it's time to dump the status
+        vTaskDelayUntil(&sTick, MS2TICKS(MON_PERIOD));
+
+        sMonStatus();
+    }
+}
+#endif // !FF_CFG_SCHED
+
 void monInit(void)
 {
     DEBUG("mon: init");
 
+    sMonCpuMhz = sdk_system_get_cpu_freq();
+
+    static StaticSemaphore_t sMutex;
+    sMonTelemetryMutex = xSemaphoreCreateMutexStatic(&sMutex);
+
+#if (FF_CFG_SCHED)
+    schedAdd(SCHED_JOB_MON, sMonStatus, MON_PERIOD, MON_FIRST);
+#else
     static StackType_t sMonTaskStack[384];
     static StaticTask_t sMonTaskTCB;
     xTaskCreateStatic(sMonTask, "ff_mon", NUMOF(sMonTaskStack), NULL, 9, sMonTaskStack, &sMonTaskTCB);
+#endif
 }
 
 // eof
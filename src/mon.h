@@ -14,12 +14,157 @@
 #define __MON_H__
 
 #include "stdinc.h"
+#include "stuff.h"
 
 //! initialise system monitor
 void monInit(void);
 
-void monIsrEnter(void);
-void monIsrLeave(void);
+//! maximum number of tasks the monitor can handle
+#define MON_MAX_TASKS 12
+
+//! interrupt sources (for monIsrEnter() and monIsrLeave())
+typedef enum MON_ISR_e
+{
+    MON_ISR_UART = 0,  //!< debug output (UART tx FIFO empty)
+    MON_ISR_SPI,       //!< LEDs (SPI transfer done)
+    MON_ISR_I2S,       //!< LEDs (I2S DMA end of frame)
+    MON_ISR_FRC1,      //!< tone (FRC1 timer)
+    MON_ISR_NUM        //!< number of sources
+} MON_ISR_t;
+
+//! interrupt service routine start (for profiling)
+/*!
+    \param[in] isr  the interrupt source
+
+    The ISRs don't nest on this platform, so a single start time is enough.
+*/
+void monIsrEnter(const MON_ISR_t isr);
+
+//! interrupt service routine end (for profiling)
+/*!
+    \param[in] isr  the interrupt source (same as for monIsrEnter())
+*/
+void monIsrLeave(const MON_ISR_t isr);
+
+//! CPU cycle counter
+static __FORCEINLINE uint32_t monCcount(void)
+{
+#ifdef __XTENSA__
+    uint32_t ccount;
+    __asm__ __volatile__ ("rsr %0, ccount" : "=a" (ccount));
+    return ccount;
+#else
+    return 0; // host build (tools/ledsim)
+#endif
+}
+
+//! number of histogram bins
+#define MON_HIST_NUM 8
+
+//! histogram with power-of-two bins
+/*!
+    Bin 0 counts values below \c base, bin 1 values below 2 * \c base, etc. The last bin counts all
+    remaining values. Initialise using MON_HIST_INIT().
+*/
+typedef struct MON_HIST_s
+{
+    uint32_t base;               //!< upper limit of the first bin
+    uint32_t bins[MON_HIST_NUM]; //!< counts
+    uint32_t count;              //!< number of values
+    uint32_t max;                //!< largest value
+} MON_HIST_t;
+
+//! histogram initialiser \hideinitializer
+#define MON_HIST_INIT(_base) { .base = (_base) }
+
+//! add value to histogram (not locked, usable from ISRs)
+void monHistAdd(MON_HIST_t *pHist, const uint32_t val);
+
+//! print and reset histogram
+void monHistPrint(const char *name, MON_HIST_t *pHist, const char *unit);
+
+//! latency trace points (from receiving a status update from the backend to sending it to the LEDs)
+typedef enum MON_TRACE_e
+{
+    MON_TRACE_RX = 0,  //!< data received from the backend (wifi)
+    MON_TRACE_PARSE,   //!< status update parsed (backend), starts a new trace
+    MON_TRACE_APPLY,   //!< jenkins info applied to the LED states (jenkins)
+    MON_TRACE_RENDER,  //!< LED frame rendered (leds)
+    MON_TRACE_FLUSH,   //!< LED frame sent (leds), completes the trace
+    MON_TRACE_NUM      //!< number of trace points
+} MON_TRACE_t;
+
+//! mark latency trace point
+/*!
+    The points are only recorded in the order given by #MON_TRACE_t, i.e. after #MON_TRACE_PARSE
+    only the next #MON_TRACE_APPLY is recorded, after that only the next #MON_TRACE_RENDER, etc.
+    Therefore this is cheap enough to be called for every frame. It's not locked (the points are
+    marked by different tasks and the tick ISR one after the other), so an occasional sample may
+    be off.
+
+    \param[in] point  the trace point
+*/
+void monTrace(const MON_TRACE_t point);
+
+//! add backend latencies (see the "trace" line in the backend protocol)
+/*!
+    \param[in] updateMs  time from the job change on the Jenkins server to the backend [ms]
+    \param[in] sendMs    time from the backend receiving the update to sending it to us [ms]
+*/
+void monTraceBackend(const uint32_t updateMs, const uint32_t sendMs);
+
+//! record boot phase
+/*!
+    To be called after each step of the startup (see user_init()). The time since boot is recorded
+    for each phase (up to #MON_BOOT_PHASES_MAX phases, more are dropped, see monBootPrint()). This
+    can be called before monInit() (and debugInit()).
+
+    \param[in] name  name of the phase (must be a static string)
+*/
+void monBootPhase(const char *name);
+
+//! maximum number of boot phases (user_init() currently records 17)
+#define MON_BOOT_PHASES_MAX 24
+
+//! print boot timeline (the recorded phases), warns if phases were dropped
+void monBootPrint(void);
+
+//! boot milestones (see monBootMilestone())
+typedef enum MON_BOOT_e
+{
+    MON_BOOT_FIRSTLED = 0,  //!< first LED frame rendered
+    MON_BOOT_ONLINE,        //!< connected to the access point
+    MON_BOOT_BACKEND,       //!< connected to the backend
+    MON_BOOT_NUM            //!< number of milestones
+} MON_BOOT_t;
+
+//! record boot milestone
+/*!
+    Only the first call for each milestone is recorded (and printed). The times to the first LED
+    frame and to the backend are included in the telemetry (see monTelemetry()).
+
+    \param[in] milestone  the milestone
+*/
+void monBootMilestone(const MON_BOOT_t milestone);
+
+//! maximum size of the telemetry record (incl. nul termination)
+#define MON_TELEMETRY_SIZE 400
+
+//! get the latest telemetry record
+/*!
+    The monitor makes a record of its data every period. It's a comma-separated list of
+    "key:value" pairs: uptime [s] (up), free heap [bytes] (heap), largest free block [bytes] (lrg),
+    interrupt load [%] (isr), backend connections (conn) and bytes received on the current
+    connection (rx), time from boot to the first LED frame (tled) and to the backend (tbe) [ms],
+    and for each task the CPU load [%] and the stack high-water mark [words]
+    ("t.<name>:<load>/<stack>").
+
+    \param[out] str   buffer for the record
+    \param[in]  size  size of the buffer
+
+    \returns true if a record was copied to the buffer, false if there's none (yet)
+*/
+bool monTelemetry(char *str, const int size);
 
 
 #endif // __MON_H__
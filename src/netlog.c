@@ -0,0 +1,149 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: network debug output (see \ref FF_NETLOG)
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+*/
+
+#include "stdinc.h"
+
+#include <lwip/api.h>
+
+#include "stuff.h"
+#include "debug.h"
+#include "wifi.h"
+#include "netlog.h"
+#include "cfg_gen.h"
+
+#define NETLOG_HEADER_SIZE 20
+
+static uint32_t sNetlogSeq;
+static uint32_t sNetlogBytes;
+static uint32_t sNetlogLost;
+static uint32_t sNetlogErrors;
+static err_t    sNetlogLastErr = ERR_OK;
+static bool     sNetlogOnline;
+
+static void sNetlogPut32(uint8_t *pBuf, const uint32_t val)
+{
+    pBuf[0] =  val        & 0xff;
+    pBuf[1] = (val >>  8) & 0xff;
+    pBuf[2] = (val >> 16) & 0xff;
+    pBuf[3] = (val >> 24) & 0xff;
+}
+
+static void sNetlogTask(void *pArg)
+{
+    static uint8_t sPacket[NETLOG_HEADER_SIZE + NETLOG_PAYLOAD_SIZE];
+    struct netconn *conn = NULL;
+    ip_addr_t hostIp;
+    const uint32_t chipId = sdk_system_get_chip_id();
+
+    while (true)
+    {
+        osSleep(FF_CFG_NETLOGPERIOD);
+
+        // no debug output here (it would end up in the next datagram)
+
+        if (!wifiIsOnline())
+        {
+            sNetlogOnline = false;
+            continue;
+        }
+
+        // (re-)resolve host after going online
+        if (!sNetlogOnline)
+        {
+            const err_t err = netconn_gethostbyname(FF_CFG_NETLOGHOST, &hostIp);
+            if (err != ERR_OK)
+            {
+                sNetlogLastErr = err;
+                sNetlogErrors++;
+                continue;
+            }
+            if (conn == NULL)
+            {
+                conn = netconn_new(NETCONN_UDP);
+                if (conn == NULL)
+                {
+                    sNetlogLastErr = ERR_MEM;
+                    sNetlogErrors++;
+                    continue;
+                }
+            }
+            sNetlogOnline = true;
+        }
+
+        // send everything that has accumulated, in as few datagrams as possible
+        while (true)
+        {
+            uint32_t lost = 0;
+            const int len = debugReadNet(&sPacket[NETLOG_HEADER_SIZE], NETLOG_PAYLOAD_SIZE, &lost);
+            sNetlogLost += lost;
+            if (len <= 0)
+            {
+                break;
+            }
+
+            memcpy(&sPacket[0], NETLOG_MAGIC, 4);
+            sNetlogPut32(&sPacket[ 4], sNetlogSeq);
+            sNetlogPut32(&sPacket[ 8], chipId);
+            sNetlogPut32(&sPacket[12], osTime());
+            sNetlogPut32(&sPacket[16], lost);
+            sNetlogSeq++;
+
+            // the datagram is lost if this fails, the collector will notice the gap in the sequence
+            struct netbuf *buf = netbuf_new();
+            err_t err = buf != NULL ? netbuf_ref(buf, sPacket, NETLOG_HEADER_SIZE + len) : ERR_MEM;
+            if (err == ERR_OK)
+            {
+                err = netconn_sendto(conn, buf, &hostIp, FF_CFG_NETLOGPORT);
+            }
+            if (buf != NULL)
+            {
+                netbuf_delete(buf);
+            }
+            if (err == ERR_OK)
+            {
+                sNetlogBytes += NETLOG_HEADER_SIZE + len;
+            }
+            else
+            {
+                sNetlogLastErr = err;
+                sNetlogErrors++;
+            }
+
+            if (len < NETLOG_PAYLOAD_SIZE)
+            {
+                break;
+            }
+        }
+    }
+}
+
+void netlogMonStatus(void)
+{
+    if (FF_CFG_NETLOGHOST[0] != '\0')
+    {
+        DEBUG("mon: netlog: online=%s seq=%u bytes=%u lost=%u errors=%u (%s)",
+            sNetlogOnline ? "yes" : "no", sNetlogSeq, sNetlogBytes, sNetlogLost, sNetlogErrors,
+            lwipErrStr(sNetlogLastErr));
+    }
+}
+
+void netlogStart(void)
+{
+    if (FF_CFG_NETLOGHOST[0] == '\0')
+    {
+        DEBUG("netlog: off");
+        return;
+    }
+    DEBUG("netlog: start (%s:%u, %ums)", FF_CFG_NETLOGHOST, FF_CFG_NETLOGPORT, FF_CFG_NETLOGPERIOD);
+
+    static StackType_t sNetlogTaskStack[384];
+    static StaticTask_t sNetlogTaskTCB;
+    xTaskCreateStatic(sNetlogTask, "ff_netlog", NUMOF(sNetlogTaskStack), NULL, 1, sNetlogTaskStack, &sNetlogTaskTCB);
+}
+
+// eof
@@ -0,0 +1,46 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: network debug output (see \ref FF_NETLOG)
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+
+    \defgroup FF_NETLOG NETLOG
+    \ingroup FF
+
+    This sends the debug output (the same as on the UART, i.e. text and binary records) to a
+    collector host via UDP (configured by CONFIG_NETLOGHOST, CONFIG_NETLOGPORT and
+    CONFIG_NETLOGPERIOD, see config-sample.mk). The output is collected for a period and then sent
+    in as few datagrams as possible, so that the wifi isn't woken up for every message. Use
+    tools/debug.pl to receive and decode the output.
+
+    Datagram format (all little endian):
+    - magic (#NETLOG_MAGIC, 4 bytes)
+    - sequence number (uint32_t, increments by one for each datagram)
+    - chip ID (uint32_t)
+    - time (uint32_t, ms since boot)
+    - number of bytes lost since the previous datagram (uint32_t, the sink couldn't keep up)
+    - debug output (1..#NETLOG_PAYLOAD_SIZE bytes)
+
+    @{
+*/
+#ifndef __NETLOG_H__
+#define __NETLOG_H__
+
+#include "stdinc.h"
+
+//! datagram magic
+#define NETLOG_MAGIC "TLog"
+
+//! maximum size of the debug output per datagram [bytes]
+#define NETLOG_PAYLOAD_SIZE 1024
+
+//! start network debug output (if configured)
+void netlogStart(void);
+
+//! print network debug output monitor info
+void netlogMonStatus(void);
+
+#endif // __NETLOG_H__
+//@}
+// eof
@@ -0,0 +1,188 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: cooperative job scheduler (see \ref FF_SCHED)
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+*/
+
+#include "stdinc.h"
+
+#include "stuff.h"
+#include "debug.h"
+#include "sched.h"
+
+typedef struct SCHED_JOB_DATA_s
+{
+    SCHED_FUNC_t func;
+    uint32_t     period;  // [ms]
+    uint32_t     next;    // next due time [ms]
+    uint32_t     runs;    // number of runs (since last status)
+    uint32_t     time;    // total runtime (since last status) [us]
+    uint32_t     max;     // longest run (since last status) [us]
+} SCHED_JOB_DATA_t;
+
+static SCHED_JOB_DATA_t sSchedJobs[SCHED_JOB_NUM];
+static volatile uint32_t svSchedPending; // triggered jobs (bits)
+static TaskHandle_t sSchedTaskHandle;
+
+static const char * const skSchedJobStrs[] =
+{
+    [SCHED_JOB_JENKINS] = "jenkins", [SCHED_JOB_STATUS] = "status", [SCHED_JOB_MON] = "mon",
+};
+
+void schedAdd(const SCHED_JOB_t job, SCHED_FUNC_t func, const uint32_t period, const uint32_t first)
+{
+    DEBUG("sched: add %s period=%u first=%u", skSchedJobStrs[job], period, first);
+    SCHED_JOB_DATA_t *pJob = &sSchedJobs[job];
+    CS_ENTER;
+    pJob->period = period;
+    pJob->next   = osTime() + first;
+    pJob->func   = func;
+    CS_LEAVE;
+    if (sSchedTaskHandle != NULL)
+    {
+        xTaskNotifyGive(sSchedTaskHandle);
+    }
+}
+
+void schedTrigger(const SCHED_JOB_t job)
+{
+    if (sSchedJobs[job].func == NULL)
+    {
+        return;
+    }
+    CS_ENTER;
+    svSchedPending |= (1 << job);
+    CS_LEAVE;
+    if (sSchedTaskHandle != NULL)
+    {
+        xTaskNotifyGive(sSchedTaskHandle);
+    }
+}
+
+// run a job and account its runtime
+static void sSchedRun(SCHED_JOB_DATA_t *pJob)
+{
+    const uint32_t t0 = sdk_system_get_time();
+    pJob->func();
+    const uint32_t dt = sdk_system_get_time() - t0;
+    CS_ENTER;
+    pJob->runs++;
+    pJob->time += dt;
+    if (dt > pJob->max)
+    {
+        pJob->max = dt;
+    }
+    CS_LEAVE;
+}
+
+#define SCHED_WAIT_MAX 1000 // [ms]
+
+// scheduler task, runs the jobs that are due or triggered and then waits for the next one
+static void sSchedTask(void *pArg)
+{
+    while (true)
+    {
+        uint32_t pending;
+        CS_ENTER;
+        pending = svSchedPending;
+        svSchedPending = 0;
+        CS_LEAVE;
+
+        int32_t wait = SCHED_WAIT_MAX;
+        for (int job = 0; job < SCHED_JOB_NUM; job++)
+        {
+            SCHED_JOB_DATA_t *pJob = &sSchedJobs[job];
+            if (pJob->func == NULL)
+            {
+                continue;
+            }
+            const uint32_t now = osTime();
+            const bool due = (pJob->period > 0) && ((int32_t)(now - pJob->next) >= 0);
+            if (due)
+            {
+                pJob->next += pJob->period;
+                // don't try to catch up if we're late
+                if ((int32_t)(now - pJob->next) >= 0)
+                {
+                    pJob->next = now + pJob->period;
+                }
+            }
+            if ( due || ((pending & (1 << job)) != 0) )
+            {
+                sSchedRun(pJob);
+            }
+            if (pJob->period > 0)
+            {
+                const int32_t dt = (int32_t)(pJob->next - osTime());
+                if (dt < wait)
+                {
+                    wait = dt;
+                }
+            }
+        }
+
+        // wait until the next job is due (or something is triggered)
+        if (wait > 0)
+        {
+            ulTaskNotifyTake(pdTRUE, MS2TICKS(wait + portTICK_PERIOD_MS - 1));
+        }
+    }
+}
+
+// The jobs run one after another, so the stack must fit the deepest job only (rather than the sum of
+// the stacks of the tasks it replaces). That's the monitor job (~600 bytes of own frames, plus
+// printf()), which ran fine in the 384 words of the ff_mon task. The jenkins job is ~220 bytes less
+// deep, the status job is trivial, and the scheduler itself adds 64 bytes. Check the high-water mark
+// in the "mon: tsk: .. ff_sched" output when changing the jobs.
+#define SCHED_STACK_SIZE (384 + 64) // [words]
+
+void schedStart(void)
+{
+#if (FF_CFG_SCHED)
+    DEBUG("sched: start");
+
+    static StackType_t sSchedTaskStack[SCHED_STACK_SIZE];
+    static StaticTask_t sSchedTaskTCB;
+    sSchedTaskHandle = xTaskCreateStatic(sSchedTask, "ff_sched", NUMOF(sSchedTaskStack), NULL, 2, sSchedTaskStack, &sSchedTaskTCB);
+#endif
+}
+
+void schedMonStatus(void)
+{
+    if (sSchedTaskHandle == NULL)
+    {
+        DEBUG("mon: sched: off");
+        return;
+    }
+
+    static uint32_t sLastTime;
+    const uint32_t now = sdk_system_get_time();
+    const uint32_t period = now - sLastTime;
+    sLastTime = now;
+
+    SCHED_JOB_DATA_t jobs[SCHED_JOB_NUM];
+    CS_ENTER;
+    memcpy(jobs, sSchedJobs, sizeof(jobs));
+    for (int job = 0; job < SCHED_JOB_NUM; job++)
+    {
+        sSchedJobs[job].runs = 0;
+        sSchedJobs[job].time = 0;
+        sSchedJobs[job].max  = 0;
+    }
+    CS_LEAVE;
+
+    for (int job = 0; job < SCHED_JOB_NUM; job++)
+    {
+        const SCHED_JOB_DATA_t *pkJob = &jobs[job];
+        if (pkJob->func == NULL)
+        {
+            continue;
+        }
+        DEBUG("mon: sched: %-7s period=%u runs=%u load=%.2f%% max=%uus", skSchedJobStrs[job],
+            pkJob->period, pkJob->runs, (double)pkJob->time * 100.0 / (double)period, pkJob->max);
+    }
+}
+
+// eof
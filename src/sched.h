@@ -0,0 +1,66 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: cooperative job scheduler (see \ref FF_SCHED)
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+
+    \defgroup FF_SCHED SCHED
+    \ingroup FF
+
+    With CONFIG_SCHED=1 (see config-sample.mk) the Jenkins state handling, the status LED timing
+    and the monitor don't get their own task (or timer) but run as jobs in a single scheduler
+    task. Each job runs periodically and/or when triggered (schedTrigger()). Jobs run to
+    completion, one after the other, so they must not block for long. The scheduler stack only
+    needs to fit the deepest job, which saves most of the stacks of the tasks it replaces (and
+    some context switches). The network (wifi, netlog), LEDs and tone
+    tasks are not affected.
+
+    The monitor prints the runtime of each job (see schedMonStatus()).
+
+    @{
+*/
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include "stdinc.h"
+
+//! jobs
+typedef enum SCHED_JOB_e
+{
+    SCHED_JOB_JENKINS = 0,  //!< Jenkins state handling (jenkins.c)
+    SCHED_JOB_STATUS,       //!< status LED and effect timing (status.c)
+    SCHED_JOB_MON,          //!< system monitor (mon.c)
+    SCHED_JOB_NUM           //!< number of jobs
+} SCHED_JOB_t;
+
+//! job function
+typedef void (*SCHED_FUNC_t)(void);
+
+//! add job
+/*!
+    \param[in] job     the job
+    \param[in] func    the job function
+    \param[in] period  period [ms] (or 0 to run only when triggered)
+    \param[in] first   delay until the first run [ms]
+*/
+void schedAdd(const SCHED_JOB_t job, SCHED_FUNC_t func, const uint32_t period, const uint32_t first);
+
+//! trigger job
+/*!
+    Makes the scheduler run the job as soon as possible. This does nothing if the job wasn't
+    added (i.e. with CONFIG_SCHED=0). Must not be called from an ISR.
+
+    \param[in] job  the job
+*/
+void schedTrigger(const SCHED_JOB_t job);
+
+//! start scheduler task (if configured)
+void schedStart(void);
+
+//! print scheduler monitor info
+void schedMonStatus(void);
+
+#endif // __SCHED_H__
+//@}
+// eof
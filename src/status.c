@@ -14,6 +14,7 @@
 #include "stuff.h"
 #include "tone.h"
 #include "config.h"
+#include "sched.h"
 #include "status.h"
 
 #define STATUS_GPIO 2 // D4, built-in LED
@@ -23,7 +24,8 @@ static uint8_t sPeriod;
 static uint8_t sNum;
 static uint8_t sEffect;
 
-static void sStatusLedTimerFunc(TimerHandle_t timer)
+// status LED and effect timing, every 100ms
+static void sStatusTick(void)
 {
     static uint32_t tick = 0;
     if (sPeriod && sNum)
@@ -46,6 +48,13 @@ static void sStatusLedTimerFunc(TimerHandle_t timer)
     }
 }
 
+#if (!FF_CFG_SCHED)
+static void sStatusLedTimerFunc(TimerHandle_t timer)
+{
+    sStatusTick();
+}
+#endif
+
 void statusLed(const STATUS_LED_t status)
 {
     gpio_write(STATUS_GPIO, false);
@@ -178,9 +187,13 @@ void statusInit(void)
     gpio_write(EFFECT_GPIO, false); // off
 
     // setup LED timer
+#if (FF_CFG_SCHED)
+    schedAdd(SCHED_JOB_STATUS, sStatusTick, 100, 100);
+#else
     static StaticTimer_t sTimer;
     TimerHandle_t timer = xTimerCreateStatic("status_led", MS2TICKS(100), true, NULL, sStatusLedTimerFunc, &sTimer);
     xTimerStart(timer, 1000);
+#endif
 
     statusLed(STATUS_LED_NONE);
 }
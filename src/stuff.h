@@ -108,6 +108,37 @@ uint32_t osGetPosixTime(void);
 
 //@}
 
+/* ***** flash data ****************************************************************************** */
+
+/*!
+    \name Flash Data
+
+    Constant data declared IROM (see esp-open-rtos' common_macros.h) lives in the flash instead of
+    the RAM. The flash can only be read word-wise (32 bits, aligned), so smaller types must be read
+    using these helpers (which also work for data in the RAM). Flash data must not be used by
+    interrupt handlers (the flash isn't accessible while it's written).
+
+    @{
+*/
+
+//! read byte from flash
+static __FORCEINLINE uint8_t romRead8(const void *pkAddr)
+{
+    const uintptr_t addr = (uintptr_t)pkAddr;
+    const uint32_t word = *(const uint32_t *)(addr & ~(uintptr_t)3);
+    return (word >> ((addr & 3) * 8)) & 0xff;
+}
+
+//! read half-word from flash (must be 16 bits aligned)
+static __FORCEINLINE uint16_t romRead16(const void *pkAddr)
+{
+    const uintptr_t addr = (uintptr_t)pkAddr;
+    const uint32_t word = *(const uint32_t *)(addr & ~(uintptr_t)3);
+    return (word >> ((addr & 2) * 8)) & 0xffff;
+}
+
+//@}
+
 /* ***** SDK enumeration stringifications ******************************************************** */
 
 /*!
@@ -13,16 +13,33 @@
 #include "stdinc.h"
 
 #include <esp8266.h>
+#include <sysparam.h>
 
 #include "stuff.h"
+#define DEBUG_MOD DEBUG_MOD_TONE
 #include "debug.h"
 #include "mon.h"
 #include "tone.h"
+#include "cfg_gen.h"
 
 /* *********************************************************************************************** */
 
 #define TONE_GPIO 4
 
+// Use the sigma-delta modulator (see CONFIG_TONESDM in config-sample.mk). For notes from about
+// 1.2kHz (APB_CLK_FREQ / 256 / 256) upwards the sigma-delta modulator can generate the tone (as a
+// train of short pulses, so it's a bit quieter than a square wave) and the timer only has to
+// interrupt at the end of the note. For lower notes the timer interrupts on every half period of
+// the note and the ISR toggles the GPIO. Pauses only interrupt at the end.
+#if defined(FF_CFG_TONESDM) && (FF_CFG_TONESDM > 0)
+#  define TONE_SDM 1
+#else
+#  define TONE_SDM 0
+#endif
+
+// lowest note frequency the sigma-delta modulator can do (max. prescaler 255, target 1)
+#define TONE_SDM_FREQ_MIN ( (APB_CLK_FREQ / 256 / 256) + 1 )
+
 // forward declarations
 static void sToneIsr(void *pArg);
 static void sToneStop(void);
@@ -39,64 +56,213 @@ void toneStart(const uint32_t freq, const uint32_t dur)
     toneMelody(pkFreqDur);
 }
 
-#define TONE_MELODY_N 50
+typedef enum TONE_MODE_e
+{
+    TONE_MODE_END = 0,  // end of melody
+    TONE_MODE_TOGGLE,   // tone by toggling the GPIO in the ISR
+    TONE_MODE_SDM,      // tone by the sigma-delta modulator
+    TONE_MODE_PAUSE,    // no tone
+} TONE_MODE_t;
+
+// A note is packed into two words, so that melodies can be played directly from the flash (which
+// can only be read word-wise):
+// - word 0: timer load value (bits 0-22), mode (TONE_MODE_t, bits 24-31)
+// - word 1: number of timer interrupts (bits 0-15), sigma-delta prescaler (bits 16-23) and target
+//   (bits 24-31)
+// The TONE_NOTE_WORDS() macro converts frequency [Hz] and duration [ms] to the two words. With
+// constant arguments the compiler does that at compile time (see rtttl_gen.h).
+#define TONE_NOTE_WORDS(freq, dur) TONE_NOTE_W0(freq, dur), TONE_NOTE_W1(freq, dur)
+#define TONE_NOTE_END_WORDS        0, 0
+
+#define TONE_NOTE_W0(freq, dur) \
+    ( ((uint32_t)TONE_NOTE_MODE(freq) << 24) | ( 0x007fffff & \
+      (TONE_NOTE_MODE(freq) == TONE_MODE_TOGGLE ? TONE_TOGGLE_VAL(freq) : TONE_DUR_VAL(dur)) ) )
+#define TONE_NOTE_W1(freq, dur) \
+    ( TONE_NOTE_MODE(freq) == TONE_MODE_TOGGLE ? TONE_TOGGLE_CNT(freq, dur) : \
+      ( TONE_DUR_CNT(dur) | ( TONE_NOTE_MODE(freq) == TONE_MODE_SDM ? \
+          (((uint32_t)TONE_SDM_PRESCALE(freq) << 16) | ((uint32_t)TONE_SDM_TARGET(freq) << 24)) : 0 ) ) )
+
+#define TONE_NOTE_GET_VAL(w0)      ( (w0) & 0x007fffff )
+#define TONE_NOTE_GET_MODE(w0)     ( (w0) >> 24 )
+#define TONE_NOTE_GET_CNT(w1)      ( (w1) & 0xffff )
+#define TONE_NOTE_GET_PRESCALE(w1) ( ((w1) >> 16) & 0xff )
+#define TONE_NOTE_GET_TARGET(w1)   ( (w1) >> 24 )
+
+#define TONE_NOTE_MODE(freq) ( (freq) == TONE_PAUSE ? TONE_MODE_PAUSE : \
+    ( (TONE_SDM && ((freq) >= TONE_SDM_FREQ_MIN)) ? TONE_MODE_SDM : TONE_MODE_TOGGLE ) )
+
+// timer value and number of times to toggle the PIO (TIMER_CLKDIV_1)
+#define TONE_TOGGLE_VAL(freq)      ( (APB_CLK_FREQ / 1000000 * 500000) / (freq) )
+#define TONE_TOGGLE_CNT(freq, dur) CLIP( 2 * (int32_t)(freq) * (int32_t)(dur) / 1000, 1, 0xffff )
+
+// timer value(s) for a note that only interrupts at the end (TIMER_CLKDIV_256), the timer is 23
+// bits (0-8388607), that's 26.8s
+#define TONE_DUR_TICKS(dur) MAX(1, ((uint32_t)(dur) * (APB_CLK_FREQ / 1000)) / 256)
+#define TONE_DUR_CNT(dur)   ( (TONE_DUR_TICKS(dur) / 8388607) + 1 )
+#define TONE_DUR_VAL(dur)   ( TONE_DUR_TICKS(dur) / TONE_DUR_CNT(dur) )
+
+// sigma-delta output frequency is APB_CLK_FREQ / (prescale + 1) * target / 256, the pulses are as
+// long as the prescaled clock period, so use the largest target possible
+#define TONE_SDM_TARGET_OK(freq, target) ( ((uint32_t)(target) * (APB_CLK_FREQ / 256)) <= ((uint32_t)(freq) * 256) )
+#define TONE_SDM_TARGET(freq) ( TONE_SDM_TARGET_OK(freq, 16) ? 16 : TONE_SDM_TARGET_OK(freq, 8) ? 8 : \
+    TONE_SDM_TARGET_OK(freq, 4) ? 4 : TONE_SDM_TARGET_OK(freq, 2) ? 2 : 1 )
+#define TONE_SDM_PRESCALE(freq) \
+    ( CLIP( ((TONE_SDM_TARGET(freq) * (APB_CLK_FREQ / 256)) + ((freq) / 2)) / (freq), 1, 256 ) - 1 )
+
+// builtin melodies
+typedef struct TONE_BUILTIN_s
+{
+    const char     *name;
+    const uint32_t *pkNotes;
+} TONE_BUILTIN_t;
 
-static volatile uint32_t svToneMelodyTimervals[TONE_MELODY_N + 1];
-static volatile int16_t  svToneMelodyTogglecnts[TONE_MELODY_N + 1];
-static volatile int16_t  svToneMelodyIx;
+// skToneBuiltins[], generated from 3rdparty/rtttl.c by tools/rtttl.pl
+#include "rtttl_gen.h"
 
-#define PAUSE_FREQ 1000
+// Melodies are played from a small ring buffer of notes, which the ISR drains at the end of each
+// note. The tone task refills it from the melody source (a note table in the flash, a list of
+// frequency-duration pairs or an RTTTL string). So melodies of any length play in constant memory.
+#define TONE_RING_N 16 // must be a power of 2
 
-void toneMelody(const int16_t *pkFreqDur)
+static volatile uint32_t svToneRing[TONE_RING_N][2];
+static volatile uint32_t svToneRingHead; // next note to write (tone task)
+static volatile uint32_t svToneRingTail; // next note to play (ISR)
+
+// pause played if the tone task didn't refill the ring buffer in time [ms]
+#define TONE_UNDERRUN_PAUSE 10
+
+typedef enum TONE_SRC_e
 {
-    sToneStop();
-    uint32_t totalDur = 0;
-    uint16_t nNotes = 0;
+    TONE_SRC_NONE,      // no (more) notes
+    TONE_SRC_NOTES,     // packed notes (see TONE_NOTE_WORDS())
+    TONE_SRC_FREQDUR,   // frequency-duration pairs
+    TONE_SRC_RTTTL,     // RTTTL melody
+} TONE_SRC_t;
+
+// melody source (protected by sToneSrcMutex)
+static TONE_SRC_t      sToneSrc;
+static const uint32_t *spkToneSrcNotes;
+static const int16_t  *spkToneSrcFreqDur;
+static RTTTL_STATE_t   sToneSrcRtttl;
+static SemaphoreHandle_t sToneSrcMutex;
+
+static TaskHandle_t sToneTaskHandle;
+
+static volatile uint32_t svToneNoteCnts[TONE_MODE_PAUSE + 1];
+static volatile uint32_t svToneIsrCnt;
+static volatile uint32_t svToneUnderrunCnt;
+
+// get next note from the source, returns false if there are no more notes
+static bool sToneSrcNext(uint32_t *pW0, uint32_t *pW1)
+{
+    int16_t freq = TONE_END;
+    int16_t dur = 0;
+    switch (sToneSrc)
+    {
+        case TONE_SRC_NONE:
+            return false;
+        case TONE_SRC_NOTES:
+            *pW0 = spkToneSrcNotes[0];
+            *pW1 = spkToneSrcNotes[1];
+            spkToneSrcNotes += 2;
+            break;
+        case TONE_SRC_FREQDUR:
+            freq = spkToneSrcFreqDur[0];
+            if (freq > 0)
+            {
+                dur = spkToneSrcFreqDur[1];
+                spkToneSrcFreqDur += 2;
+            }
+            break;
+        case TONE_SRC_RTTTL:
+            if (!rtttlNext(&sToneSrcRtttl, &freq, &dur))
+            {
+                freq = TONE_END;
+            }
+            break;
+    }
 
-    //memset(svToneMelodyTimervals, 0, sizeof(svToneMelodyTimervals));
-    for (int ix = 0; ix < NUMOF(svToneMelodyTimervals); ix++)
+    if (sToneSrc != TONE_SRC_NOTES)
     {
-        svToneMelodyTimervals[ix] = 0;
+        if (freq > 0)
+        {
+            *pW0 = TONE_NOTE_W0(freq, dur);
+            *pW1 = TONE_NOTE_W1(freq, dur);
+        }
+        else
+        {
+            *pW0 = 0;
+            *pW1 = 0;
+        }
     }
-    //memset(svToneMelodyTogglecnts, 0, sizeof(svToneMelodyTogglecnts));
-    for (int ix = 0; ix < NUMOF(svToneMelodyTogglecnts); ix++)
+
+    // end of melody
+    if (TONE_NOTE_GET_MODE(*pW0) == TONE_MODE_END)
     {
-        svToneMelodyTogglecnts[ix] = 0;
+        sToneSrc = TONE_SRC_NONE;
     }
-    svToneMelodyIx = 0;
+    return true;
+}
 
-    for (int16_t ix = 0; ix < TONE_MELODY_N; ix++)
+// refill ring buffer from the source (with sToneSrcMutex taken)
+static void sToneRingFill(void)
+{
+    while ( (svToneRingHead - svToneRingTail) < TONE_RING_N )
     {
-        const int16_t freq = pkFreqDur[ 2 * ix ];
-        if ( (freq != TONE_END) && (freq > 0) )
+        uint32_t w0, w1;
+        if (!sToneSrcNext(&w0, &w1))
         {
-            const int16_t _freq = freq != TONE_PAUSE ? freq : PAUSE_FREQ;
-            const int16_t dur = pkFreqDur[ (2 * ix) + 1 ];
-
-            // timer value
-            const uint32_t timerval = (APB_CLK_FREQ / 1000000 * 500000) / _freq;
+            break;
+        }
+        const uint32_t ix = svToneRingHead % TONE_RING_N;
+        svToneRing[ix][0] = w0;
+        svToneRing[ix][1] = w1;
+        svToneRingHead++;
+    }
+}
 
-            // number of times to toggle the PIO
-            const int16_t togglecnt = 2 * _freq * dur / 1000;
+static void sToneTask(void *pArg)
+{
+    while (true)
+    {
+        // wait until the ISR wants more notes
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-            svToneMelodyTimervals[ix]  = timerval;
-            svToneMelodyTogglecnts[ix] = freq != TONE_PAUSE ? togglecnt : -togglecnt;
+        xSemaphoreTake(sToneSrcMutex, portMAX_DELAY);
+        sToneRingFill();
+        xSemaphoreGive(sToneSrcMutex);
+    }
+}
 
-            totalDur += dur;
-            nNotes++;
+static void sTonePlay(const TONE_SRC_t src, const void *pkSrc)
+{
+    sToneStop();
 
-            //DEBUG("toneMelody() %2d %4d %4d -> %6u %4d", ix, freq, dur, timerval, togglecnt);
-        }
-        else
-        {
+    xSemaphoreTake(sToneSrcMutex, portMAX_DELAY);
+    sToneSrc = src;
+    switch (src)
+    {
+        case TONE_SRC_NONE:
+            break;
+        case TONE_SRC_NOTES:
+            spkToneSrcNotes = pkSrc;
+            break;
+        case TONE_SRC_FREQDUR:
+            spkToneSrcFreqDur = pkSrc;
+            break;
+        case TONE_SRC_RTTTL:
+            if (!rtttlInit(&sToneSrcRtttl, pkSrc))
+            {
+                WARNING("tone: bad melody");
+            }
             break;
-        }
     }
-
-    //DEBUG("toneMelody() %ums, %u", totalDur, nNotes);
+    svToneRingHead = 0;
+    svToneRingTail = 0;
+    sToneRingFill();
+    xSemaphoreGive(sToneSrcMutex);
 
     // configure hw timer
-    timer_set_divider(FRC1, TIMER_CLKDIV_1);
     timer_set_reload(FRC1, true);
     timer_set_interrupts(FRC1, true); // enable and unmask interrupt
 
@@ -104,39 +270,87 @@ void toneMelody(const int16_t *pkFreqDur)
     sToneStart();
 }
 
+void toneMelody(const int16_t *pkFreqDur)
+{
+    sTonePlay(TONE_SRC_FREQDUR, pkFreqDur);
+}
+
 /* *********************************************************************************************** */
 
-static volatile int16_t svToneToggleCnt;
-static volatile bool svToneSilent;
+static volatile int32_t svToneTimerCnt; // (the counts are 0..0xffff, see TONE_NOTE_GET_CNT())
+static volatile bool svToneToggle;
 
-static void sToneStart(void) // RAM func
+#if (TONE_SDM > 0)
+IRAM static void sToneSdmOn(const uint8_t prescale, const uint8_t target) // RAM func
 {
-    gpio_write(TONE_GPIO, false);
+    GPIO.DSM = GPIO_DSM_ENABLE | VAL2FIELD_M(GPIO_DSM_PRESCALER, prescale) | VAL2FIELD_M(GPIO_DSM_TARGET, target);
+    SET_MASK_BITS(GPIO.CONF[TONE_GPIO], GPIO_CONF_SOURCE_DSM);
+}
 
-    const int32_t timerval  = svToneMelodyTimervals[svToneMelodyIx];
-    const int16_t togglecnt = svToneMelodyTogglecnts[svToneMelodyIx];
-    svToneMelodyIx++;
+IRAM static void sToneSdmOff(void) // RAM func
+{
+    CLEAR_MASK_BITS(GPIO.CONF[TONE_GPIO], GPIO_CONF_SOURCE_DSM);
+    GPIO.DSM = 0;
+}
+#else
+static void sToneSdmOn(const uint8_t prescale, const uint8_t target) { UNUSED(prescale); UNUSED(target); }
+static void sToneSdmOff(void) { }
+#endif
 
-    if (togglecnt)
-    {
-        svToneToggleCnt = togglecnt < 0 ? -togglecnt : togglecnt;
-        svToneSilent = togglecnt < 0 ? true : false;
+IRAM static void sToneStart(void) // RAM func
+{
+    sToneSdmOff();
+    gpio_write(TONE_GPIO, false);
 
-        // arm timer (23 bits, 0-8388607)
-        timer_set_load(FRC1, timerval);
-        timer_set_run(FRC1, true);
+    uint32_t w0, w1;
+    const uint32_t tail = svToneRingTail;
+    if (tail != svToneRingHead)
+    {
+        w0 = svToneRing[tail % TONE_RING_N][0];
+        w1 = svToneRing[tail % TONE_RING_N][1];
+        svToneRingTail = tail + 1;
     }
+    // the tone task didn't keep up
     else
     {
-        sToneStop();
+        w0 = TONE_NOTE_W0(TONE_PAUSE, TONE_UNDERRUN_PAUSE);
+        w1 = TONE_NOTE_W1(TONE_PAUSE, TONE_UNDERRUN_PAUSE);
+        svToneUnderrunCnt++;
+    }
+    const TONE_MODE_t mode = (TONE_MODE_t)TONE_NOTE_GET_MODE(w0);
+
+    switch (mode)
+    {
+        case TONE_MODE_TOGGLE:
+            timer_set_divider(FRC1, TIMER_CLKDIV_1);
+            svToneToggle = true;
+            break;
+        case TONE_MODE_SDM:
+            sToneSdmOn(TONE_NOTE_GET_PRESCALE(w1), TONE_NOTE_GET_TARGET(w1));
+            FALLTHROUGH;
+        case TONE_MODE_PAUSE:
+            timer_set_divider(FRC1, TIMER_CLKDIV_256);
+            svToneToggle = false;
+            break;
+        case TONE_MODE_END:
+        default:
+            sToneStop();
+            return;
     }
+    svToneNoteCnts[mode]++;
+
+    // arm timer (23 bits, 0-8388607)
+    svToneTimerCnt = TONE_NOTE_GET_CNT(w1);
+    timer_set_load(FRC1, TONE_NOTE_GET_VAL(w0));
+    timer_set_run(FRC1, true);
 }
 
-static void sToneStop(void) // RAM func
+IRAM static void sToneStop(void) // RAM func
 {
     timer_set_run(FRC1, false); // stop timer
     timer_set_interrupts(FRC1, false); // disable and mask interrupt
 
+    sToneSdmOff();
     gpio_write(TONE_GPIO, false);
     sToneIsPlaying = false;
 }
@@ -144,6 +358,9 @@ static void sToneStop(void) // RAM func
 void toneStop(void)
 {
     sToneStop();
+    xSemaphoreTake(sToneSrcMutex, portMAX_DELAY);
+    sToneSrc = TONE_SRC_NONE;
+    xSemaphoreGive(sToneSrcMutex);
 }
 
 __INLINE bool toneIsPlaying(void)
@@ -154,13 +371,15 @@ __INLINE bool toneIsPlaying(void)
 
 IRAM static void sToneIsr(void *pArg) // RAM func
 {
-    monIsrEnter();
+    monIsrEnter(MON_ISR_FRC1);
     //UNUSED(pArg);
 
+    svToneIsrCnt++;
+
     // toggle PIO...
-    if (!svToneSilent)
+    if (svToneToggle)
     {
-        if (svToneToggleCnt & 0x1)
+        if (svToneTimerCnt & 0x1)
         {
             gpio_write(TONE_GPIO, true);
         }
@@ -170,15 +389,23 @@ IRAM static void sToneIsr(void *pArg) // RAM func
         }
     }
 
-    svToneToggleCnt--;
+    svToneTimerCnt--;
 
     // ...until done
-    if (svToneToggleCnt <= 0)
+    if (svToneTimerCnt <= 0)
     {
         sToneStart();
+
+        // have the tone task refill the ring buffer
+        if ( sToneIsPlaying && ((svToneRingHead - svToneRingTail) <= (TONE_RING_N / 2)) )
+        {
+            BaseType_t woken = pdFALSE;
+            vTaskNotifyGiveFromISR(sToneTaskHandle, &woken);
+            portYIELD_FROM_ISR(woken);
+        }
     }
 
-    monIsrLeave();
+    monIsrLeave(MON_ISR_FRC1);
 }
 
 
@@ -186,37 +413,251 @@ IRAM static void sToneIsr(void *pArg) // RAM func
 
 void toneBuiltinMelody(const char *name)
 {
-    const char *rtttl = rtttlBuiltinMelody(name);
-    if (rtttl == NULL)
+    int ix = NUMOF(skToneBuiltins);
+    while (ix--)
     {
-        ERROR("tone: no such melody: %s", name);
-        return;
+        if (strcmp(skToneBuiltins[ix].name, name) == 0)
+        {
+            sTonePlay(TONE_SRC_NOTES, skToneBuiltins[ix].pkNotes);
+            return;
+        }
     }
-    toneRtttlMelody(rtttl);
+    ERROR("tone: no such melody: %s", name);
 }
 
 void toneBuiltinMelodyRandom(void)
 {
-    const char *rtttl = rtttlBuiltinMelodyRandom();
-    toneRtttlMelody(rtttl);
+    const int ix = rand() % NUMOF(skToneBuiltins);
+    sTonePlay(TONE_SRC_NOTES, skToneBuiltins[ix].pkNotes);
 }
 
 
 void toneRtttlMelody(const char *rtttl)
 {
+    sTonePlay(TONE_SRC_RTTTL, rtttl);
+}
+
+/* *********************************************************************************************** */
+
+// The melody cache has TONE_CACHE_N slots in the flash (sysparam keys "melody0", "melody1", ...),
+// each holding one RTTTL string. The hashes of the cached melodies are kept in RAM, so that looking
+// up a melody doesn't touch the flash. Playing a cached melody loads it into sToneCacheBuf.
+
+#define TONE_CACHE_KEY "melody%d"
+
+typedef struct TONE_CACHE_s
+{
+    uint32_t hash;  // melody hash, 0 = empty slot
+    uint32_t used;  // last use (sToneCacheUseCnt), for replacing the least recently used melody
+} TONE_CACHE_t;
+
+static TONE_CACHE_t sToneCache[TONE_CACHE_N];
+static uint32_t sToneCacheUseCnt;
+static uint32_t sToneCacheHits;
+static uint32_t sToneCacheMisses;
+static char sToneCacheBuf[TONE_CACHE_SIZE];
+static SemaphoreHandle_t sToneCacheMutex;
+
+uint32_t toneMelodyHash(const char *rtttl)
+{
+    // FNV-1a
+    uint32_t hash = 0x811c9dc5;
+    while (*rtttl)
+    {
+        hash ^= (uint8_t)*rtttl++;
+        hash *= 0x01000193;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+// check melody, it must be "name:control:notes" with a valid control section and at least one note
+static bool sToneCacheCheck(const char *rtttl)
+{
+    RTTTL_STATE_t state;
+    if (!rtttlInit(&state, rtttl))
+    {
+        return false;
+    }
+    const char *pkNotes = state.p;
+    if (strspn(pkNotes, "0123456789abcdefgp#.,") != strlen(pkNotes))
+    {
+        return false;
+    }
+    int nNotes = 0;
+    int16_t freq, dur;
+    while (rtttlNext(&state, &freq, &dur))
+    {
+        nNotes++;
+    }
+    return nNotes > 0;
+}
+
+// find slot of cached melody, returns -1 if it's not in the cache
+static int sToneCacheFind(const uint32_t hash)
+{
+    for (int ix = 0; (hash != 0) && (ix < TONE_CACHE_N); ix++)
+    {
+        if (sToneCache[ix].hash == hash)
+        {
+            return ix;
+        }
+    }
+    return -1;
+}
+
+bool toneCacheStore(const uint32_t hash, const char *rtttl)
+{
+    if ( (strlen(rtttl) >= TONE_CACHE_SIZE) || (toneMelodyHash(rtttl) != hash) || !sToneCacheCheck(rtttl) )
+    {
+        WARNING("tone: bad melody %08x", hash);
+        return false;
+    }
+
+    xSemaphoreTake(sToneCacheMutex, portMAX_DELAY);
+
+    // already cached?
+    int slot = sToneCacheFind(hash);
+    if (slot < 0)
+    {
+        // replace the least recently used (or an empty) slot
+        slot = 0;
+        for (int ix = 1; ix < TONE_CACHE_N; ix++)
+        {
+            if (sToneCache[ix].used < sToneCache[slot].used)
+            {
+                slot = ix;
+            }
+        }
+
+        char key[16];
+        snprintf(key, sizeof(key), TONE_CACHE_KEY, slot);
+        PRINT("tone: store melody %08x in %s (%d bytes, replaces %08x)",
+            hash, key, strlen(rtttl), sToneCache[slot].hash);
+        const sysparam_status_t res = sysparam_set_string(key, rtttl);
+        if (res != SYSPARAM_OK)
+        {
+            WARNING("tone: sysparam set fail (%d)", res);
+            sToneCache[slot].hash = 0;
+            sToneCache[slot].used = 0;
+            xSemaphoreGive(sToneCacheMutex);
+            return false;
+        }
+        sToneCache[slot].hash = hash;
+    }
+    sToneCacheUseCnt++;
+    sToneCache[slot].used = sToneCacheUseCnt;
+
+    xSemaphoreGive(sToneCacheMutex);
+    return true;
+}
+
+bool toneCacheMelody(const uint32_t hash)
+{
+    if (hash == 0)
+    {
+        return false;
+    }
+
+    // stop first, sToneCacheBuf may be playing
     toneStop();
-    const int nMelody = (TONE_MELODY_N * 2) + 1;
-    int16_t *pMelody = malloc( nMelody * sizeof(int16_t) );
-    if (pMelody)
+
+    xSemaphoreTake(sToneCacheMutex, portMAX_DELAY);
+    bool res = false;
+    const int slot = sToneCacheFind(hash);
+    if (slot >= 0)
+    {
+        char key[16];
+        snprintf(key, sizeof(key), TONE_CACHE_KEY, slot);
+        size_t len = 0;
+        bool isBinary = false;
+        if ( (sysparam_get_data_static(key, (uint8_t *)sToneCacheBuf, sizeof(sToneCacheBuf) - 1, &len, &isBinary) == SYSPARAM_OK) &&
+             !isBinary )
+        {
+            sToneCacheBuf[len] = '\0';
+            sToneCacheUseCnt++;
+            sToneCache[slot].used = sToneCacheUseCnt;
+            sTonePlay(TONE_SRC_RTTTL, sToneCacheBuf);
+            res = true;
+        }
+        else
+        {
+            WARNING("tone: %s gone", key);
+            sToneCache[slot].hash = 0;
+            sToneCache[slot].used = 0;
+        }
+    }
+    if (res)
     {
-        rtttlMelody(rtttl, pMelody, nMelody);
-        toneMelody(pMelody);
-        free(pMelody);
+        sToneCacheHits++;
     }
     else
     {
-        ERROR("tone: malloc fail");
+        sToneCacheMisses++;
+        WARNING("tone: melody %08x not cached", hash);
+    }
+    xSemaphoreGive(sToneCacheMutex);
+
+    return res;
+}
+
+void toneCacheList(char *str, const int size)
+{
+    int len = 0;
+    str[0] = '\0';
+    xSemaphoreTake(sToneCacheMutex, portMAX_DELAY);
+    for (int ix = 0; ix < TONE_CACHE_N; ix++)
+    {
+        if ( (sToneCache[ix].hash != 0) && ((len + 8 + 1) < size) )
+        {
+            len += snprintf(&str[len], size - len, "%s%08x", len > 0 ? "," : "", sToneCache[ix].hash);
+        }
+    }
+    xSemaphoreGive(sToneCacheMutex);
+}
+
+void toneMonStatus(void)
+{
+    DEBUG("mon: tone: notes=%u/%u/%u (toggle/sdm/pause) isr=%u underrun=%u playing=%s",
+        svToneNoteCnts[TONE_MODE_TOGGLE], svToneNoteCnts[TONE_MODE_SDM], svToneNoteCnts[TONE_MODE_PAUSE],
+        svToneIsrCnt, svToneUnderrunCnt, sToneIsPlaying ? "yes" : "no");
+    char list[TONE_CACHE_LIST_SIZE];
+    toneCacheList(list, sizeof(list));
+    DEBUG("mon: tone: cache=%s hits=%u misses=%u", list[0] ? list : "-", sToneCacheHits, sToneCacheMisses);
+}
+
+// load hashes of the cached melodies
+static void sToneCacheInit(void)
+{
+    static StaticSemaphore_t sMutex;
+    sToneCacheMutex = xSemaphoreCreateMutexStatic(&sMutex);
+
+    for (int ix = 0; ix < TONE_CACHE_N; ix++)
+    {
+        char key[16];
+        snprintf(key, sizeof(key), TONE_CACHE_KEY, ix);
+        size_t len = 0;
+        bool isBinary = false;
+        const sysparam_status_t res = sysparam_get_data_static(
+            key, (uint8_t *)sToneCacheBuf, sizeof(sToneCacheBuf) - 1, &len, &isBinary);
+        if (res == SYSPARAM_OK)
+        {
+            sToneCacheBuf[len] = '\0';
+            if (!isBinary && sToneCacheCheck(sToneCacheBuf))
+            {
+                sToneCache[ix].hash = toneMelodyHash(sToneCacheBuf);
+                DEBUG("tone: %s %08x (%d bytes)", key, sToneCache[ix].hash, len);
+            }
+            else
+            {
+                WARNING("tone: bad cached %s", key);
+            }
+        }
+        else if (res != SYSPARAM_NOTFOUND)
+        {
+            WARNING("tone: sysparam get fail (%d)", res);
+        }
     }
+    sToneCacheBuf[0] = '\0';
 }
 
 /* *********************************************************************************************** */
@@ -224,7 +665,7 @@ void toneRtttlMelody(const char *rtttl)
 
 void toneInit(void)
 {
-    DEBUG("tone: init (%uMHz)", APB_CLK_FREQ/1000000);
+    DEBUG("tone: init (%uMHz, sdm %s)", APB_CLK_FREQ/1000000, TONE_SDM ? "on" : "off");
 
     gpio_enable(TONE_GPIO, GPIO_OUTPUT);
     gpio_write(TONE_GPIO, false);
@@ -237,6 +678,15 @@ void toneInit(void)
 
     // attach ISR
     _xt_isr_attach(INUM_TIMER_FRC1, sToneIsr, NULL);
+
+    static StaticSemaphore_t sMutex;
+    sToneSrcMutex = xSemaphoreCreateMutexStatic(&sMutex);
+
+    static StackType_t sToneTaskStack[256];
+    static StaticTask_t sToneTaskTCB;
+    sToneTaskHandle = xTaskCreateStatic(sToneTask, "ff_tone", NUMOF(sToneTaskStack), NULL, 1, sToneTaskStack, &sToneTaskTCB);
+
+    sToneCacheInit();
 }
 
 
@@ -23,6 +23,9 @@
 //! initialise tone module
 void toneInit(void);
 
+//! print tone monitor info
+void toneMonStatus(void);
+
 //! play a tone
 /*!
     \note This is non-blocking and returns immediately, while the tone might still be playing. Use
@@ -54,7 +57,8 @@ bool toneIsPlaying(void);
 //! play a melody given a series of frequency-duration pairs
 /*!
     \note This is non-blocking and returns immediately. It stopy any currently playing tone or
-    melody.
+    melody. The notes are read while the melody plays, so the list must remain valid (e.g. static
+    const) unless it is very short (up to 15 notes).
 
     \param[in] pkFreqDur  list of pairs of tone frequency and duration
 
@@ -77,10 +81,57 @@ void toneBuiltinMelodyRandom(void);
 
 //! play melody in RTTTL format
 /*!
+    \note The melody is parsed while it plays, so the string must remain valid.
+
     \param[in] rtttl  string with melody in RTTTL format (see rtttl.c, https://en.wikipedia.org/wiki/Ring_Tone_Transfer_Language)
 */
 void toneRtttlMelody(const char *rtttl);
 
+//! number of melodies in the melody cache
+#define TONE_CACHE_N 4
+
+//! maximum size of a cached melody (RTTTL string, including the terminating nul)
+#define TONE_CACHE_SIZE 512
+
+//! size of the string required for toneCacheList()
+#define TONE_CACHE_LIST_SIZE (TONE_CACHE_N * (8 + 1))
+
+//! calculate melody hash
+/*!
+    \param[in] rtttl  string with melody in RTTTL format
+
+    \returns the 32 bits FNV-1a hash of the string (never 0)
+*/
+uint32_t toneMelodyHash(const char *rtttl);
+
+//! store melody in the melody cache
+/*!
+    Custom melodies are uploaded by the backend once and stored in the flash (sysparam). After that
+    they are referenced by their hash only (see toneCacheMelody()). If the cache is full the least
+    recently used melody is replaced.
+
+    \param[in] hash   the melody hash (see toneMelodyHash())
+    \param[in] rtttl  string with melody in RTTTL format
+
+    \returns true if the melody is now in the cache, false otherwise (hash mismatch, bad melody)
+*/
+bool toneCacheStore(const uint32_t hash, const char *rtttl);
+
+//! play melody from the melody cache
+/*!
+    \param[in] hash  the melody hash
+
+    \returns true if the melody is playing, false if it is not in the cache (or hash is 0)
+*/
+bool toneCacheMelody(const uint32_t hash);
+
+//! list cached melodies
+/*!
+    \param[out] str   string for the comma-separated list of hashes (hex), empty if there are none
+    \param[in]  size  size of the string (should be #TONE_CACHE_LIST_SIZE)
+*/
+void toneCacheList(char *str, const int size);
+
 #endif // __TONE_H__
 //@}
 // eof
@@ -18,11 +18,16 @@
 #include "jsmn.h"
 
 #include "stuff.h"
+#define DEBUG_MOD DEBUG_MOD_WIFI
 #include "debug.h"
 #include "wifi.h"
 #include "status.h"
 #include "backend.h"
 #include "jenkins.h"
+#include "tone.h"
+#include "crash.h"
+#include "mon.h"
+#include "heap.h"
 #include "cfg_gen.h"
 #include "ver_gen.h"
 #include "crt_gen.h"
@@ -61,12 +66,15 @@ static const char *sWifiStateStr(const WIFI_STATE_t state)
 }
 
 // query parameters for the backend
-#define BACKEND_QUERY "cmd=realtime;ascii=1;client=%s;name=%s;stassid="FF_CFG_STASSID";staip="IPSTR";version="FF_BUILDVER";maxch="STRINGIFY(JENKINS_MAX_CH)
+#define BACKEND_QUERY "cmd=realtime;ascii=1;client=%s;name=%s;stassid="FF_CFG_STASSID";staip="IPSTR";version="FF_BUILDVER";maxch="STRINGIFY(JENKINS_MAX_CH)";melodies=%s"
+
+// query parameter for the telemetry record
+#define WIFI_TELEMETRY_PREFIX ";telemetry="
 
 // wifi (network) state data
 typedef struct WIFI_DATA_s
 {
-    char            url[ (2 * sizeof(FF_CFG_BACKENDURL)) + (2 * sizeof(BACKEND_QUERY)) ];
+    char            url[ (2 * sizeof(FF_CFG_BACKENDURL)) + (2 * sizeof(BACKEND_QUERY)) + TONE_CACHE_LIST_SIZE ];
     const char     *host;
     const char     *path;
     const char     *query;
@@ -135,6 +143,7 @@ static bool sWifiWaitConnect(void)
             sWifiData.staIp = ipinfo.ip;
             connected = true;
             PRINT("wifi: online after %.3fs", (double)(osTime() - now) * 1e-3);
+            monBootMilestone(MON_BOOT_ONLINE);
             break;
         }
         osSleep(100);
@@ -261,13 +270,27 @@ static void sWifiBearSslAddEntropy(void)
 // connect to backend
 static bool sWifiConnectBackend(void)
 {
+    // the network stack needs some heap for connecting (use the last probe result, probing is expensive)
+    {
+        const int largest = heapGetLargest();
+        if ( (largest > 0) && (largest < HEAP_LARGEST_MIN) )
+        {
+            WARNING("wifi: heap fragmented (largest block %d, free %u), connecting may fail",
+                largest, sdk_system_get_free_heap_size());
+        }
+    }
+
     // check and decompose backend URL
     {
         strcpy(sWifiData.url, FF_CFG_BACKENDURL);
         const int urlLen = strlen(sWifiData.url);
 
+        // tell the backend which melodies we have, so that it doesn't send them again
+        char melodies[TONE_CACHE_LIST_SIZE];
+        toneCacheList(melodies, sizeof(melodies));
+
         snprintf(&sWifiData.url[urlLen], sizeof(sWifiData.url) - urlLen - 1, "?"BACKEND_QUERY,
-            getSystemId(), sWifiData.staName, IP2STR(&sWifiData.staIp));
+            getSystemId(), sWifiData.staName, IP2STR(&sWifiData.staIp), melodies);
         DEBUG("wifi: backend url=%s", sWifiData.url);
 
         const int res = reqParamsFromUrl(sWifiData.url, sWifiData.url, sizeof(sWifiData.url),
@@ -344,6 +367,23 @@ static bool sWifiConnectBackend(void)
 
     // make HTTP POST request
     {
+        // the crash report (if any) is sent in addition to the query parameters
+        const char *pkCrash = crashUploadParam();
+        const int crashLen = strlen(pkCrash);
+
+        // with SSL we can't send telemetry on the side (see sWifiPostTelemetry()), so send it here
+        static char sTelemetry[sizeof(WIFI_TELEMETRY_PREFIX) + MON_TELEMETRY_SIZE];
+        sTelemetry[0] = '\0';
+        if ( (FF_CFG_TELEMETRYPERIOD > 0) && sWifiData.https )
+        {
+            strcpy(sTelemetry, WIFI_TELEMETRY_PREFIX);
+            if (!monTelemetry(&sTelemetry[sizeof(WIFI_TELEMETRY_PREFIX) - 1], MON_TELEMETRY_SIZE))
+            {
+                sTelemetry[0] = '\0';
+            }
+        }
+        const int telemetryLen = strlen(sTelemetry);
+
         char req[sizeof(sWifiData.url) + 128];
         snprintf(req, sizeof(req),
             "POST /%s HTTP/1.1\r\n"           // HTTP POST request
@@ -356,14 +396,17 @@ static bool sWifiConnectBackend(void)
             sWifiData.path,
             sWifiData.host,
             sWifiData.auth != NULL ? sWifiData.auth : "",
-            strlen(sWifiData.query),
+            strlen(sWifiData.query) + crashLen + telemetryLen,
             sWifiData.query);
-        DEBUG("wifi: request POST /%s: %s", sWifiData.path, sWifiData.query);
+        DEBUG("wifi: request POST /%s: %s (crash %d, telemetry %d)", sWifiData.path, sWifiData.query,
+            crashLen, telemetryLen);
 
 #if (HAVE_CRT)
         if (sWifiData.https)
         {
             if ( (br_sslio_write_all(&sWifiData.bearSslIoCtx, req, strlen(req)) != BR_ERR_OK) ||
+                 ( (crashLen > 0) && (br_sslio_write_all(&sWifiData.bearSslIoCtx, pkCrash, crashLen) != BR_ERR_OK) ) ||
+                 ( (telemetryLen > 0) && (br_sslio_write_all(&sWifiData.bearSslIoCtx, sTelemetry, telemetryLen) != BR_ERR_OK) ) ||
                  (br_sslio_flush(&sWifiData.bearSslIoCtx)                       != BR_ERR_OK) )
             {
                 ERROR("wifi: ssl POST /%s: %s", sWifiData.path,
@@ -377,7 +420,11 @@ static bool sWifiConnectBackend(void)
         else
 #endif
         {
-            const err_t err = netconn_write(sWifiData.conn, req, strlen(req), NETCONN_COPY);
+            err_t err = netconn_write(sWifiData.conn, req, strlen(req), NETCONN_COPY);
+            if ( (err == ERR_OK) && (crashLen > 0) )
+            {
+                err = netconn_write(sWifiData.conn, pkCrash, crashLen, NETCONN_COPY);
+            }
             if (err != ERR_OK)
             {
                 ERROR("wifi: POST /%s: %s", sWifiData.path, lwipErrStr(err));
@@ -491,6 +538,11 @@ static bool sWifiConnectBackend(void)
         }
 
         sWifiData.backendReady = backendConnect(pBody, (int)rxLen - (pBody - (char *)rxBuf));
+        if (sWifiData.backendReady)
+        {
+            monBootMilestone(MON_BOOT_BACKEND);
+            crashUploaded();
+        }
         break;
     }
     if (buf != NULL)
@@ -519,12 +571,128 @@ static bool sWifiConnectBackend(void)
     }
 }
 
+#define WIFI_TELEMETRY_TIMEOUT 2000 // [ms]
+
+// write all data to the (non-blocking) telemetry connection, which may still be connecting, before the timeout
+static err_t sWifiTelemetryWrite(struct netconn *conn, const char *data, const int size, const uint32_t start)
+{
+    int offs = 0;
+    while (offs < size)
+    {
+        size_t written = 0;
+        const err_t err = netconn_write_partly(conn, &data[offs], size - offs, NETCONN_COPY, &written);
+        offs += written;
+        if ( (err == ERR_INPROGRESS) || (err == ERR_WOULDBLOCK) || (err == ERR_ALREADY) ||
+             ((err == ERR_OK) && (offs < size)) )
+        {
+            if ((int32_t)(osTime() - start) >= WIFI_TELEMETRY_TIMEOUT)
+            {
+                return ERR_TIMEOUT;
+            }
+            osSleep(20);
+        }
+        else if (err != ERR_OK)
+        {
+            return err;
+        }
+    }
+    return ERR_OK;
+}
+
+// send telemetry record to the backend in a separate request (only without SSL, as we can't afford
+// a second SSL engine, see sWifiConnectBackend() for that case), this blocks the backend connection
+// for at most WIFI_TELEMETRY_TIMEOUT
+static void sWifiPostTelemetry(void)
+{
+    static char sBody[100 + MON_TELEMETRY_SIZE];
+    const int len = snprintf(sBody, sizeof(sBody), "cmd=telemetry;client=%s"WIFI_TELEMETRY_PREFIX, getSystemId());
+    if (!monTelemetry(&sBody[len], sizeof(sBody) - len))
+    {
+        return;
+    }
+
+    struct netconn *conn = netconn_new(NETCONN_TCP);
+    if (conn == NULL)
+    {
+        WARNING("wifi: telemetry: netconn");
+        return;
+    }
+
+    // non-blocking connect, the writes below wait for the connection (with the timeout)
+    const uint32_t start = osTime();
+    netconn_set_nonblocking(conn, true);
+    netconn_set_recvtimeout(conn, 100);
+    err_t err = netconn_connect(conn, &sWifiData.hostIp, sWifiData.port);
+    if ( (err == ERR_OK) || (err == ERR_INPROGRESS) )
+    {
+        char req[sizeof(sWifiData.url) + 128];
+        snprintf(req, sizeof(req),
+            "POST /%s HTTP/1.1\r\n"
+                "Host: %s\r\n"
+                "Authorization: Basic %s\r\n"
+                "User-Agent: "FF_PROGRAM"/"FF_BUILDVER"\r\n"
+                "Content-Length: %d\r\n"
+                "Connection: close\r\n"
+                "\r\n",
+            sWifiData.path,
+            sWifiData.host,
+            sWifiData.auth != NULL ? sWifiData.auth : "",
+            strlen(sBody));
+        err = sWifiTelemetryWrite(conn, req, strlen(req), start);
+        if (err == ERR_OK)
+        {
+            err = sWifiTelemetryWrite(conn, sBody, strlen(sBody), start);
+        }
+    }
+
+    // wait for the response status line (blocking receive, with the receive timeout)
+    int status = 0;
+    if (err == ERR_OK)
+    {
+        netconn_set_nonblocking(conn, false);
+        while ((int32_t)(osTime() - start) < WIFI_TELEMETRY_TIMEOUT)
+        {
+            struct netbuf *buf = NULL;
+            err = netconn_recv(conn, &buf);
+            if ( (err == ERR_TIMEOUT) || (err == ERR_WOULDBLOCK) )
+            {
+                continue;
+            }
+            if (err == ERR_OK)
+            {
+                void *data;
+                uint16_t dataLen;
+                if ( (netbuf_data(buf, &data, &dataLen) == ERR_OK) && (dataLen > 12) &&
+                     (strncmp((const char *)data, "HTTP/1.1 ", 9) == 0) )
+                {
+                    status = atoi(&((const char *)data)[9]);
+                }
+                netbuf_free(buf);
+                netbuf_delete(buf);
+            }
+            break;
+        }
+    }
+
+    if (status == 200)
+    {
+        DEBUG("wifi: telemetry sent (%d, %ums)", strlen(sBody), osTime() - start);
+    }
+    else
+    {
+        WARNING("wifi: telemetry: %s (status %d, %ums)", lwipErrStr(err), status, osTime() - start);
+    }
+    netconn_close(conn);
+    netconn_delete(conn);
+}
+
 // handle backend connection (wait for more data)
 // return true to force immediate reconnect, false for reconnecting later
 static bool sWifiHandleConnection(void)
 {
     bool res = true;
     bool keepGoing = true;
+    uint32_t lastTelemetry = osTime();
     while (keepGoing)
     {
         // check if backend is okay
@@ -600,6 +768,7 @@ static bool sWifiHandleConnection(void)
             char *respStr = (char *)rxBuf;
             respStr[rxLen] = '\0';
             //DEBUG("wifi: recv [%u] %s", len, respStr);
+            monTrace(MON_TRACE_RX);
             const BACKEND_STATUS_t status = backendHandle(respStr, (int)rxLen);
             switch (status)
             {
@@ -607,6 +776,15 @@ static bool sWifiHandleConnection(void)
                 case BACKEND_STATUS_FAIL:      keepGoing = false; res = false; break;
                 case BACKEND_STATUS_RECONNECT: keepGoing = false; res = true;  break;
             }
+
+            // time to send telemetry? do it right after a message (e.g. the heartbeat) so that we
+            // don't delay the next one
+            if ( (status == BACKEND_STATUS_OKAY) && (FF_CFG_TELEMETRYPERIOD > 0) && !sWifiData.https &&
+                 ((osTime() - lastTelemetry) > (1000 * FF_CFG_TELEMETRYPERIOD)) )
+            {
+                lastTelemetry = osTime();
+                sWifiPostTelemetry();
+            }
         }
 
         if (buf != NULL)
@@ -638,15 +816,49 @@ static bool sWifiIsOnline(void)
     return (status == STATION_GOT_IP) && (ipinfo.ip.addr != 0) ? true : false;
 }
 
+bool wifiIsOnline(void)
+{
+    return sWifiIsOnline();
+}
+
+// set our hostname on the station netif (the DHCP request sends it), returns true if it's set
+static bool sWifiSetHostname(void)
+{
+#if LWIP_NETIF_HOSTNAME
+    // (sdk_wifi_station_set_hostname() doesn't seem to work)
+    struct netif *netif = sdk_system_get_netif(STATION_IF);
+    if (netif == NULL)
+    {
+        return false;
+    }
+    if (netif_get_hostname(netif) != sWifiData.staName)
+    {
+        netif_set_hostname(netif, sWifiData.staName);
+    }
+#endif
+    return true;
+}
+
 static void sWifiTask(void *pArg)
 {
-    // doesn't seem to work in wifiInit() (user_init())
-    //sdk_wifi_station_set_hostname(sWifiData.staName);
 #if LWIP_NETIF_HOSTNAME
+    // the hostname couldn't be set before connecting (in wifiInit()) --> set it now, as long as we
+    // don't have an IP yet the DHCP request will still include it, else we have to reconnect
     struct netif *netif = sdk_system_get_netif(STATION_IF);
-    sdk_wifi_station_disconnect();
-    netif_set_hostname(netif, sWifiData.staName);
-    sdk_wifi_station_connect();
+    if ( (netif != NULL) && (netif_get_hostname(netif) != sWifiData.staName) )
+    {
+        const bool reconnect = sdk_wifi_station_get_connect_status() == STATION_GOT_IP;
+        DEBUG("wifi: late hostname%s", reconnect ? ", reconnecting" : "");
+        if (reconnect)
+        {
+            sdk_wifi_station_disconnect();
+        }
+        sWifiSetHostname();
+        if (reconnect)
+        {
+            sdk_wifi_station_connect();
+        }
+    }
 #endif
 
     WIFI_STATE_t oldState = WIFI_STATE_OFFLINE;
@@ -918,7 +1130,14 @@ void wifiInit(void)
     };
     sdk_wifi_station_set_config(&config);
 
+    // start associating now, this runs in the background while the rest of the system initialises
+    // (the hostname must be set before, so that the ff_wifi task doesn't have to reconnect)
+    if (!sWifiSetHostname())
+    {
+        WARNING("wifi: no station netif yet, hostname set later");
+    }
     sdk_wifi_station_set_auto_connect(true);
+    sdk_wifi_station_connect();
 }
 
 void wifiStart(void)
@@ -23,6 +23,9 @@ void wifiStart(void);
 
 void wifiMonStatus(void);
 
+//! check if we're connected to the wifi and have an IP address
+bool wifiIsOnline(void);
+
 #endif // __WIFI_H__
 //@}
 // eof
@@ -42,6 +42,16 @@ if ($ARGV[0] && ($ARGV[0] =~ m@^(/dev/[^:]+|COM\d)(?::(\d+)|)$@))
         printf(STDERR "ERROR: Failed opening serial port '%s', baudrate %i!\n", $port, $br);
     }
 }
+elsif ($ARGV[0] && ($ARGV[0] =~ m@^udp:(?:([^:]+):|)(\d+)$@))
+{
+    my $host = $1 || '*';
+    my $port = $2;
+    printf("netlog: [%s] [%s]\n", $host, $port) if ($debug);
+    unless ($inputFunc = createHandleNetlog($host, $port))
+    {
+        printf(STDERR "ERROR: Failed binding host '%s', port %i!\n", $host, $port);
+    }
+}
 elsif ($ARGV[0] && ($ARGV[0] =~ m@^([^:]+)(?::(\d+)|)@))
 {
     my $host = $1;
@@ -56,14 +66,35 @@ elsif ($ARGV[0] && ($ARGV[0] =~ m@^([^:]+)(?::(\d+)|)@))
 unless ($inputFunc)
 {
     print(STDERR "\n\n");
-    print(STDERR "Usage: $0 <device>:<baudrate> | <host>:<port>\n");
+    print(STDERR "Usage: $0 <device>:<baudrate> | <host>:<port> | udp:[<host>:]<port> [<strtab>]\n");
+    print(STDERR "\n");
+    print(STDERR "E.g. $0 /dev/ttyUSB0:115200   or   $0 localhost:6454   or   $0 udp:6455\n");
+    print(STDERR "\n");
+    print(STDERR "The udp:<port> form receives the debug output of one or more lamps sent\n");
+    print(STDERR "by the network sink (CONFIG_NETLOGHOST).\n");
     print(STDERR "\n");
-    print(STDERR "E.g. $0 /dev/ttyUSB0:115200   or   $0 localhost:6454\n");
+    print(STDERR "The <strtab> (e.g. build/tschenggins-laempli.strtab) is needed to decode\n");
+    print(STDERR "binary debug messages (CONFIG_LOGBIN = 1).\n");
     print(STDERR "\n\n");
     exit(1);
 }
 
 
+################################################################################
+# load string table for decoding binary debug messages
+
+my $strtab = undef;
+if ($ARGV[1])
+{
+    unless ($strtab = loadStrtab($ARGV[1]))
+    {
+        printf(STDERR "ERROR: Failed loading string table '%s'!\n", $ARGV[1]);
+        exit(1);
+    }
+    printf("string table: [%s] [0x%08x] [%u]\n", $ARGV[1], $strtab->{base}, length($strtab->{data}));
+}
+
+
 ################################################################################
 # handle user abort (C-c) nicely
 
@@ -85,14 +116,22 @@ my %colours =
 # wait for input data, parse it and display it
 
 my $t0 = time();
-my $rxbuf = '';
+my %rxbufs = (); # per source (lamp), the serial port and Art-Net input have only one ('')
 while (!$ABORT)
 {
     # get more input (rx)
-    my $data = $inputFunc->();
+    my ($data, $src, $notice) = $inputFunc->();
+    $src //= '';
+    if ($notice)
+    {
+        # data was lost, drop incomplete message
+        $rxbufs{$src} = '';
+        printf("$colours{ts}%07.3f$colours{_OFF_} %s$colours{WARNING}%s$colours{_OFF_}\n",
+               time() - $t0, $src ne '' ? "$src " : '', $notice);
+    }
     if ($data)
     {
-        $rxbuf .= $data;
+        $rxbufs{$src} .= $data;
         if ($debug)
         {
             printf(STDERR "%05i: got %i bytes: %s\n", $n++, length($data),
@@ -120,48 +159,59 @@ while (!$ABORT)
     #}
 
     # parse rx data and display
-    while (my $msg = parse(\$rxbuf))
+    foreach my $src (sort keys %rxbufs)
     {
-        if ($msg->{_name} eq 'ERROR')
+        while (my $msg = parse(\$rxbufs{$src}, $src))
         {
-            #`bell`;
-            print("\a");
-        }
-        printf("$colours{ts}%07.3f$colours{_OFF_} ", time() - $t0);
-        if ($msg->{_name} eq 'GARBAGE')
-        {
-            my $dump = sprintf("%s[%i]:\n", $msg->{_name}, $msg->{_size});
-            my $raw = $msg->{_raw};
-            for (my $ix = 0; $ix < length($raw); )
+            if ($msg->{_name} eq 'ERROR')
+            {
+                #`bell`;
+                print("\a");
+            }
+            printf("$colours{ts}%07.3f$colours{_OFF_} ", time() - $t0);
+            if ($src ne '')
             {
-                $dump .= sprintf('0x%04x: ', $ix);
-                my $ascii = '';
-                for (my $ix2 = 0; $ix2 < 32; $ix2++)
+                print("$src ");
+            }
+            if (defined $msg->{_devts})
+            {
+                printf("$colours{ts}(%.3f)$colours{_OFF_} ", $msg->{_devts} * 1e-3);
+            }
+            if ($msg->{_name} eq 'GARBAGE')
+            {
+                my $dump = sprintf("%s[%i]:\n", $msg->{_name}, $msg->{_size});
+                my $raw = $msg->{_raw};
+                for (my $ix = 0; $ix < length($raw); )
                 {
-                    my $c = $ix + $ix2 < length($raw) ? substr($raw, $ix + $ix2, 1) : undef;
-                    $ascii .= defined $c ? ($c =~ m{^[[:print:]]+$}x ? $c : '.') : ' ';
-                    $dump .= defined $c ? sprintf('%02x ', unpack('C', $c)) : '   ';
-                    if ( ($ix2 % 4) == 3 )
+                    $dump .= sprintf('0x%04x: ', $ix);
+                    my $ascii = '';
+                    for (my $ix2 = 0; $ix2 < 32; $ix2++)
                     {
-                        $dump .= ' ';
+                        my $c = $ix + $ix2 < length($raw) ? substr($raw, $ix + $ix2, 1) : undef;
+                        $ascii .= defined $c ? ($c =~ m{^[[:print:]]+$}x ? $c : '.') : ' ';
+                        $dump .= defined $c ? sprintf('%02x ', unpack('C', $c)) : '   ';
+                        if ( ($ix2 % 4) == 3 )
+                        {
+                            $dump .= ' ';
+                        }
                     }
+                    $dump .= " $ascii\n";
+                    $ix += 32;
                 }
-                $dump .= " $ascii\n";
-                $ix += 32;
+                print($dump);
+            }
+            elsif (defined $colours{$msg->{_name}})
+            {
+                print($colours{$msg->{_name}} . $msg->{_str} . $colours{_OFF_} . "\n");
+            }
+            elsif ($msg->{_str})
+            {
+                printf("%s[%i]: %s\n", $msg->{_name}, $msg->{_size}, $msg->{_str});
+            }
+            else
+            {
+                printf("%s[%i]\n", $msg->{_name}, $msg->{_size});
             }
-            print($dump);
-        }
-        elsif (defined $colours{$msg->{_name}})
-        {
-            print($colours{$msg->{_name}} . $msg->{_str} . $colours{_OFF_} . "\n");
-        }
-        elsif ($msg->{_str})
-        {
-            printf("%s[%i]: %s\n", $msg->{_name}, $msg->{_size}, $msg->{_str});
-        }
-        else
-        {
-            printf("%s[%i]\n", $msg->{_name}, $msg->{_size});
         }
     }
 }
@@ -172,12 +222,13 @@ while (!$ABORT)
 # { _name => 'some message identifier', _raw => 'raw message data',
 #   _size => size of raw message data, _str => 'stringified message data' }
 
-my $garbage = '';
+my %garbage = (); # per source
 
 
 sub parse
 {
-    my $bufRef = shift;
+    my ($bufRef, $src) = @_;
+    $src //= '';
 
     my $msg = undef;
 
@@ -187,9 +238,24 @@ sub parse
         # parser wants more data
         my $wait = 0;
 
+        # try parse: binary ERROR/WARNING/NOTICE/PRINT/DEBUG message (see src/debug.h)
+        if ($$bufRef =~ m/^\x1e/)
+        {
+            my $len = length($$bufRef) > 1 ? unpack('C', substr($$bufRef, 1, 1)) : undef;
+            if (!defined $len || (length($$bufRef) < ($len + 3)))
+            {
+                $wait = 1;
+            }
+            elsif (unpack('%8C*', substr($$bufRef, 2, $len)) == unpack('C', substr($$bufRef, 2 + $len, 1)))
+            {
+                $msg = decodeLogBin(substr($$bufRef, 2, $len), $src);
+                $msg->{_size} = $len + 3;
+                $msg->{_raw} = substr($$bufRef, 0, $len + 3);
+            }
+        }
         # try parse: ERROR/WARNING/NOTICE/PRINT/DEBUG message
         #if ($$bufRef =~ m/^(\n*([EWNPD]): ([[:print:]]+)\r?\n+)/)
-        if ($$bufRef =~ m/^(\n*([EWNPD]): ([[:print:]\p{Alnum}\t]+)\r?\n+)/)
+        elsif ($$bufRef =~ m/^(\n*([EWNPD]): ([[:print:]\p{Alnum}\t]+)\r?\n+)/)
         {
             my ($raw, $type, $str) = ($1, $2, $3);
             $str =~ s/\r/\\r/g; # ..removing some non-printable stuff
@@ -219,6 +285,7 @@ sub parse
         if (defined $msg)
         {
             # if we have collected garbage, return this first
+            my $garbage = $garbage{$src} // '';
             if ($garbage)
             {
                 my $str = join(' ', map { sprintf('%02x', $_) } unpack('C*', $garbage));
@@ -227,7 +294,7 @@ sub parse
 
                 $msg = { _name => 'GARBAGE', _size => length($garbage), _raw => $garbage,
                          _str => $str };
-                $garbage = '';
+                $garbage{$src} = '';
             }
             else
             {
@@ -251,7 +318,7 @@ sub parse
         {
             my $g = substr($$bufRef, 0, 1);
             #printf(STDERR "DROPPING GARBAGE BYTE 0x%02x [%s]\n", unpack('C', $g), $g);
-            $garbage .= $g;
+            $garbage{$src} .= $g;
             substr($$bufRef, 0, 1, '');
         }
 
@@ -261,6 +328,119 @@ sub parse
 }
 
 
+################################################################################
+# binary debug messages
+
+# load string table, which is the output of "objdump -s -j .rodata <elf>", i.e. lines like:
+#  3ffe8a60 443a2064 65627567 3a20696e 69742062  D: debug: init b
+sub loadStrtab
+{
+    my ($file) = @_;
+    open(my $fh, '<', $file) || return undef;
+    my $strtab = { base => undef, data => '' };
+    while (my $line = <$fh>)
+    {
+        if ($line =~ m{^ ([0-9a-f]{8}) ((?:[0-9a-f]{2,8} ){1,4})})
+        {
+            my ($addr, $hex) = (hex($1), $2);
+            $strtab->{base} //= $addr;
+            $hex =~ s{ }{}g;
+            substr($strtab->{data}, $addr - $strtab->{base}, length($hex) / 2, pack('H*', $hex));
+        }
+    }
+    close($fh);
+    return defined $strtab->{base} ? $strtab : undef;
+}
+
+my %devMs = (); # device time [ms] per source (the records have the time since the previous record)
+my $BASE = 0x3ffe8000; # DEBUG_LOGBIN_BASE
+
+sub decodeLogBin
+{
+    my ($payload, $src) = @_;
+    my $pos = 0;
+    my $varint = sub
+    {
+        my $val = 0;
+        my $shift = 0;
+        while ($pos < length($payload))
+        {
+            my $byte = unpack('C', substr($payload, $pos++, 1));
+            $val |= ($byte & 0x7f) << $shift;
+            $shift += 7;
+            last unless ($byte & 0x80);
+        }
+        return $val;
+    };
+    my $signed = sub { my $val = shift; return $val >= 0x80000000 ? $val - 4294967296 : $val; };
+
+    my $id = $varint->();
+    $devMs{$src} = ($devMs{$src} // 0) + $varint->();
+    my $devMs = $devMs{$src};
+
+    # look up format string
+    my $fmt = undef;
+    if ($strtab)
+    {
+        my $offs = $BASE + $id - $strtab->{base};
+        if ( ($offs >= 0) && ($offs < length($strtab->{data})) )
+        {
+            ($fmt) = unpack('Z*', substr($strtab->{data}, $offs));
+        }
+    }
+    if (!defined $fmt || ($fmt !~ m{^[EWNPD]: }))
+    {
+        return { _name => 'LOGBIN', _str => sprintf('id=0x%x args=%s', $BASE + $id,
+            join(' ', map { sprintf('%02x', $_) } unpack('C*', substr($payload, $pos)))), _devts => $devMs };
+    }
+
+    # format, the conversions must match sDebugLogBinPayload() in src/debug.c
+    $fmt =~ s{%([-+ #0]*)(\*|\d*)(?:\.(\*|\d*))?([lhz]*)([a-zA-Z%])}
+    {
+        my ($flags, $width, $prec, $length, $conv) = ($1, $2, $3, $4, $5);
+        my $res = '%';
+        if ($conv ne '%')
+        {
+            $width = $signed->($varint->()) if ($width eq '*');
+            $prec = $signed->($varint->()) if (defined $prec && ($prec eq '*'));
+            my $spec = '%' . $flags . $width . (defined $prec ? ".$prec" : '');
+            if ($conv eq 's')
+            {
+                my ($str) = unpack('Z*', substr($payload, $pos));
+                $pos += length($str) + 1;
+                $res = sprintf("$spec$conv", $str);
+            }
+            elsif ($conv =~ m{^[eEfgG]$})
+            {
+                my ($val) = unpack('d<', substr($payload, $pos, 8));
+                $pos += 8;
+                $res = sprintf("$spec$conv", $val);
+            }
+            else
+            {
+                my $val = $varint->();
+                if ($length =~ m{ll})
+                {
+                    $val += $varint->() << 32;
+                }
+                elsif ($conv =~ m{^[di]$})
+                {
+                    $val = $signed->($val);
+                }
+                $res = $conv eq 'p' ? sprintf('0x%08x', $val) : sprintf("$spec$conv", $val);
+            }
+        }
+        $res;
+    }ge;
+
+    $fmt =~ s/\r/\\r/g; # ..removing some non-printable stuff
+    $fmt =~ s/\n/\\n/g;
+    $fmt =~ s/\t/\\t/g;
+    my %map = ( E => 'ERROR', W => 'WARNING', N => 'NOTICE', P => 'PRINT', D => 'DEBUG' );
+    return { _name => $map{substr($fmt, 0, 1)}, _str => $fmt, _devts => $devMs };
+}
+
+
 ################################################################################
 # input function for serial port
 
@@ -321,6 +501,43 @@ sub createHandleNet
 }
 
 
+################################################################################
+# input function for the network sink (see src/netlog.h)
+
+sub createHandleNetlog
+{
+    my ($host, $port) = @_;
+
+    my $h = IO::Socket::INET->new( LocalHost => ($host ne '*') ? $host : undef,
+                                   LocalPort => $port, Proto => 'udp', Blocking => 0 ) || return undef;
+    my %seqs = (); # next expected sequence number per lamp
+    return sub
+    {
+        my $msg;
+        if ($h->recv($msg, 2048) && (length($msg) > 20))
+        {
+            my ($magic, $seq, $chipId, $ms, $lost) = unpack('a4VVVV', $msg);
+            return () unless ($magic eq 'TLog');
+            my $src = sprintf('%06x', $chipId);
+            my @notices = ();
+            if (defined $seqs{$src} && ($seq != $seqs{$src}))
+            {
+                push(@notices, $seq < $seqs{$src} ? 'lamp restarted' :
+                     sprintf('%u datagrams lost', $seq - $seqs{$src}));
+            }
+            if ($lost)
+            {
+                push(@notices, sprintf('%u bytes lost on lamp', $lost));
+            }
+            $seqs{$src} = $seq + 1;
+            printf("%s seq=%u ms=%u lost=%u len=%u\n", $src, $seq, $ms, $lost, length($msg) - 20) if ($debug);
+            return (substr($msg, 20), $src, @notices ? sprintf('(%.3f) %s', $ms * 1e-3, join(', ', @notices)) : undef);
+        }
+        return ();
+    };
+}
+
+
 ################################################################################
 1;
 __END__
@@ -0,0 +1 @@
+// LED render simulator stand-in, build options can be given on the command line (e.g. -DFF_CFG_LEDSFPS=50)
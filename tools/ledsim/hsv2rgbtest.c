@@ -0,0 +1,324 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: HSV to RGB conversion test and benchmark
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+
+    This checks hsv2rgbFrame16() against the original 8 bit hsv2rgb() (HSV2RGB_METHOD 2, kept here
+    as the oracle): the 16 bit dim curve must stay within one 8 bit step of the 8 bit curve, and for
+    all HSV values the 16 bit output rounded to 8 bits must stay within #TEST_TOL steps of the 8 bit
+    output (the difference comes from the interpolated curve and the truncating 8 bit arithmetic).
+    It also checks that the conversion cache doesn't change the results, for frames that hit and
+    thrash it. With -b it benchmarks hsv2rgbFrame16() against the 8 bit per-LED conversion.
+
+    Build and run (see the Makefile):
+
+        make -C tools/ledsim test
+        make -C tools/ledsim bench
+*/
+
+#include <time.h>
+#include <getopt.h>
+#include <stdarg.h>
+
+// the firmware code (unity build, so that we can use the dim curve)
+#include "../../src/hsv2rgb.c"
+
+
+/* ***** oracle ********************************************************************************** */
+
+// the original 8 bit conversion (HSV2RGB_METHOD 2), as it was before the 16 bit output
+
+// Saturation/Value lookup table to compensate for the nonlinearity of human
+// vision. Used in the getRGB function on saturation and brightness to make
+// dimming look more natural. Exponential function used to create values below
+// : x from 0 - 255 : y = round(pow( 2.0, x+64/40.0) - 1)
+// From: http://www.kasperkamperman.com/blog/arduino/arduino-programming-hsb-to-rgb/
+static const uint8_t skOldDimCurve[] =
+{
+      0,   1,   1,   2,   2,   2,   2,   2,   2,   3,   3,   3,   3,   3,   3,   3,
+      3,   3,   3,   3,   3,   3,   3,   4,   4,   4,   4,   4,   4,   4,   4,   4,
+      4,   4,   4,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5,   6,   6,   6,
+      6,   6,   6,   6,   6,   7,   7,   7,   7,   7,   7,   7,   8,   8,   8,   8,
+      8,   8,   9,   9,   9,   9,   9,   9,  10,  10,  10,  10,  10,  11,  11,  11,
+     11,  11,  12,  12,  12,  12,  12,  13,  13,  13,  13,  14,  14,  14,  14,  15,
+     15,  15,  16,  16,  16,  16,  17,  17,  17,  18,  18,  18,  19,  19,  19,  20,
+     20,  20,  21,  21,  22,  22,  22,  23,  23,  24,  24,  25,  25,  25,  26,  26,
+     27,  27,  28,  28,  29,  29,  30,  30,  31,  32,  32,  33,  33,  34,  35,  35,
+     36,  36,  37,  38,  38,  39,  40,  40,  41,  42,  43,  43,  44,  45,  46,  47,
+     48,  48,  49,  50,  51,  52,  53,  54,  55,  56,  57,  58,  59,  60,  61,  62,
+     63,  64,  65,  66,  68,  69,  70,  71,  73,  74,  75,  76,  78,  79,  81,  82,
+     83,  85,  86,  88,  90,  91,  93,  94,  96,  98,  99, 101, 103, 105, 107, 109,
+    110, 112, 114, 116, 118, 121, 123, 125, 127, 129, 132, 134, 136, 139, 141, 144,
+    146, 149, 151, 154, 157, 159, 162, 165, 168, 171, 174, 177, 180, 183, 186, 190,
+    193, 196, 200, 203, 207, 211, 214, 218, 222, 226, 230, 234, 238, 242, 248, 255
+};
+
+
+// classic HSV2RGB code à la Wikipedia
+static void sOldHsv2rgb(const uint8_t H, const uint8_t S, const uint8_t V, uint8_t *R, uint8_t *G, uint8_t *B)
+{
+    const uint32_t sat = 255 - skOldDimCurve[255 - S];
+    const uint32_t val = skOldDimCurve[V];
+    const uint32_t s = (6 * (uint32_t)H) >> 8;               // the segment 0..5 (360/60 * [0..255] / 256)
+    const uint32_t t = (6 * (uint32_t)H) & 0xff;             // within the segment 0..255 (360/60 * [0..255] % 256)
+    const uint32_t l = (val * (255 - sat)) >> 8;             // lower level
+    const uint32_t r = (val * sat * t) >> 16;                // ramp
+    switch (s)
+    {
+        case 0: *R = val;        *G = l + r;      *B = l;          break;
+        case 1: *R = val - r;    *G = val;        *B = l;          break;
+        case 2: *R = l;          *G = val;        *B = l + r;      break;
+        case 3: *R = l;          *G = val - r;    *B = val;        break;
+        case 4: *R = l + r;      *G = l;          *B = val;        break;
+        case 5: *R = val;        *G = l;          *B = val - r;    break;
+    }
+}
+
+
+/* ***** test ************************************************************************************ */
+
+#define TEST_FRAME_MAX 256
+#define TEST_TOL       3    // max. difference to the 8 bit conversion [8 bit steps]
+#define TEST_MEAN_MAX  0.5  // max. mean difference to the 8 bit conversion [8 bit steps]
+
+static uint32_t sTestNum;
+static uint32_t sTestFail;
+
+static void sTestFailed(const char *fmt, ...)
+{
+    if (sTestFail < 10)
+    {
+        va_list args;
+        va_start(args, fmt);
+        fputs("hsv2rgbtest: ", stderr);
+        vfprintf(stderr, fmt, args);
+        fputs("\n", stderr);
+        va_end(args);
+    }
+    sTestFail++;
+}
+
+// the 16 bit curve must be monotonic and within one 8 bit step of the 8 bit curve
+static void sTestCurve(void)
+{
+    for (int ix = 0; ix < 256; ix++)
+    {
+        sTestNum++;
+        const int32_t c16 = skMatrixDimCurve16[ix];
+        const int32_t c8  = (int32_t)skOldDimCurve[ix] * 257;
+        if ( (ABS(c16 - c8) >= 257) || ((ix > 0) && (c16 < (int32_t)skMatrixDimCurve16[ix - 1])) )
+        {
+            sTestFailed("curve at %d: %d, 8 bit curve %d", ix, c16, c8);
+        }
+    }
+    if ( (skMatrixDimCurve16[0] != 0) || (skMatrixDimCurve16[255] != 65535) )
+    {
+        sTestFailed("curve ends: %u..%u", skMatrixDimCurve16[0], skMatrixDimCurve16[255]);
+    }
+}
+
+// all HSV values against the 8 bit conversion, one frame per hue and saturation
+static void sTestOracle(void)
+{
+    uint8_t hsv[256][3];
+    uint16_t rgb[256][3];
+    uint32_t hist[TEST_TOL + 2] = { 0 };
+    uint64_t sum = 0;
+    for (int h = 0; h < 256; h++)
+    {
+        for (int s = 0; s < 256; s++)
+        {
+            for (int v = 0; v < 256; v++)
+            {
+                hsv[v][0] = h;
+                hsv[v][1] = s;
+                hsv[v][2] = v;
+            }
+            hsv2rgbFrame16(hsv, rgb, 256);
+            for (int v = 0; v < 256; v++)
+            {
+                uint8_t old[3];
+                sOldHsv2rgb(h, s, v, &old[0], &old[1], &old[2]);
+                sTestNum++;
+                for (int c = 0; c < 3; c++)
+                {
+                    const int32_t d = ABS( (((int32_t)rgb[v][c] + 128) / 257) - (int32_t)old[c] );
+                    sum += d;
+                    hist[ MIN(d, TEST_TOL + 1) ]++;
+                    if (d > TEST_TOL)
+                    {
+                        sTestFailed("hsv %d,%d,%d -> rgb %u,%u,%u, 8 bit %u,%u,%u", h, s, v,
+                            rgb[v][0], rgb[v][1], rgb[v][2], old[0], old[1], old[2]);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    const double mean = (double)sum / (256.0 * 256.0 * 256.0 * 3.0);
+    printf("hsv2rgbtest: difference to 8 bit: 0: %.2f%%, 1: %.2f%%, 2: %.2f%%, 3: %.2f%%, mean %.3f\n",
+        (double)hist[0] * 100.0 / (256.0 * 256.0 * 256.0 * 3.0), (double)hist[1] * 100.0 / (256.0 * 256.0 * 256.0 * 3.0),
+        (double)hist[2] * 100.0 / (256.0 * 256.0 * 256.0 * 3.0), (double)hist[3] * 100.0 / (256.0 * 256.0 * 256.0 * 3.0), mean);
+    if (mean > TEST_MEAN_MAX)
+    {
+        sTestFailed("mean difference to 8 bit %.3f > %.3f", mean, TEST_MEAN_MAX);
+    }
+}
+
+// fill frame with runs of colours from a small palette (like the LEDs of a typical Lämpli)
+static void sTestPaletteFrame(uint8_t (*pHSV)[3], const int num, const int nColours)
+{
+    uint8_t palette[16][3];
+    for (int ix = 0; ix < nColours; ix++)
+    {
+        palette[ix][0] = rand();
+        palette[ix][1] = rand();
+        palette[ix][2] = rand();
+    }
+    int colour = 0;
+    for (int ix = 0; ix < num; ix++)
+    {
+        if ((rand() % 4) == 0)
+        {
+            colour = rand() % nColours;
+        }
+        memcpy(pHSV[ix], palette[colour], sizeof(pHSV[ix]));
+    }
+}
+
+// cache hits and collisions: the frame must give the same as converting each element on its own
+static void sTestCache(void)
+{
+    uint8_t hsv[TEST_FRAME_MAX][3];
+    uint16_t rgb[TEST_FRAME_MAX][3];
+    uint16_t ref[TEST_FRAME_MAX][3];
+    for (int n = 0; n < 100000; n++)
+    {
+        const int num = 1 + (rand() % TEST_FRAME_MAX);
+        sTestPaletteFrame(hsv, num, 1 + (rand() % 16));
+        hsv2rgbFrame16(hsv, rgb, num);
+        for (int ix = 0; ix < num; ix++)
+        {
+            hsv2rgbFrame16(&hsv[ix], &ref[ix], 1);
+            sTestNum++;
+            if (memcmp(rgb[ix], ref[ix], sizeof(rgb[ix])) != 0)
+            {
+                sTestFailed("cache mismatch at %d: hsv %u,%u,%u -> rgb %u,%u,%u, expected %u,%u,%u",
+                    ix, hsv[ix][0], hsv[ix][1], hsv[ix][2], rgb[ix][0], rgb[ix][1], rgb[ix][2],
+                    ref[ix][0], ref[ix][1], ref[ix][2]);
+            }
+        }
+    }
+}
+
+static bool sTest(void)
+{
+    sTestCurve();
+    sTestOracle();
+    sTestCache();
+
+    if (sTestFail > 0)
+    {
+        printf("hsv2rgbtest: FAIL (%u of %u checks failed)\n", sTestFail, sTestNum);
+        return false;
+    }
+    printf("hsv2rgbtest: ok (%u checks)\n", sTestNum);
+    return true;
+}
+
+
+/* ***** benchmark ******************************************************************************* */
+
+#define BENCH_FRAME 64
+#define BENCH_ITER  200000
+
+static double sBenchNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec * 1e-9);
+}
+
+static void sBench(const char *name, const uint8_t (*pkHSV)[3])
+{
+    static uint16_t sRGB[BENCH_FRAME][3];
+    static uint8_t sRGB8[BENCH_FRAME][3];
+    double t0 = sBenchNow();
+    for (int n = 0; n < BENCH_ITER; n++)
+    {
+        hsv2rgbFrame16(pkHSV, sRGB, BENCH_FRAME);
+        __asm__ __volatile__ ("" : : "r" (sRGB) : "memory");
+    }
+    const double dtFrame = sBenchNow() - t0;
+    t0 = sBenchNow();
+    for (int n = 0; n < BENCH_ITER; n++)
+    {
+        for (int ix = 0; ix < BENCH_FRAME; ix++)
+        {
+            sOldHsv2rgb(pkHSV[ix][0], pkHSV[ix][1], pkHSV[ix][2], &sRGB8[ix][0], &sRGB8[ix][1], &sRGB8[ix][2]);
+        }
+        __asm__ __volatile__ ("" : : "r" (sRGB8) : "memory");
+    }
+    const double dtOld = sBenchNow() - t0;
+    const double nConv = (double)BENCH_ITER * (double)BENCH_FRAME;
+    printf("hsv2rgbtest: bench %-8s hsv2rgbFrame16 %6.2fns/LED, 8 bit hsv2rgb %6.2fns/LED (%.2fx)\n",
+        name, dtFrame * 1e9 / nConv, dtOld * 1e9 / nConv, dtOld / dtFrame);
+}
+
+static void sBenchAll(void)
+{
+    uint8_t hsv[BENCH_FRAME][3];
+
+    // all the same colour (e.g. all builds ok)
+    for (int ix = 0; ix < BENCH_FRAME; ix++)
+    {
+        hsv[ix][0] = 85;
+        hsv[ix][1] = 255;
+        hsv[ix][2] = 200;
+    }
+    sBench("uniform", hsv);
+
+    // a few colours
+    sTestPaletteFrame(hsv, BENCH_FRAME, 4);
+    sBench("palette", hsv);
+
+    // all different
+    for (int ix = 0; ix < BENCH_FRAME; ix++)
+    {
+        hsv[ix][0] = rand();
+        hsv[ix][1] = rand();
+        hsv[ix][2] = rand();
+    }
+    sBench("random", hsv);
+}
+
+
+/* ***** main ************************************************************************************ */
+
+int main(int argc, char **argv)
+{
+    bool bench = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "bh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b': bench = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-b]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    srand(1);
+    if (bench)
+    {
+        sBenchAll();
+        return 0;
+    }
+    return sTest() ? 0 : 1;
+}
+
+// eof
@@ -0,0 +1,267 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: Jenkins result snapshot test
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+
+    This checks the snapshot of the job results in jenkins.c on the host: it's encoded and stored
+    in the RTC memory and the flash, bad snapshots (magic, checksum, size) are rejected, and the
+    restored channels are shown as stale (flicker in the result colour) after a reset.
+
+    Build and run (see the Makefile):
+
+        make -C tools/ledsim test
+*/
+
+#include <ctype.h>
+
+// the firmware code (unity build, so that we can reach into the static functions and variables)
+#include "../../src/jenkins.c"
+
+
+/* ***** firmware stand-ins ********************************************************************** */
+
+volatile uint32_t ledsimRtcmem[128];
+
+// (only errors, the expected warnings about the bad snapshots would be noise)
+volatile uint8_t debugLevels[DEBUG_MOD_NUM] = { [0 ... (DEBUG_MOD_NUM - 1)] = DEBUG_LEVEL_ERROR };
+void debugLock(void) { }
+void debugUnlock(void) { }
+void monTrace(const MON_TRACE_t point) { UNUSED(point); }
+void schedTrigger(const SCHED_JOB_t job) { UNUSED(job); }
+uint32_t osGetPosixTime(void) { return 0; }
+CONFIG_MODEL_t configGetModel(void) { return CONFIG_MODEL_STANDARD; }
+CONFIG_NOISE_t configGetNoise(void) { return CONFIG_NOISE_NONE; }
+uint32_t configGetMelSuccess(void) { return 0; }
+uint32_t configGetMelFailure(void) { return 0; }
+bool toneCacheMelody(const uint32_t hash) { UNUSED(hash); return false; }
+void toneBuiltinMelody(const char *name) { UNUSED(name); }
+void toneStop(void) { }
+void statusChewie(void) { }
+void statusHello(void) { }
+
+// the LED states set by jenkins.c
+static LEDS_PARAM_t sTestLeds[JENKINS_MAX_CH];
+
+void ledsSetState(const uint16_t ledIx, const LEDS_PARAM_t *pkParam)
+{
+    if (ledIx < NUMOF(sTestLeds))
+    {
+        sTestLeds[ledIx] = *pkParam;
+    }
+}
+
+void ledsSetStateHello(const LEDS_PARAM_t *pkParamHead, const LEDS_PARAM_t *pkParamBow)
+{
+    UNUSED(pkParamHead); UNUSED(pkParamBow);
+}
+
+
+/* ***** helpers ********************************************************************************* */
+
+static int sTestFail;
+
+#define TEST(_cond, _what) do { if (!(_cond)) { printf("jenkinstest: FAIL: %s (%s, line %d)\n", \
+    _what, STRINGIFY(_cond), __LINE__); sTestFail++; } } while (0)
+
+// a power cycle loses the RTC memory, a reset doesn't
+static void sTestBoot(const bool powerCycle)
+{
+    if (powerCycle)
+    {
+        memset((void *)ledsimRtcmem, 0, sizeof(ledsimRtcmem));
+    }
+    memset(sJenkinsInfo, 0, sizeof(sJenkinsInfo));
+    memset(sJenkinsInfoDirty, 0, sizeof(sJenkinsInfoDirty));
+    memset(&sJenkinsSnapshot, 0, sizeof(sJenkinsSnapshot));
+    memset(&sJenkinsSnapshotFl, 0, sizeof(sJenkinsSnapshotFl));
+    sJenkinsSnapshotDirty = false;
+    sJenkinsSnapshotFlTime = 0;
+    sJenkinsRestored = false;
+    sJenkinsWorstResult = JENKINS_RESULT_UNKNOWN;
+    sJenkinsActiveState = JENKINS_STATE_UNKNOWN;
+    memset(sTestLeds, 0, sizeof(sTestLeds));
+    ledsimTickCount = 0;
+    jenkinsInit();
+    sJenkinsProcess(0);
+}
+
+static void sTestSetInfo(const int chIx, const JENKINS_STATE_t state, const JENKINS_RESULT_t result)
+{
+    JENKINS_INFO_t info;
+    memset(&info, 0, sizeof(info));
+    info.chIx = chIx;
+    info.active = (state != JENKINS_STATE_UNKNOWN) || (result != JENKINS_RESULT_UNKNOWN);
+    info.state = state;
+    info.result = result;
+    strcpy(info.job, "job");
+    strcpy(info.server, "server");
+    jenkinsSetInfo(&info);
+    sJenkinsProcess(0);
+}
+
+static ledsim_sysparam_t *sTestFlash(void)
+{
+    ledsim_sysparam_t *pParam = ledsimSysparamFind(JENKINS_SNAPSHOT_SYSPARAM_KEY, true);
+    if (pParam == NULL)
+    {
+        abort();
+    }
+    return pParam;
+}
+
+static JENKINS_SNAPSHOT_t *sTestRtcmem(void)
+{
+    return (JENKINS_SNAPSHOT_t *)&ledsimRtcmem[JENKINS_SNAPSHOT_RTCMEM_OFFS];
+}
+
+// check that the restored channels are shown as stale, and that the others are not active
+static void sTestCheckStale(const JENKINS_RESULT_t *pkResults, const char *what)
+{
+    for (int ix = 0; ix < JENKINS_MAX_CH; ix++)
+    {
+        const bool active = pkResults[ix] != JENKINS_RESULT_UNKNOWN;
+        const LEDS_PARAM_t *pkExp = sJenkinsLedStateFromJenkins(JENKINS_STATE_UNKNOWN, pkResults[ix]);
+        char str[100];
+        snprintf(str, sizeof(str), "%s: channel %d", what, ix);
+        TEST(sJenkinsInfo[ix].active == active, str);
+        TEST(sJenkinsInfo[ix].state == JENKINS_STATE_UNKNOWN, str);
+        TEST(sJenkinsInfo[ix].result == pkResults[ix], str);
+        if (active)
+        {
+            TEST(memcmp(&sTestLeds[ix], pkExp, sizeof(*pkExp)) == 0, str);
+            TEST(sTestLeds[ix].fx == LEDS_FX_FLICKER, str);
+        }
+    }
+}
+
+
+/* ***** tests *********************************************************************************** */
+
+static void sTestSnapshot(void)
+{
+    // first boot, nothing stored
+    sTestBoot(true);
+    TEST(!sJenkinsSnapshotValid(sTestRtcmem()), "no rtc snapshot at first boot");
+    TEST(sTestFlash()->writes == 0, "no flash snapshot at first boot");
+
+    // encode: active channels are JENKINS_SNAPSHOT_ACTIVE | result, others 0
+    ledsimTickCount = MS2TICKS(1000);
+    sTestSetInfo(0, JENKINS_STATE_IDLE,    JENKINS_RESULT_SUCCESS);
+    sTestSetInfo(3, JENKINS_STATE_RUNNING, JENKINS_RESULT_FAILURE);
+    sTestSetInfo(7, JENKINS_STATE_OFF,     JENKINS_RESULT_UNSTABLE);
+    const JENKINS_SNAPSHOT_t *pkRtc = sTestRtcmem();
+    TEST(pkRtc->magic == JENKINS_SNAPSHOT_MAGIC, "rtc snapshot magic");
+    TEST(pkRtc->checksum == sJenkinsSnapshotChecksum(pkRtc), "rtc snapshot checksum");
+    for (int ix = 0; ix < JENKINS_MAX_CH; ix++)
+    {
+        const uint8_t exp =
+            ix == 0 ? (JENKINS_SNAPSHOT_ACTIVE | JENKINS_RESULT_SUCCESS)  :
+            ix == 3 ? (JENKINS_SNAPSHOT_ACTIVE | JENKINS_RESULT_FAILURE)  :
+            ix == 7 ? (JENKINS_SNAPSHOT_ACTIVE | JENKINS_RESULT_UNSTABLE) : 0;
+        TEST(pkRtc->channels[ix] == exp, "rtc snapshot channel");
+    }
+
+    // flash: written on the first change, then at most every JENKINS_SNAPSHOT_FLASH_INTERVAL
+    TEST(sTestFlash()->writes == 1, "flash snapshot written once");
+    TEST(sTestFlash()->bin && (sTestFlash()->len == sizeof(JENKINS_SNAPSHOT_t)), "flash snapshot format");
+    const JENKINS_RESULT_t resultsFl[JENKINS_MAX_CH] = { [0] = JENKINS_RESULT_SUCCESS };
+    TEST(((const JENKINS_SNAPSHOT_t *)sTestFlash()->val)->channels[3] == 0, "flash snapshot is the first one");
+    ledsimTickCount += MS2TICKS(1000 * JENKINS_SNAPSHOT_FLASH_INTERVAL) + 1;
+    sJenkinsProcess(0);
+    TEST(sTestFlash()->writes == 2, "flash snapshot written after the interval");
+    TEST(memcmp(sTestFlash()->val, pkRtc, sizeof(*pkRtc)) == 0, "flash snapshot is the current one");
+    sJenkinsProcess(0);
+    TEST(sTestFlash()->writes == 2, "flash snapshot not written if unchanged");
+
+    // reset: restore from the RTC memory, shown as stale
+    const JENKINS_RESULT_t results[JENKINS_MAX_CH] =
+    {
+        [0] = JENKINS_RESULT_SUCCESS, [3] = JENKINS_RESULT_FAILURE, [7] = JENKINS_RESULT_UNSTABLE,
+    };
+    sTestBoot(false);
+    sTestCheckStale(results, "reset");
+
+    // power cycle: restore from the flash
+    sTestBoot(true);
+    sTestCheckStale(results, "power cycle");
+
+    // a corrupt RTC snapshot (checksum) is rejected, the flash one is used
+    sTestSetInfo(3, JENKINS_STATE_UNKNOWN, JENKINS_RESULT_UNKNOWN);
+    sTestRtcmem()->channels[7] ^= 0x01;
+    memcpy(sTestFlash()->val, &(JENKINS_SNAPSHOT_t){ .magic = JENKINS_SNAPSHOT_MAGIC, .channels = { [0] = 0x81 } },
+        sizeof(JENKINS_SNAPSHOT_t));
+    ((JENKINS_SNAPSHOT_t *)sTestFlash()->val)->checksum = sJenkinsSnapshotChecksum((JENKINS_SNAPSHOT_t *)sTestFlash()->val);
+    sTestBoot(false);
+    sTestCheckStale(resultsFl, "bad rtc checksum");
+
+    // bad magic, bad checksum, bad size, not binary: nothing is restored
+    const JENKINS_RESULT_t resultsNone[JENKINS_MAX_CH] = { 0 };
+    for (int bad = 0; bad < 4; bad++)
+    {
+        sTestBoot(true);
+        JENKINS_SNAPSHOT_t *pFl = (JENKINS_SNAPSHOT_t *)sTestFlash()->val;
+        memset(pFl, 0, sizeof(*pFl));
+        pFl->magic = JENKINS_SNAPSHOT_MAGIC;
+        pFl->channels[1] = JENKINS_SNAPSHOT_ACTIVE | JENKINS_RESULT_FAILURE;
+        pFl->checksum = sJenkinsSnapshotChecksum(pFl);
+        sTestFlash()->len = sizeof(*pFl);
+        sTestFlash()->bin = true;
+        switch (bad)
+        {
+            case 0: pFl->magic++; break;
+            case 1: pFl->channels[1] = JENKINS_SNAPSHOT_ACTIVE | JENKINS_RESULT_SUCCESS; break;
+            case 2: sTestFlash()->len -= 4; break;
+            case 3: sTestFlash()->bin = false; break;
+        }
+        sTestBoot(true);
+        char str[50];
+        snprintf(str, sizeof(str), "bad flash snapshot %d", bad);
+        sTestCheckStale(resultsNone, str);
+        TEST(!sJenkinsSnapshotValid(&sJenkinsSnapshot), str);
+    }
+
+    // results that don't exist are ignored
+    {
+        JENKINS_SNAPSHOT_t *pFl = (JENKINS_SNAPSHOT_t *)sTestFlash()->val;
+        memset(pFl, 0, sizeof(*pFl));
+        pFl->magic = JENKINS_SNAPSHOT_MAGIC;
+        pFl->channels[1] = JENKINS_SNAPSHOT_ACTIVE | 0x0f;
+        pFl->channels[2] = JENKINS_SNAPSHOT_ACTIVE | JENKINS_RESULT_UNSTABLE;
+        pFl->channels[4] = JENKINS_RESULT_FAILURE; // not active
+        pFl->checksum = sJenkinsSnapshotChecksum(pFl);
+        sTestFlash()->len = sizeof(*pFl);
+        sTestFlash()->bin = true;
+        sTestBoot(true);
+        const JENKINS_RESULT_t resultsIgn[JENKINS_MAX_CH] = { [2] = JENKINS_RESULT_UNSTABLE };
+        sTestCheckStale(resultsIgn, "illegal results");
+    }
+
+    // the backend clearing all channels (e.g. on disconnect) doesn't touch the snapshot
+    {
+        sTestBoot(false);
+        JENKINS_SNAPSHOT_t before = *sTestRtcmem();
+        jenkinsClearAll();
+        sJenkinsProcess(0);
+        TEST(memcmp(&before, sTestRtcmem(), sizeof(before)) == 0, "clear all keeps the snapshot");
+    }
+}
+
+
+/* ***** main ************************************************************************************ */
+
+int main(int argc, char **argv)
+{
+    UNUSED(argc); UNUSED(argv);
+    sTestSnapshot();
+    if (sTestFail > 0)
+    {
+        printf("jenkinstest: FAIL (%d checks failed)\n", sTestFail);
+        return 1;
+    }
+    printf("jenkinstest: ok\n");
+    return 0;
+}
+
+// eof
@@ -0,0 +1,373 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: LED render simulator
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+
+    This runs the firmware's LED render pipeline (leds.c, ledfx.c, hsv2rgb.c) on the host. It plays
+    the tick interrupt, the SPI and I2S peripherals and the render task. It dumps the bytes sent to
+    the LED strips and an image of the frames (one row per frame, one pixel per LED), and it reports
+    the render time per frame.
+
+    Build (from the top-level directory, the options are the same as in config-sample.mk), or use
+    make -C tools/ledsim for the default options:
+
+        gcc -std=gnu99 -O2 -Wall -Wno-format -o ledsim -Itools/ledsim -Isrc -I3rdparty \
+            [-DFF_CFG_LEDSFPS=100] [-DFF_CFG_LEDSI2S=5 -DFF_CFG_LEDSI2SDRIVER=CONFIG_DRIVER_SK9822 \
+            -DFF_CFG_LEDSI2SORDER=CONFIG_ORDER_BGR] tools/ledsim/ledsim.c -lm
+
+    Usage:
+
+        ./ledsim [-d ws2801|sk9822] [-o rgb|rbg|grb|gbr|brg|bgr] [-b low|medium|high|full]
+                 [-t <seconds>] [-p <frames.ppm>] [-w <wire.bin>] [-x <fx base64>] <state> ...
+
+    A <state> is "<ix>[-<ix>]:<hue>,<sat>,<val>,<fx>[,<arg>]" with <fx> still, pulse, flicker, blink
+    or the effect number. For example:
+
+        ./ledsim -t 5 -p frames.ppm -w wire.bin 0-3:0,255,255,pulse 4:85,255,200,blink,50
+
+    The wire dump is a sequence of records: output (1 byte, 0 = SPI, 1 = I2S), length (2 bytes,
+    little endian), data. The output is deterministic (the random generator is seeded with a fixed
+    value), so the dumps of two versions of the code can be compared to check render changes.
+    make -C tools/ledsim golden compares the dumps of a few cases to the golden output in golden/
+    (hex dumps), make -C tools/ledsim golden-update updates it after intended changes.
+*/
+
+#include <time.h>
+#include <getopt.h>
+
+// the firmware code (unity build, so that we can reach into the static functions and variables)
+#include "../../src/leds.c"
+#include "../../src/ledfx.c"
+#include "../../src/hsv2rgb.c"
+#include "../../3rdparty/base64.c"
+
+
+/* ***** firmware stand-ins ********************************************************************** */
+
+static CONFIG_DRIVER_t sLedsimDriver = CONFIG_DRIVER_WS2801;
+static CONFIG_ORDER_t  sLedsimOrder  = CONFIG_ORDER_RGB;
+static CONFIG_BRIGHT_t sLedsimBright = CONFIG_BRIGHT_FULL;
+
+CONFIG_DRIVER_t configGetDriver(void) { return sLedsimDriver; }
+CONFIG_ORDER_t  configGetOrder(void)  { return sLedsimOrder; }
+CONFIG_BRIGHT_t configGetBright(void) { return sLedsimBright; }
+
+volatile uint8_t debugLevels[DEBUG_MOD_NUM] = { [0 ... (DEBUG_MOD_NUM - 1)] = DEBUG_LEVEL_DEBUG };
+void debugLock(void) { }
+void debugUnlock(void) { }
+void monIsrEnter(const MON_ISR_t isr) { }
+void monIsrLeave(const MON_ISR_t isr) { }
+void monTrace(const MON_TRACE_t point) { }
+void monBootMilestone(const MON_BOOT_t milestone) { }
+
+void monHistAdd(MON_HIST_t *pHist, const uint32_t val)
+{
+    const uint32_t ix = val / pHist->base;
+    pHist->bins[ ix < MON_HIST_NUM ? ix : (MON_HIST_NUM - 1) ]++;
+}
+
+void monHistPrint(const char *name, MON_HIST_t *pHist, const char *unit)
+{
+    UNUSED(name); UNUSED(pHist); UNUSED(unit);
+}
+
+
+/* ***** SDK stand-ins *************************************************************************** */
+
+ledsim_spi_regs_t ledsimSpiRegs[2];
+ledsim_dport_regs_t ledsimDportRegs;
+
+static _xt_isr sLedsimSpiIsr;
+static dma_isr_t sLedsimI2sIsr;
+static dma_descriptor_t *sLedsimI2sDesc;
+static bool sLedsimNotified;
+
+void _xt_isr_attach(uint8_t inum, _xt_isr isr, void *arg)
+{
+    UNUSED(arg);
+    if (inum == INUM_SPI)
+    {
+        sLedsimSpiIsr = isr;
+    }
+}
+
+void i2s_dma_init(dma_isr_t isr, void *arg, i2s_clock_div_t div, i2s_pins_t pins)
+{
+    UNUSED(arg); UNUSED(div); UNUSED(pins);
+    sLedsimI2sIsr = isr;
+}
+
+void i2s_dma_start(dma_descriptor_t *pDesc)
+{
+    sLedsimI2sDesc = pDesc;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    UNUSED(task); UNUSED(woken);
+    sLedsimNotified = true;
+}
+
+
+/* ***** peripherals ***************************************************************************** */
+
+static FILE *sLedsimWireFile;
+
+static void sLedsimWireDump(const uint8_t output, const uint8_t *pkData, const int size)
+{
+    if ( (sLedsimWireFile != NULL) && (size > 0) )
+    {
+        const uint8_t head[3] = { output, size & 0xff, (size >> 8) & 0xff };
+        fwrite(head, sizeof(head), 1, sLedsimWireFile);
+        fwrite(pkData, size, 1, sLedsimWireFile);
+    }
+}
+
+// play the SPI: send the W registers and fire the transfer done interrupt, until the driver is done
+static void sLedsimSpiRun(void)
+{
+    uint8_t data[ sizeof(sLedsSpiBufs[0]) ];
+    int size = 0;
+    while ((SPI(LEDS_SPI).CMD & SPI_CMD_USR) != 0)
+    {
+        const int nBytes = (((SPI(LEDS_SPI).USER1 >> SPI_USER1_MOSI_BITLEN_S) & SPI_USER1_MOSI_BITLEN_M) + 1) / 8;
+        if ((size + nBytes) <= (int)sizeof(data))
+        {
+            memcpy(&data[size], (const void *)SPI(LEDS_SPI).W, nBytes);
+            size += nBytes;
+        }
+        CLEAR_MASK_BITS(SPI(LEDS_SPI).CMD, SPI_CMD_USR);
+        SET_MASK_BITS(SPI(LEDS_SPI).SLAVE0, SPI_SLAVE0_TRANS_DONE);
+        DPORT.SPI_INT_STATUS = DPORT_SPI_INT_STATUS_SPI1;
+        if (sLedsimSpiIsr != NULL)
+        {
+            sLedsimSpiIsr(NULL);
+        }
+        DPORT.SPI_INT_STATUS = 0;
+    }
+    sLedsimWireDump(0, data, size);
+}
+
+// play the I2S: send the DMA buffer and fire the end-of-frame interrupt
+static void sLedsimI2sRun(void)
+{
+    if (sLedsimI2sDesc == NULL)
+    {
+        return;
+    }
+    // the words are sent MSB first
+    uint8_t data[4096];
+    const uint32_t *pkWords = sLedsimI2sDesc->buf_ptr;
+    const int size = MIN((int)sLedsimI2sDesc->datalen, (int)sizeof(data));
+    for (int ix = 0; ix < (size / 4); ix++)
+    {
+        const uint32_t word = pkWords[ix];
+        data[ (ix * 4) + 0 ] = (word >> 24) & 0xff;
+        data[ (ix * 4) + 1 ] = (word >> 16) & 0xff;
+        data[ (ix * 4) + 2 ] = (word >>  8) & 0xff;
+        data[ (ix * 4) + 3 ] =  word        & 0xff;
+    }
+    sLedsimWireDump(1, data, size);
+    sLedsimI2sDesc = NULL;
+    if (sLedsimI2sIsr != NULL)
+    {
+        sLedsimI2sIsr(NULL);
+    }
+}
+
+
+/* ***** command line **************************************************************************** */
+
+static int sLedsimLookup(const char *str, const char * const *pkNames, const int num)
+{
+    for (int ix = 0; ix < num; ix++)
+    {
+        if (strcasecmp(str, pkNames[ix]) == 0)
+        {
+            return ix;
+        }
+    }
+    return -1;
+}
+
+static bool sLedsimParseState(const char *str)
+{
+    static const char * const skFxNames[] = { "still", "pulse", "flicker", "blink" };
+    int ix0 = 0, ix1 = -1, hue = 0, sat = 0, val = 0, arg = 0, n = 0;
+    char fxStr[20];
+    if ( (sscanf(str, "%d-%d:%n", &ix0, &ix1, &n) == 2) && (n > 0) )
+    {
+    }
+    else if ( (sscanf(str, "%d:%n", &ix0, &n) == 1) && (n > 0) )
+    {
+        ix1 = ix0;
+    }
+    else
+    {
+        return false;
+    }
+    const int nArgs = sscanf(&str[n], "%d,%d,%d,%19[^,],%d", &hue, &sat, &val, fxStr, &arg);
+    if ( (nArgs < 4) || (ix0 < 0) || (ix1 < ix0) || (ix1 >= LEDS_NUM) )
+    {
+        return false;
+    }
+    int fx = sLedsimLookup(fxStr, skFxNames, NUMOF(skFxNames));
+    if (fx < 0)
+    {
+        char *pEnd;
+        fx = strtol(fxStr, &pEnd, 0);
+        if (*pEnd != '\0')
+        {
+            return false;
+        }
+    }
+    const LEDS_PARAM_t param =
+    {
+        .hue = hue, .sat = sat, .val = val, .fx = (LEDS_FX_t)fx, .arg = arg
+    };
+    for (int ix = ix0; ix <= ix1; ix++)
+    {
+        ledsSetState(ix, &param);
+    }
+    return true;
+}
+
+static void sLedsimUsage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [-d ws2801|sk9822] [-o rgb|rbg|grb|gbr|brg|bgr] [-b low|medium|high|full]\n"
+        "          [-t <seconds>] [-p <frames.ppm>] [-w <wire.bin>] [-x <fx base64>] <state> ...\n"
+        "<state> = <ix>[-<ix>]:<hue>,<sat>,<val>,still|pulse|flicker|blink|<fx>[,<arg>], <ix> = 0..%d\n",
+        prog, LEDS_NUM - 1);
+}
+
+static double sLedsimNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec * 1e-9);
+}
+
+
+/* ***** main ************************************************************************************ */
+
+int main(int argc, char **argv)
+{
+    static const char * const skDriverNames[] = { "unknown", "ws2801", "sk9822" };
+    static const char * const skOrderNames[]  = { "unknown", "rgb", "rbg", "grb", "gbr", "brg", "bgr" };
+    static const char * const skBrightNames[] = { "unknown", "low", "medium", "high", "full" };
+
+    double seconds = 2.0;
+    const char *ppmName = NULL;
+    const char *wireName = NULL;
+    const char *fxBase64 = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:o:b:t:p:w:x:h")) != -1)
+    {
+        int ix = 0;
+        switch (opt)
+        {
+            case 'd': ix = sLedsimLookup(optarg, skDriverNames, NUMOF(skDriverNames)); sLedsimDriver = ix; break;
+            case 'o': ix = sLedsimLookup(optarg, skOrderNames,  NUMOF(skOrderNames));  sLedsimOrder  = ix; break;
+            case 'b': ix = sLedsimLookup(optarg, skBrightNames, NUMOF(skBrightNames)); sLedsimBright = ix; break;
+            case 't': seconds = atof(optarg); break;
+            case 'p': ppmName = optarg; break;
+            case 'w': wireName = optarg; break;
+            case 'x': fxBase64 = optarg; break;
+            default:  ix = -1; break;
+        }
+        if (ix < 0)
+        {
+            sLedsimUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    srand(1);
+    ledsInit();
+    ledsStart();
+    if ( (fxBase64 != NULL) && !ledfxLoad(fxBase64) )
+    {
+        fprintf(stderr, "bad effect programs\n");
+        return 1;
+    }
+    for (int ix = optind; ix < argc; ix++)
+    {
+        if (!sLedsimParseState(argv[ix]))
+        {
+            fprintf(stderr, "bad state: %s\n", argv[ix]);
+            sLedsimUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // the frames sent during ledsInit() are not dumped
+    sLedsimSpiRun();
+    sLedsimI2sRun();
+    FILE *pPpmFile = ppmName != NULL ? fopen(ppmName, "wb") : NULL;
+    sLedsimWireFile = wireName != NULL ? fopen(wireName, "wb") : NULL;
+    if ( ((ppmName != NULL) && (pPpmFile == NULL)) || ((wireName != NULL) && (sLedsimWireFile == NULL)) )
+    {
+        fprintf(stderr, "cannot open output file\n");
+        return 1;
+    }
+
+    const int nFrames = MAX(1, (int)(seconds * 1000.0 / LEDS_FRAME_MS));
+    if (pPpmFile != NULL)
+    {
+        fprintf(pPpmFile, "P6\n%d %d\n255\n", LEDS_NUM, nFrames);
+    }
+
+    double tMin = 1e9, tMax = 0.0, tSum = 0.0;
+    int nRendered = 0;
+    for (int frame = 0; frame < nFrames; frame++)
+    {
+        // tick interrupts, the last one flips the buffers and starts the transfers
+        for (int tick = 0; tick < LEDS_FRAME_TICKS; tick++)
+        {
+            ledsTick();
+        }
+        sLedsimSpiRun();
+        sLedsimI2sRun();
+
+        // render task
+        if (sLedsimNotified)
+        {
+            sLedsimNotified = false;
+            const double t0 = sLedsimNow();
+            sLedsRenderFrame();
+            const double dt = sLedsimNow() - t0;
+            tMin = MIN(tMin, dt);
+            tMax = MAX(tMax, dt);
+            tSum += dt;
+            nRendered++;
+        }
+
+        if (pPpmFile != NULL)
+        {
+            fwrite(sLedsData, sizeof(sLedsData), 1, pPpmFile);
+        }
+    }
+
+    if (pPpmFile != NULL)
+    {
+        fclose(pPpmFile);
+    }
+    if (sLedsimWireFile != NULL)
+    {
+        fclose(sLedsimWireFile);
+    }
+
+    printf("ledsim: %d LEDs (%d on I2S), %dfps (%dms), %d frames, late %u, overrun %u\n",
+        LEDS_NUM, LEDS_I2S_NUM, LEDS_FPS, LEDS_FRAME_MS, nFrames, svLedsFrameLate, svLedsFrameOverrun);
+    if (nRendered > 0)
+    {
+        printf("ledsim: render time per frame: min %.2fus, avg %.2fus, max %.2fus\n",
+            tMin * 1e6, (tSum / nRendered) * 1e6, tMax * 1e6);
+    }
+    return 0;
+}
+
+// eof
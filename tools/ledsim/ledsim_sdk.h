@@ -0,0 +1,201 @@
+/*!
+    \file
+    \brief flipflip's Tschenggins Lämpli: LED render simulator, SDK and OS stand-ins (see ledsim.c)
+
+    - Copyright (c) 2018 Philippe Kehl (flipflip at oinkzwurgl dot org),
+      https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+
+    Just enough of the esp-open-rtos SDK and FreeRTOS API to compile the LED render pipeline (and
+    the modules tested on the host) on the host. There's only one thread, so locks and critical
+    sections do nothing, and the hardware registers are plain memory. The interrupt and DMA hooks
+    are implemented in ledsim.c, which plays the SPI and I2S peripherals.
+*/
+#ifndef __LEDSIM_SDK_H__
+#define __LEDSIM_SDK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define IRAM
+#define IROM const
+#define BIT(x) (1UL << (x))
+
+// ***** FreeRTOS *****
+
+typedef uint32_t TickType_t;
+typedef uint32_t StackType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef struct { int dummy; } StaticTask_t;
+typedef struct { int dummy; } StaticSemaphore_t;
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define configTICK_RATE_HZ  100
+#define configUSE_TICK_HOOK 1
+#define portTICK_PERIOD_MS  (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY       0xffffffff
+#define pdTRUE              1
+#define pdFALSE             0
+#define portYIELD_FROM_ISR(x) (void)(x)
+#define taskENTER_CRITICAL() do { } while (0)
+#define taskEXIT_CRITICAL()  do { } while (0)
+
+static TickType_t ledsimTickCount; // the OS time, only advanced by the tests
+static inline void vTaskDelay(TickType_t ticks) { (void)ticks; }
+static inline TickType_t xTaskGetTickCount(void) { return ledsimTickCount; }
+static inline TaskHandle_t xTaskCreateStatic(TaskFunction_t func, const char *name, uint32_t depth,
+    void *arg, UBaseType_t prio, StackType_t *stack, StaticTask_t *tcb)
+{ (void)func; (void)name; (void)depth; (void)arg; (void)prio; (void)stack; return tcb; }
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken); // ledsim.c
+static inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) { (void)clear; (void)ticks; return 1; }
+static inline SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *pSem) { return pSem; }
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) { (void)sem; (void)ticks; return pdTRUE; }
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) { (void)sem; return pdTRUE; }
+
+// (never blocks, the receiver must run after the sender)
+typedef struct { uint8_t *buf; uint32_t itemSize; uint32_t len; uint32_t head; uint32_t count; } StaticQueue_t;
+typedef StaticQueue_t *QueueHandle_t;
+static inline QueueHandle_t xQueueCreateStatic(uint32_t len, uint32_t itemSize, uint8_t *buf, StaticQueue_t *pQueue)
+{ pQueue->buf = buf; pQueue->itemSize = itemSize; pQueue->len = len; pQueue->head = 0; pQueue->count = 0; return pQueue; }
+static inline BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    (void)ticks;
+    if (q->count >= q->len) { return pdFALSE; }
+    memcpy(&q->buf[ ((q->head + q->count) % q->len) * q->itemSize ], item, q->itemSize);
+    q->count++;
+    return pdTRUE;
+}
+static inline BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    (void)ticks;
+    if (q->count == 0) { return pdFALSE; }
+    memcpy(item, &q->buf[ q->head * q->itemSize ], q->itemSize);
+    q->head = (q->head + 1) % q->len;
+    q->count--;
+    return pdTRUE;
+}
+
+// ***** SDK *****
+
+static inline uint8_t sdk_system_get_cpu_freq(void) { return 80; }
+typedef int AUTH_MODE;
+enum sdk_dhcp_status { DHCP_STOPPED, DHCP_STARTED };
+enum sdk_phy_mode { PHY_MODE_11B = 1, PHY_MODE_11G, PHY_MODE_11N };
+enum sdk_sleep_type { WIFI_SLEEP_NONE, WIFI_SLEEP_LIGHT, WIFI_SLEEP_MODEM };
+
+// ***** interrupts *****
+
+#define INUM_SPI 2
+typedef void (*_xt_isr)(void *);
+static inline void _xt_isr_mask(uint32_t mask) { (void)mask; }
+static inline void _xt_isr_unmask(uint32_t mask) { (void)mask; }
+void _xt_isr_attach(uint8_t inum, _xt_isr isr, void *arg); // ledsim.c
+
+// ***** SPI *****
+
+typedef struct { volatile uint32_t CMD, USER0, USER1, SLAVE0, W[16]; } ledsim_spi_regs_t;
+extern ledsim_spi_regs_t ledsimSpiRegs[2];
+#define SPI(n) (ledsimSpiRegs[n])
+typedef struct { volatile uint32_t SPI_INT_STATUS; } ledsim_dport_regs_t;
+extern ledsim_dport_regs_t ledsimDportRegs;
+#define DPORT ledsimDportRegs
+
+#define SPI_SLAVE0_TRANS_DONE     BIT(4)
+#define SPI_SLAVE0_WR_STA_DONE    BIT(3)
+#define SPI_SLAVE0_RD_STA_DONE    BIT(2)
+#define SPI_SLAVE0_WR_BUF_DONE    BIT(1)
+#define SPI_SLAVE0_RD_BUF_DONE    BIT(0)
+#define SPI_SLAVE0_TRANS_DONE_EN  BIT(9)
+#define SPI_SLAVE0_WR_STA_DONE_EN BIT(8)
+#define SPI_SLAVE0_RD_STA_DONE_EN BIT(7)
+#define SPI_SLAVE0_WR_BUF_DONE_EN BIT(6)
+#define SPI_SLAVE0_RD_BUF_DONE_EN BIT(5)
+#define SPI_USER0_COMMAND         BIT(31)
+#define SPI_USER0_ADDR            BIT(30)
+#define SPI_USER0_DUMMY           BIT(29)
+#define SPI_USER0_MISO            BIT(28)
+#define SPI_USER0_MOSI            BIT(27)
+#define SPI_CMD_USR               BIT(18)
+#define SPI_USER1_MOSI_BITLEN_M   0x000001ff
+#define SPI_USER1_MOSI_BITLEN_S   17
+#define DPORT_SPI_INT_STATUS_SPI1 BIT(1)
+#define VAL2FIELD_M(f, v)         (((v) & f##_M) << f##_S)
+#define SET_MASK_BITS(r, m)       ((r) |= (m))
+#define CLEAR_MASK_BITS(r, m)     ((r) &= ~(m))
+
+typedef enum { SPI_MODE0 } spi_mode_t;
+typedef enum { SPI_LITTLE_ENDIAN, SPI_BIG_ENDIAN } spi_endianness_t;
+#define SPI_FREQ_DIV_2M 40
+typedef struct { spi_mode_t mode; uint32_t freq_divider; bool msb; spi_endianness_t endianness; bool minimal_pins; } spi_settings_t;
+static inline void spi_set_settings(uint8_t bus, const spi_settings_t *s) { (void)bus; (void)s; }
+
+// ***** I2S *****
+
+typedef struct dma_descriptor
+{
+    uint32_t blocksize:12;
+    uint32_t datalen:12;
+    uint32_t unused:5;
+    uint32_t sub_sof:1;
+    uint32_t eof:1;
+    volatile uint32_t owner:1;
+    void *buf_ptr;
+    struct dma_descriptor *next_link_ptr;
+} dma_descriptor_t;
+typedef struct { uint8_t bclk_div; uint8_t clkm_div; } i2s_clock_div_t;
+typedef struct { bool data; bool clock; bool ws; } i2s_pins_t;
+typedef void (*dma_isr_t)(void *);
+void i2s_dma_init(dma_isr_t isr, void *arg, i2s_clock_div_t div, i2s_pins_t pins); // ledsim.c
+void i2s_dma_start(dma_descriptor_t *pDesc); // ledsim.c
+static inline void i2s_dma_stop(void) { }
+static inline i2s_clock_div_t i2s_get_clock_div(int32_t freq) { (void)freq; i2s_clock_div_t div = { 0, 0 }; return div; }
+static inline bool i2s_dma_is_eof_interrupt(void) { return true; }
+static inline void i2s_dma_clear_interrupt(void) { }
+
+// ***** RTC memory *****
+
+extern volatile uint32_t ledsimRtcmem[128]; // the test that uses it
+#define RTCMEM_FREE ledsimRtcmem
+
+// ***** sysparam (in memory, a few small values) *****
+
+typedef enum { SYSPARAM_OK = 0, SYSPARAM_NOTFOUND = 1, SYSPARAM_ERR_NOMEM = -3 } sysparam_status_t;
+typedef struct { char key[16]; uint8_t val[1024]; size_t len; bool bin; uint32_t writes; } ledsim_sysparam_t;
+static ledsim_sysparam_t ledsimSysparam[4];
+static inline ledsim_sysparam_t *ledsimSysparamFind(const char *key, const bool create)
+{
+    for (int ix = 0; ix < (int)(sizeof(ledsimSysparam) / sizeof(*ledsimSysparam)); ix++)
+    {
+        ledsim_sysparam_t *pParam = &ledsimSysparam[ix];
+        if (strcmp(pParam->key, key) == 0) { return pParam; }
+        if (create && (pParam->key[0] == '\0')) { strncpy(pParam->key, key, sizeof(pParam->key) - 1); return pParam; }
+    }
+    return NULL;
+}
+static inline sysparam_status_t sysparam_get_data_static(const char *key, uint8_t *buf, size_t size, size_t *pLen, bool *pBin)
+{
+    const ledsim_sysparam_t *pkParam = ledsimSysparamFind(key, false);
+    if ((pkParam == NULL) || (pkParam->len == 0)) { return SYSPARAM_NOTFOUND; }
+    if (pkParam->len > size) { return SYSPARAM_ERR_NOMEM; }
+    memcpy(buf, pkParam->val, pkParam->len);
+    if (pLen != NULL) { *pLen = pkParam->len; }
+    if (pBin != NULL) { *pBin = pkParam->bin; }
+    return SYSPARAM_OK;
+}
+static inline sysparam_status_t sysparam_set_data(const char *key, const uint8_t *val, size_t len, bool bin)
+{
+    ledsim_sysparam_t *pParam = ledsimSysparamFind(key, true);
+    if ((pParam == NULL) || (len > sizeof(pParam->val))) { return SYSPARAM_ERR_NOMEM; }
+    memcpy(pParam->val, val, len);
+    pParam->len = len;
+    pParam->bin = bin;
+    pParam->writes++;
+    return SYSPARAM_OK;
+}
+
+#endif // __LEDSIM_SDK_H__
+// eof
@@ -0,0 +1,2 @@
+// LED render simulator stand-in, see ledsim_sdk.h
+#include "ledsim_sdk.h"
@@ -0,0 +1,96 @@
+#!/usr/bin/perl
+################################################################################
+#
+# Copyright (c) 2018 Philippe Kehl <flipflip at oinkzwurgl dot org>
+# https://oinkzwurgl.org/projaeggd/tschenggins-laempli
+#
+# Compiles the builtin RTTTL melodies (the skRtttlMelodyNN strings in
+# 3rdparty/rtttl.c) into note tables for src/tone.c. The notes are expanded
+# into timer units by the TONE_NOTE_WORDS() macro at compile time, so that
+# playing a builtin melody needs no parsing and no memory allocation.
+#
+# usage: rtttl.pl 3rdparty/rtttl.c > rtttl_gen.h
+#
+# This parses the melodies exactly like rtttlMelody() in 3rdparty/rtttl.c does
+# (including the integer arithmetic).
+#
+################################################################################
+
+use strict;
+use warnings;
+
+my $file = shift(@ARGV) or die("usage: $0 <rtttl.c>\n");
+open(my $fh, '<', $file) or die("$file: $!\n");
+
+# the melodies, in order of appearance in the source
+my @melodies = ();
+while (my $line = <$fh>)
+{
+    if ($line =~ m{^\s*const\s+char\s+(skRtttlMelody\d+)\[\]\s*=\s*"([^"]+)"\s*;})
+    {
+        push(@melodies, { var => $1, rtttl => $2 });
+    }
+}
+close($fh);
+die("$file: no melodies found\n") unless (@melodies);
+
+# same as notes[] in rtttlMelody(), index is (scale - 4) * 12 + note
+my @notes = ('', map { my $o = $_; map { "RTTTL_NOTE_$_$o" } qw(C CS D DS E F FS G GS A AS B) } (4 .. 7));
+my %noteIx = ( c => 1, d => 3, e => 5, f => 6, g => 8, a => 10, b => 12 );
+
+my @out = ();
+push(@out, "// generated by tools/rtttl.pl from $file, do not edit",
+           '#ifndef __RTTTL_GEN_H__', '#define __RTTTL_GEN_H__', '');
+
+my @builtins = ();
+foreach my $melody (@melodies)
+{
+    my ($name, $control, $commands) = split(/:/, $melody->{rtttl}, 3);
+    die("$melody->{var}: bad format\n") unless (defined $commands);
+
+    # control section defaults
+    my ($defDur, $defOct, $bpm) = (4, 6, 63);
+    foreach my $pair (split(/,/, $control))
+    {
+        if    ($pair =~ m{^d=(\d+)$}) { $defDur = $1 if ($1 > 0); }
+        elsif ($pair =~ m{^o=(\d)$})  { $defOct = $1 if ( ($1 >= 3) && ($1 <= 7) ); }
+        elsif ($pair =~ m{^b=(\d+)$}) { $bpm = $1; }
+    }
+    my $wholenote = int(60 * 1000 / $bpm) * 4;
+
+    my @words = ();
+    foreach my $cmd (split(/,/, $commands))
+    {
+        $cmd =~ m{^(\d*)([a-gp])(#?)(\.?)(\d?)$} or die("$melody->{var}: bad note '$cmd'\n");
+        my ($num, $note, $sharp, $dot, $scale) = ($1, $2, $3, $4, $5);
+        my $duration = int($wholenote / ($num ? $num : $defDur));
+        $duration += int($duration / 2) if ($dot);
+        if ($note eq 'p')
+        {
+            push(@words, "TONE_NOTE_WORDS(TONE_PAUSE, $duration)");
+        }
+        else
+        {
+            my $ix = ((($scale ne '' ? $scale : $defOct) - 4) * 12) + $noteIx{$note} + ($sharp ? 1 : 0);
+            die("$melody->{var}: note '$cmd' out of range\n") unless ( ($ix > 0) && ($ix <= $#notes) );
+            push(@words, "TONE_NOTE_WORDS($notes[$ix], $duration)");
+        }
+    }
+    push(@words, 'TONE_NOTE_END_WORDS');
+
+    my $var = $melody->{var};
+    $var =~ s{^skRtttl}{skRtttlGen};
+    push(@out, "// $name", "static IROM uint32_t $var\[\] =", '{');
+    while (my @line = splice(@words, 0, 4))
+    {
+        push(@out, '    ' . join(', ', @line) . ',');
+    }
+    push(@out, '};', '');
+    push(@builtins, "    { .name = \"$name\", .pkNotes = $var },");
+}
+
+push(@out, 'static IROM TONE_BUILTIN_t skToneBuiltins[] =', '{', @builtins, '};', '',
+           '#endif // __RTTTL_GEN_H__');
+print(join("\n", @out), "\n");
+
+# eof
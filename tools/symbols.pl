@@ -5,6 +5,20 @@
 #
 # Usage: objdump -t img.elf | ramsyms
 #
+# Or decode and symbolise a crash record (see src/crash.h):
+#
+# Usage: objdump -t img.elf | symbols.pl crash <record>
+#
+# The <record> is the base64url encoded record or a file with records as
+# returned by the backend (cmd=crashes). The img.elf must be the one of the
+# firmware version that crashed.
+#
+# Or report the dRAM, iRAM and iROM (flash) usage per module and check the
+# budget, i.e. the minimum free space in each region of the image (exits with
+# an error if the budget is exceeded):
+#
+# Usage: size -A img.elf foo.o bar.o ... | symbols.pl budget <dRAM> <iRAM> <iROM>
+#
 # Copyright (c) 2017 Philippe Kehl <flipflip at oinkzwurgl dot org>
 # https://oinkzwurgl.org/projaeggd/tschenggins-laempli
 #
@@ -12,8 +26,22 @@
 
 use strict;
 use warnings;
+use MIME::Base64;
+
+if ( ($#ARGV == 1) && ($ARGV[0] eq 'crash') )
+{
+    crash($ARGV[1]);
+    exit(0);
+}
 
-die("Usage: objdump -t foo.elf | $0 <regName> <regStart> <regSize>") unless ($#ARGV == 2);
+if ( ($#ARGV == 3) && ($ARGV[0] eq 'budget') )
+{
+    exit(budget(@ARGV[1..3]) ? 0 : 1);
+}
+
+die("Usage: objdump -t foo.elf | $0 <regName> <regStart> <regSize>\n" .
+    "       objdump -t foo.elf | $0 crash <record>\n" .
+    "       size -A foo.elf foo.o ... | $0 budget <dRAM> <iRAM> <iROM>\n") unless ($#ARGV == 2);
 
 my $regName  = $ARGV[0];
 my $regStart = 1 * ($ARGV[1] =~ m{^0x|h$} ? hex($ARGV[1]) : $ARGV[1]);
@@ -101,6 +129,191 @@ foreach my $s (sort { $sections{$a} <=> $sections{$b} } keys %sections)
 printf("\n\ntotal %s (0x%08x+0x%05x) usage: %6u/%6u (%.1f%%) %6u bytes free\n",
        $regName, $regStart, $regSize, $totSize, $regSize, $totSize / $regSize * 1e2, $regSize - $totSize);
 
+################################################################################
+# decode and symbolise crash records (see src/crash.h)
+
+sub crash
+{
+    my ($arg) = @_;
+
+    # function symbols
+    my @funcs = ();
+    while (<STDIN>)
+    {
+        if (m/^([0-9a-fA-F]+)\s.*\sF\s+(\S+)\s+([0-9a-fA-F]+)\s+(\S+)/)
+        {
+            push(@funcs, { addr => hex($1), size => hex($3), sym => $4 });
+        }
+    }
+    @funcs = sort { $a->{addr} <=> $b->{addr} } @funcs;
+    my $sym = sub
+    {
+        my ($addr) = @_;
+        foreach my $f (@funcs)
+        {
+            if ( ($addr >= $f->{addr}) && ($addr < ($f->{addr} + ($f->{size} || 1))) )
+            {
+                return sprintf('%s+0x%x', $f->{sym}, $addr - $f->{addr});
+            }
+        }
+        return '?';
+    };
+
+    # records, "<ts> <version> <record>" lines or just the record
+    my @lines = ();
+    if (-f $arg)
+    {
+        open(my $fh, '<', $arg) or die("$arg: $!\n");
+        @lines = grep { m/\S/ && !m/^#/ } <$fh>;
+        close($fh);
+    }
+    else
+    {
+        @lines = ($arg);
+    }
+
+    my @types = ('none', 'exception', 'exception (reset info)', 'watchdog (reset info)');
+    my %causes =
+    (
+         0 => 'IllegalInstruction',     1 => 'Syscall',               2 => 'InstructionFetchError',
+         3 => 'LoadStoreError',         4 => 'Level1Interrupt',       5 => 'Alloca',
+         6 => 'IntegerDivideByZero',    8 => 'Privileged',            9 => 'LoadStoreAlignment',
+        12 => 'InstrPIFDataError',     13 => 'LoadStorePIFDataError',14 => 'InstrPIFAddrError',
+        15 => 'LoadStorePIFAddrError', 16 => 'InstTLBMiss',          17 => 'InstTLBMultiHit',
+        18 => 'InstFetchPrivilege',    20 => 'InstFetchProhibited',  24 => 'LoadStoreTLBMiss',
+        25 => 'LoadStoreTLBMultiHit',  26 => 'LoadStorePrivilege',   28 => 'LoadProhibited',
+        29 => 'StoreProhibited',
+    );
+
+    foreach my $line (@lines)
+    {
+        $line =~ s/\s+$//;
+        my ($ts, $version, $b64) = $line =~ m/^(?:(\d+)\s+(\S+)\s+)?([A-Za-z0-9_-]+)$/;
+        unless ($b64)
+        {
+            print("bad record: $line\n");
+            next;
+        }
+        $b64 =~ tr{-_}{+/};
+        $b64 .= '=' x ((4 - (length($b64) % 4)) % 4);
+        my $raw = MIME::Base64::decode_base64($b64);
+        my ($magic, $checksum, $ver, $type, $cause, $logLen, $epc1, $excvaddr, $depc, $uptime, $task, @rest) =
+            unpack('VVCCCCVVVVZ12V24Z40Z40a160', $raw);
+        my @stack = grep { $_ } @rest[0..23];
+        my @backend = grep { $_ ne '' } @rest[24..25];
+        my $log = substr($rest[26] // '', 0, $logLen // 0);
+
+        my $sum = 0;
+        $sum = ($sum + $_) % 4294967296 for (unpack('V*', substr($raw, 8)));
+        if ( (length($raw) != 376) || ($magic != 0x68736172) || ($sum != $checksum) || ($ver != 1) )
+        {
+            print("bad record: $line\n");
+            next;
+        }
+
+        print("***** crash record *****\n");
+        printf("time:     %s\n", scalar(localtime($ts))) if ($ts);
+        printf("version:  %s\n", $version) if ($version);
+        printf("type:     %s\n", $types[$type] // $type);
+        printf("cause:    %u (%s)\n", $cause, $causes{$cause} // '?');
+        printf("epc1:     0x%08x %s\n", $epc1, $sym->($epc1));
+        printf("excvaddr: 0x%08x\n", $excvaddr);
+        printf("depc:     0x%08x %s\n", $depc, $depc ? $sym->($depc) : '');
+        printf("task:     %s\n", $task) if ($task ne '');
+        printf("uptime:   %.3fs\n", $uptime * 1e-3) if ($uptime);
+        print("stack:\n") if (@stack);
+        printf("  0x%08x %s\n", $_, $sym->($_)) for (@stack);
+        print("backend:\n") if (@backend);
+        print("  $_\n") for (@backend);
+        if ($log ne '')
+        {
+            $log =~ s/[^[:print:]\n]/./g; # binary log records (CONFIG_LOGBIN) are not decoded
+            print("log:\n");
+            print("  $_\n") for (split(/\n/, $log));
+        }
+        print("\n");
+    }
+}
+
+
+################################################################################
+# usage per module and budget check
+
+sub budget
+{
+    my @minFree = @_;
+    my @regions =
+    (
+        { name => 'dRAM', start => 0x3ffe8000, size => 0x14000 },
+        { name => 'iRAM', start => 0x40100000, size => 0x8000 },
+        { name => 'iROM', start => 0x40200000, size => 0x5c000 },
+    );
+
+    # "size -A" output, the image has the sections at their final addresses, the objects at 0
+    my %modules = ();
+    my @order = ();
+    my $file = undef;
+    while (<STDIN>)
+    {
+        if (m/^(\S+)\s+:\s*$/)
+        {
+            $file = $1;
+            push(@order, $file);
+            $modules{$file} = [ 0, 0, 0 ];
+        }
+        elsif ($file && m/^(\.\S+)\s+(\d+)\s+(\d+)\s*$/)
+        {
+            my ($sec, $size, $addr) = ($1, $2, $3);
+            my $ix;
+            if ($addr)
+            {
+                for (my $rix = 0; $rix <= $#regions; $rix++)
+                {
+                    if ( ($addr >= $regions[$rix]->{start}) && ($addr < ($regions[$rix]->{start} + $regions[$rix]->{size})) )
+                    {
+                        $ix = $rix;
+                    }
+                }
+            }
+            # (code that isn't explicitly placed in the iRAM goes to the flash)
+            elsif ($sec =~ m/^\.(data|rodata|bss|sdata|sbss)/)  { $ix = 0; }
+            elsif ($sec =~ m/^\.iram/)                           { $ix = 1; }
+            elsif ($sec =~ m/^\.(text|literal|irom)/)            { $ix = 2; }
+            $modules{$file}->[$ix] += $size if (defined $ix);
+        }
+    }
+    die("no input (size -A output)\n") unless (@order);
+
+    my $image = shift(@order);
+    print("***** usage by module (objects, before unused sections are dropped) *****\n");
+    printf("%-24s %7s %7s %7s\n", 'module', map { $_->{name} } @regions);
+    my @tot = (0, 0, 0);
+    foreach my $m (sort { $modules{$b}->[0] <=> $modules{$a}->[0] or $a cmp $b } @order)
+    {
+        my ($name) = $m =~ m{([^/]+)$};
+        printf("%-24s %7u %7u %7u\n", $name, @{$modules{$m}});
+        $tot[$_] += $modules{$m}->[$_] for (0..2);
+    }
+    printf("%-24s %7u %7u %7u\n", 'total', @tot);
+
+    print("\n***** usage by region (image, incl. SDK and libraries) *****\n");
+    my $ok = 1;
+    for (my $ix = 0; $ix <= $#regions; $ix++)
+    {
+        my $r = $regions[$ix];
+        my $used = $modules{$image}->[$ix];
+        my $free = $r->{size} - $used;
+        my $res = $free >= $minFree[$ix] ? 'ok' : 'EXCEEDED';
+        printf("budget %s (0x%08x+0x%05x) usage: %6u/%6u (%.1f%%) %6u bytes free (min %u) %s\n",
+               $r->{name}, $r->{start}, $r->{size}, $used, $r->{size}, $used / $r->{size} * 1e2,
+               $free, $minFree[$ix], $res);
+        $ok = 0 if ($free < $minFree[$ix]);
+    }
+    print(STDERR "budget exceeded!\n") unless ($ok);
+    return $ok;
+}
+
+
 ################################################################################
 1;
 __END__
@@ -50,6 +50,9 @@ my $SERVERNAMERE  = qr{^[-_a-zA-Z0-9.]{5,50}$};
 my $JOBIDRE       = qr{^[0-9a-z]{8,8}$};
 my $DBFILE        = $ENV{'REMOTE_USER'} ? "$DATADIR/tschenggins-status-$ENV{'REMOTE_USER'}.json" : "$DATADIR/tschenggins-status.json";
 my $DEFAULTCMD    = 'gui';
+my $CRASHES_MAX   = 5;
+my $LATENCYBINS   = 16;
+my $TELEMETRY_MAX = 144;
 
 #DEBUG("DATADIR=%s, VALIDRESULT=%s, VALIDSTATE=%s", $DATADIR, $VALIDRESULT, $VALIDSTATE);
 
@@ -74,6 +77,8 @@ The following parameters are used in the commands described below.
 
 =item * C<client> -- client ID
 
+=item * C<crash> -- crash record from the client (base64url encoded, see src/crash.h)
+
 =item * C<cmd> -- the command
 
 =item * C<debug> -- debugging on (1) or off (0, default), enabling will pretty-print (JSON) responses
@@ -86,6 +91,12 @@ The following parameters are used in the commands described below.
 
 =item * C<maxch> -- maximum number of channels the client can handle (default 10)
 
+=item * C<melodies> -- comma-separated list of the melody hashes the client has cached
+
+=item * C<melody> -- melody in RTTTL format
+
+=item * C<event> -- event ('success', 'failure')
+
 =item * C<name> -- client or job name
 
 =item * C<offset> -- offset into list of results (default 0)
@@ -104,6 +115,8 @@ The following parameters are used in the commands described below.
 
 =item * C<strlen> -- chop long strings at length (default 256)
 
+=item * C<telemetry> -- telemetry record from the client (comma-separated "key:value" pairs, see src/mon.h)
+
 =item * C<version> -- client software version
 
 =back
@@ -137,6 +150,12 @@ The following parameters are used in the commands described below.
     my $bright   = $q->param('bright')   || '';
     my $noise    = $q->param('noise')    || '';
     my $cfgcmd   = $q->param('cfgcmd')   || '';
+    my $fx       = $q->param('fx')       || '';
+    my $melody   = $q->param('melody')   || '';
+    my $event    = $q->param('event')    || ''; # 'success', 'failure'
+    my $melodies = $q->param('melodies') || '';
+    my $crash    = $q->param('crash')    || '';
+    my $telemetry = $q->param('telemetry') || '';
 
     # application/json POST
     my $contentType = $q->content_type();
@@ -211,7 +230,8 @@ Connection check. Responds with "hi there" (immediately or after a delay).
 
 This expects a application/json POST request. The C<states> array consists of objects with the
 following fields: C<server>, C<name> and optionally C<state> and/or C<result>. A last-changed
-timestamp can be given in C<ts>.
+timestamp can be given in C<ts>. For tracing the update latency the time of the change on the
+Jenkins server can be given in C<tms> (milliseconds since the epoch).
 
 Use the C<tschenggins-watcher.pl> script to watch multiple Jenkins jobs on the Jenkins server, or
 the C<tschenggins-update.pl> script to update single states manually or from scripts, or create your
@@ -282,7 +302,7 @@ This can be used to implement a polling client (but see C<cmd=realtime> for some
 
 =pod
 
-=item B<<  C<< cmd=realtime client=<clientid> [name=<client name>] [staip=<client station IP>] [stassid=<client station SSID>] [version=<client sw version>] [strlen=<number>] [maxch=<number>] >> >>
+=item B<<  C<< cmd=realtime client=<clientid> [name=<client name>] [staip=<client station IP>] [stassid=<client station SSID>] [version=<client sw version>] [strlen=<number>] [maxch=<number>] [melodies=<hashes>] [crash=<record>] [telemetry=<record>] >> >>
 
 Returns info for a client and updates client info. This is persistent connection with real-time
 update as things happen (i.e. the web server will keep sending).
@@ -313,10 +333,25 @@ The "hello" is is followed by the C<client> ID, C<strlen> and the client C<name>
 first "heartbeat", the "config" and the "status" are sent immediately. From then on heartbeats will
 follow every 5 seconds. The status is sent as needed, i.e. as soon as something changes.
 
+If the client config has custom melodies ("melsuccess", "melfailure") that the client doesn't
+have yet (see the C<melodies> parameter), they are sent once after the "config":
+
+    melody 1545832436 5f2a0c1d name:d=4,o=5,b=100:c,e,g\r\n
+
+If a changed job has a latency trace (see C<cmd=update>) a "trace" line with the channel
+index, the time from the Jenkins server to the backend and the time from the backend receiving the
+update to sending it (both in milliseconds) follows the "status":
+
+    trace 1545832449 0 250 800\r\n
+
 Note how the first "status" lists all configured channels (jobs) and how subsequent updates only
 list the changed job(s). The C<strlen> corresponds to the maximum length of individual strings in
 the JSON "config" data, not the whole response line.
 
+If the client crashed it sends the C<crash> record on the next connect. The last few records
+are stored with the client info (see C<cmd=crashes>). Clients that can't send telemetry on the
+side (see C<cmd=telemetry>) send it here.
+
 To test use something like C<curl "https://..../tschenggins-status2.pl?cmd=realtime;client=...">.
 
 =cut
@@ -339,11 +374,59 @@ To test use something like C<curl "https://..../tschenggins-status2.pl?cmd=realt
             $db->{_dirtiness}++;
         }
 
+        # store crash record, keep the last few
+        if (!$error && ($crash =~ m{^[A-Za-z0-9_-]{1,1024}$}))
+        {
+            my $crashes = $db->{clients}->{$client}->{crashes} ||= [];
+            push(@{$crashes}, { ts => int(time()), version => $version || 'unknown', record => $crash });
+            splice(@{$crashes}, 0, $#{$crashes} + 1 - $CRASHES_MAX) if ($#{$crashes} >= $CRASHES_MAX);
+            $db->{_dirtiness}++;
+        }
+
+        # store telemetry record
+        if (!$error && $telemetry)
+        {
+            _telemetryAdd($db, $client, $telemetry);
+        }
+
         # continues in call to _realtime() below... (unless $error)
     }
 
 =pod
 
+=item B<<  C<< cmd=telemetry client=<clientid> [telemetry=<record>] >> >>
+
+Store a telemetry record from a client (sent periodically by the client, see
+C<CONFIG_TELEMETRYPERIOD> in F<config-sample.mk>). The last 144 records (12 hours with the default
+period) are kept per client. Without the C<telemetry> parameter the stored records are listed, one
+per line: timestamp and record.
+
+=cut
+
+    # store or list client telemetry records
+    elsif ($cmd eq 'telemetry')
+    {
+        if ($client && $db->{clients}->{$client})
+        {
+            if ($telemetry)
+            {
+                $error = _telemetryAdd($db, $client, $telemetry);
+                $text = 'ok' unless ($error);
+            }
+            else
+            {
+                $text = join('', map { my $rec = $_; "$rec->{ts} " . join(',', map { "$_:$rec->{$_}" } grep { $_ ne 'ts' } sort keys %{$rec}) . "\n" }
+                             @{$db->{clients}->{$client}->{telemetry} || []}) || "# no telemetry\n";
+            }
+        }
+        else
+        {
+            $error = 'illegal parameter';
+        }
+    }
+
+=pod
+
 =back
 
 =head3 Web Interface Commands
@@ -464,6 +547,31 @@ Returns the raw database (JSON).
 
 =pod
 
+=item B<<  C<< cmd=crashes client=<clientid> >> >>
+
+List the crash records of a client, one per line: timestamp, client software version and
+record. Use C<make crash CRASH=...> (F<tools/symbols.pl>) with the matching firmware to decode.
+
+=cut
+
+    # list client crash records
+    elsif ($cmd eq 'crashes')
+    {
+        if ($client && $db->{clients}->{$client})
+        {
+            $text = join('', map { "$_->{ts} $_->{version} $_->{record}\n" }
+                         @{$db->{clients}->{$client}->{crashes} || []}) || "# no crashes\n";
+        }
+        else
+        {
+            $error = 'illegal parameter';
+        }
+    }
+
+=pod
+
+=pod
+
 =item B<<  C<< cmd=rmclient client=<clientid> >> >>
 
 Remove client info.
@@ -550,9 +658,93 @@ Set client device configuration.
 
 =pod
 
+=item B<<  C<< cmd=cfgfx client=<clientid> [fx=<...>] >> >>
+
+Set client LED effect programs (base64 encoded, see the LEDFX firmware documentation). No or empty
+C<fx> removes the programs.
+
+=cut
+
+    # set client LED effect programs
+    elsif ($cmd eq 'cfgfx')
+    {
+        DEBUG("cfgfx $client $fx");
+        if ($client && $db->{config}->{$client} && ($fx =~ m{^[A-Za-z0-9+/]*={0,2}$}) &&
+            ((length($fx) % 4) == 0) && (length($fx) <= 512))
+        {
+            if ($fx)
+            {
+                $db->{config}->{$client}->{fx} = $fx;
+            }
+            else
+            {
+                delete $db->{config}->{$client}->{fx};
+            }
+            $db->{_dirtiness}++;
+            $text = "client $client set fx $fx";
+            # signal server
+            if ($db->{clients}->{$client}->{pid})
+            {
+                $signalClient = $db->{clients}->{$client}->{pid};
+            }
+        }
+        else
+        {
+            $error = 'illegal parameter';
+        }
+    }
+
+=pod
+
+=item B<<  C<< cmd=cfgmelody client=<clientid> event=<event> [melody=<...>] >> >>
+
+Set client melody (RTTTL format, up to 500 characters) for the given C<event>. No or empty
+C<melody> sets the builtin melody. The melody is sent to the client once and is cached there (see
+C<cmd=realtime>).
+
+=cut
+
+    # set client melody
+    elsif ($cmd eq 'cfgmelody')
+    {
+        DEBUG("cfgmelody $client $event $melody");
+        if ($client && $db->{config}->{$client} && ($event =~ m{^(success|failure)$}) &&
+            (!$melody || ( ($melody =~ m{^[^:\r\n]*:[dob=0-9,]*:[0-9a-gp#.,]+$}) && (length($melody) <= 500) )))
+        {
+            if ($melody)
+            {
+                my $hash = _melodyHash($melody);
+                $db->{melodies}->{$hash} = $melody;
+                $db->{config}->{$client}->{"mel$event"} = $hash;
+            }
+            else
+            {
+                delete $db->{config}->{$client}->{"mel$event"};
+            }
+            # forget melodies no longer used by any client
+            my %used = map { ($_->{melsuccess} || '', 1, $_->{melfailure} || '', 1) } values %{$db->{config}};
+            delete $db->{melodies}->{$_} for (grep { !$used{$_} } keys %{$db->{melodies} || {}});
+            $db->{_dirtiness}++;
+            $text = "client $client set $event melody $melody";
+            # signal server
+            if ($db->{clients}->{$client}->{pid})
+            {
+                $signalClient = $db->{clients}->{$client}->{pid};
+            }
+        }
+        else
+        {
+            $error = 'illegal parameter';
+        }
+    }
+
+=pod
+
 =item B<<  C<< cmd=cfgcmd cfgcmd=<...> >> >>
 
-Send command to client.
+Send command to client. Besides the commands offered in the GUI, there are "melody <hash>" to play
+a cached melody and "loglevel <module> <level>" to change the debug output (e.g. "loglevel all
+warning", see the firmware debug module).
 
 =cut
 
@@ -616,7 +808,8 @@ variable.
 
     if ( !$error && ($cmd eq 'realtime') )
     {
-        _realtime($client, $strlen, { name => $name, staip => $staip, stassid => $stassid, version => $version }); # this doesn't return
+        _realtime($client, $strlen, { name => $name, staip => $staip, stassid => $stassid, version => $version },
+                  [ split(/,/, lc($melodies)) ]); # this doesn't return
         exit(0);
     }
 
@@ -893,6 +1086,18 @@ sub _update
         $db->{jobs}->{$id}->{state}  = $jState       if ($jState);
         $db->{jobs}->{$id}->{result} = $jResult      if ($jResult);
         $db->{_dirtiness}++;
+
+        # latency trace, see _realtime()
+        if ($st->{tms} && ($st->{tms} =~ m{^\d+$}))
+        {
+            my $recvMs = int(time() * 1000);
+            $db->{jobs}->{$id}->{trace} = { tms => int($st->{tms}), recv => $recvMs };
+            _latencyAdd($db, 'update', $recvMs - $st->{tms});
+        }
+        else
+        {
+            delete $db->{jobs}->{$id}->{trace};
+        }
     }
 
     # update multijobs
@@ -990,6 +1195,54 @@ sub _get
     }
 }
 
+# melody hash (32 bits FNV-1a, same as toneMelodyHash() in the firmware)
+sub _melodyHash
+{
+    my ($melody) = @_;
+    my $hash = 0x811c9dc5;
+    foreach my $c (unpack('C*', $melody))
+    {
+        $hash = (($hash ^ $c) * 0x01000193) & 0xffffffff;
+    }
+    return sprintf('%08x', $hash || 1);
+}
+
+# add telemetry record to the client's ring, returns error string
+sub _telemetryAdd
+{
+    my ($db, $client, $record) = @_;
+    if ( (length($record) > 1024) || ($record !~ m{^[A-Za-z0-9_.:,/-]+$}) )
+    {
+        return 'illegal telemetry';
+    }
+    my %rec = ( ts => int(time()) );
+    foreach my $kv (split(/,/, $record))
+    {
+        my ($k, $v) = split(/:/, $kv, 2);
+        $rec{$k} = $v if ($k && defined $v && ($k ne 'ts'));
+    }
+    my $ring = $db->{clients}->{$client}->{telemetry} ||= [];
+    push(@{$ring}, \%rec);
+    splice(@{$ring}, 0, $#{$ring} + 1 - $TELEMETRY_MAX) if ($#{$ring} >= $TELEMETRY_MAX);
+    $db->{_dirtiness}++;
+    return '';
+}
+
+# add value to latency histogram, bins are powers of two [ms] (see _gui_latency())
+sub _latencyAdd
+{
+    my ($db, $hop, $ms) = @_;
+    $ms = 0 if ($ms < 0); # clocks are not perfectly in sync
+    my $hist = $db->{latency}->{$hop} ||= { bins => [ (0) x $LATENCYBINS ], n => 0, sum => 0, max => 0 };
+    my $ix = 0;
+    $ix++ while ( ($ms >= (2 ** $ix)) && ($ix < ($LATENCYBINS - 1)) );
+    $hist->{bins}->[$ix]++;
+    $hist->{n}++;
+    $hist->{sum} += $ms;
+    $hist->{max} = $ms if ($ms > $hist->{max});
+    $db->{_dirtiness}++;
+}
+
 sub _jobs
 {
     my ($db, $client, $strlen, $info) = @_;
@@ -1039,8 +1292,9 @@ sub _jobs
 # curl --raw -s -v -i "http://..../tschenggins-status.pl?cmd=realtime;client=...;debug=1"
 sub _realtime
 {
-    my ($client, $strlen, $info) = @_;
+    my ($client, $strlen, $info, $melodies) = @_;
     print($q->header(-type => 'text/plain', -expires => 'now', charset => 'US-ASCII'));
+    my %haveMelodies = map { $_, 1 } @{$melodies};
     my $n = 0;
     my $nHeartbeat = 0;
     my $lastTs = 0;
@@ -1048,6 +1302,7 @@ sub _realtime
     my $lastConfig = 'not a possible config string';
     my $lastCheck = 0;
     my $startTs = time();
+    my %sentTraces = ();
     my $debugServer = ($q->param('debug') || 0) > 1 ? 1 : 0;
     my $doCheck = 0;
     $SIG{USR1} = sub { $doCheck = 1; };
@@ -1089,6 +1344,7 @@ sub _realtime
             $lastCheck = $now;
         }
 
+        my @sendLatencies = ();
         if ($doCheck)
         {
             $doCheck = 0;
@@ -1147,6 +1403,16 @@ sub _realtime
                     print("\r\nconfig $nowInt $json\r\n");
                     $lastConfig = $config;
                 }
+
+                # send melodies the client doesn't have yet
+                foreach my $hash (grep { $_ } map { $db->{config}->{$client}->{"mel$_"} } qw(success failure))
+                {
+                    if (!$haveMelodies{$hash} && $db->{melodies} && $db->{melodies}->{$hash})
+                    {
+                        print("\r\nmelody $nowInt $hash $db->{melodies}->{$hash}\r\n");
+                        $haveMelodies{$hash} = 1;
+                    }
+                }
             }
             if ($db && $db->{clients} && $db->{clients}->{$client})
             {
@@ -1177,11 +1443,37 @@ sub _realtime
                     {
                         my $json = _jsonEncode(\@changedJobs, 1, 0);
                         print("\r\nstatus $nowInt $json\r\n");
+
+                        # latency traces of the updates we've just sent (but not old ones)
+                        my $sendMs = int(time() * 1000);
+                        foreach my $job (@changedJobs)
+                        {
+                            my $jobId = $db->{config}->{$client}->{jobs}->[ $job->[0] ] || '';
+                            my $trace = $jobId && $db->{jobs}->{$jobId} ? $db->{jobs}->{$jobId}->{trace} : undef;
+                            if ($trace && ($trace->{recv} > ($startTs * 1000)) &&
+                                (!$sentTraces{$job->[0]} || ($sentTraces{$job->[0]} != $trace->{recv})))
+                            {
+                                $sentTraces{$job->[0]} = $trace->{recv};
+                                my $updateMs = $trace->{recv} - $trace->{tms};
+                                my $sentMs = $sendMs - $trace->{recv};
+                                print("\r\ntrace $nowInt $job->[0] " . ($updateMs > 0 ? $updateMs : 0) . " $sentMs\r\n");
+                                push(@sendLatencies, $sentMs);
+                            }
+                        }
                     }
                 }
             }
         }
 
+        # store latencies of the traced updates we've sent
+        if ($#sendLatencies > -1)
+        {
+            my ($dbHandle, $db, $error) = _dbOpen();
+            _latencyAdd($db, 'send', $_) for (@sendLatencies);
+            _dbClose($dbHandle, $db, 0, $error ? 0 : 1);
+            @sendLatencies = ();
+        }
+
         # FIXME: if we just could read some data from the client here to determine if it is still alive..
         # reading from STDIN doesn't show any data... :-(
     }
@@ -1598,6 +1890,8 @@ sub _gui_clients
         my $staIp    = $client->{staip} || 'unknown';
         my $staSsid  = $client->{stassid} || 'unknown';
         my $version  = $client->{version} || 'unknown';
+        my $crashes  = $#{$client->{crashes} || []} + 1;
+        my @sparks   = _gui_sparklines($client->{telemetry});
         my $edit     = $q->span({ -class => 'action action-configure-client', -data_clientid => $clientId }, 'configure');
 
         my @leds = ();
@@ -1619,7 +1913,11 @@ sub _gui_clients
                           $q->td({ -class => 'center nowrap' }, $staIp),
                           $q->td({ -align => 'center nowrap' }, $staSsid),
                           $q->td({ }, $cfgModel),
-                          $q->td({ -class => 'center' }, $version), $q->td({}, $edit)));
+                          $q->td({ -class => 'center' }, $version, $crashes ? ($q->br(),
+                                 $q->a({ -href => ($q->url() . "?cmd=crashes;client=$clientId") }, "$crashes crashes")) : ()),
+                          $q->td({ -class => 'nowrap' }, @sparks ? (join($q->br(), @sparks), $q->br(),
+                                 $q->a({ -href => ($q->url() . "?cmd=telemetry;client=$clientId") }, 'records')) : 'n/a'),
+                          $q->td({}, $edit)));
     }
     return (
          $q->p({}, 'Here is a list of all known Lämpli.'),
@@ -1635,9 +1933,85 @@ sub _gui_clients
                                         $q->th({ -class => 'sort nowrap' }, 'Sta SSID'),
                                         $q->th({ -class => 'sort' }, 'Model'),
                                         $q->th({ -class => 'sort' }, 'Version'),
+                                        $q->th({}, 'Telemetry'),
                                         $q->th({}, 'Actions'),
                                        ),
                              ),
+                   $q->tbody({}, @trs)),
+         _gui_latency($db));
+}
+
+# sparklines of the telemetry records of a client, see _telemetryAdd()
+sub _gui_sparklines
+{
+    my ($ring) = @_;
+    return () unless ($ring && ($#{$ring} > 0));
+
+    # minimal stack of all tasks
+    foreach my $rec (@{$ring})
+    {
+        my @stacks = map { m{/(\d+)$} ? $1 : () } map { $rec->{$_} } grep { m{^t\.} } keys %{$rec};
+        $rec->{_stack} = (sort { $a <=> $b } @stacks)[0] if (@stacks);
+    }
+
+    my @sparks = ();
+    foreach my $metric ([ heap => 'heap' ], [ lrg => 'largest' ], [ _stack => 'stack' ], [ isr => 'isr' ], [ conn => 'conn' ])
+    {
+        my ($key, $label) = @{$metric};
+        my @vals = map { defined $_->{$key} && ($_->{$key} =~ m{^[\d.]+$}) ? $_->{$key} : () } @{$ring};
+        next if ($#vals < 1);
+        my ($min, $max) = ($vals[0], $vals[0]);
+        foreach (@vals) { $min = $_ if ($_ < $min); $max = $_ if ($_ > $max); }
+        my ($w, $h) = (100, 16);
+        my $range = ($max - $min) || 1;
+        my @points = ();
+        for (my $ix = 0; $ix <= $#vals; $ix++)
+        {
+            push(@points, sprintf('%.1f,%.1f', $ix * $w / $#vals, $h - 1 - (($vals[$ix] - $min) * ($h - 2) / $range)));
+        }
+        push(@sparks, qq{<svg class="sparkline" width="$w" height="$h"><title>$label: $vals[-1] ($min..$max)</title>}
+             . qq{<polyline fill="none" stroke="currentColor" points="} . join(' ', @points) . qq{"/></svg> $label $vals[-1]});
+    }
+    delete $_->{_stack} for (@{$ring});
+    return @sparks;
+}
+
+# latency histograms, see _latencyAdd()
+sub _gui_latency
+{
+    my ($db) = @_;
+
+    my %hops = ( update => 'Jenkins &rarr; backend', send => 'backend &rarr; Lämpli (sent)' );
+    my @trs = ();
+    foreach my $hop (qw(update send))
+    {
+        my $hist = $db->{latency} ? $db->{latency}->{$hop} : undef;
+        next unless ($hist && $hist->{n});
+        my @bins = ();
+        for (my $ix = 0; $ix <= $#{$hist->{bins}}; $ix++)
+        {
+            next unless ($hist->{bins}->[$ix]);
+            push(@bins, ($ix ? '&lt;' . (2 ** $ix) : '&lt;1') . "ms:$hist->{bins}->[$ix]");
+        }
+        push(@trs, $q->Tr({},
+                          $q->td({ -class => 'nowrap' }, $hops{$hop}),
+                          $q->td({ -class => 'right' }, $hist->{n}),
+                          $q->td({ -class => 'right' }, sprintf('%.0f', $hist->{sum} / $hist->{n})),
+                          $q->td({ -class => 'right' }, $hist->{max}),
+                          $q->td({}, join(' ', @bins))));
+    }
+    return () if ($#trs < 0);
+    return (
+         $q->p({}, 'Update latencies [ms] (the rest of the way is shown in the Lämpli\'s monitor output).'),
+         $q->table({},
+                   $q->thead({}, $q->Tr({},
+                                        $q->th({}, 'Hop'),
+                                        $q->th({}, 'Count'),
+                                        $q->th({}, 'Avg'),
+                                        $q->th({}, 'Max'),
+                                        $q->th({ -class => 'max-width' }, 'Histogram'),
+                                       ),
+                             ),
                    $q->tbody({}, @trs)));
 }
 
@@ -533,6 +533,9 @@ sub jobDoneCb
         my ($jState, $jResult, $timestamp) = getJenkinsJob($state->{$jobName}->{jobDir}, path($file)->parent());
         DEBUG("Job '%s' has stopped, state is %s and result is '%s'.", $jobName, $jState, $jResult);
 
+        # for tracing the update latency (see cmd=update of tschenggins-status.pl)
+        $state->{$jobName}->{traceMs} = int(time() * 1000);
+
         # set status
         setState($state->{$jobName}, $jState, $jResult, $timestamp);
 
@@ -586,6 +589,10 @@ sub updateBackend
                 $st->{jStateDirty} = 0;
                 $st->{jResultDirty} = 0;
             }
+            if ($st->{traceMs})
+            {
+                $_st->{tms} = delete $st->{traceMs};
+            }
             push(@newUpdates, $_st);
         }
     }